@@ -0,0 +1,276 @@
+# Compares RUXML against other Ruby streaming XML parsers on throughput, allocated objects and GC time.
+#
+#   rake bench                                 # generated corpora, 4 MB each
+#   rake bench BENCH_SIZE_MB=32
+#   rake bench BENCH_FILES=a.xml,b.xml          # your own documents
+#
+# Nokogiri, Ox and REXML are measured when they can be loaded, none of them are dependencies of the gem.
+
+require 'stringio'
+require 'ruxml'
+
+module RUXML
+  module Bench
+    WORDS = %w[lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod tempor &amp; magna aliqua].freeze
+
+    module_function
+
+    def corpora(size)
+      {
+        "text_heavy" => text_heavy(size),
+        "attribute_heavy" => attribute_heavy(size),
+        "deeply_nested" => deeply_nested(size),
+        "small_docs" => small_docs(size),
+        "comment_heavy" => comment_heavy(size),
+      }
+    end
+
+    def text_heavy(size)
+      out = +"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<book>\n"
+      i = 0
+      while out.bytesize < size
+        out << "  <p>" << Array.new(120) { WORDS[(i += 7) % WORDS.size] }.join(" ") << "</p>\n"
+      end
+      out << "</book>\n"
+    end
+
+    def attribute_heavy(size)
+      out = +"<rows>\n"
+      row = 0
+      while out.bytesize < size
+        out << "  <row id=\"#{row}\""
+        24.times { |i| out << " attr#{i}=\"value #{row}-#{i}\"" }
+        out << " sku='SKU-#{format('%08d', row)}'/>\n"
+        row += 1
+      end
+      out << "</rows>\n"
+    end
+
+    def deeply_nested(size)
+      out = +"<root>"
+      while out.bytesize < size
+        256.times { |depth| out << "<level#{depth % 8} n=\"#{depth}\">" }
+        out << "leaf"
+        255.downto(0) { |depth| out << "</level#{depth % 8}>" }
+      end
+      out << "</root>"
+    end
+
+    # Many small documents, parsed one at a time
+    def small_docs(size)
+      docs = []
+      bytes = 0
+      while bytes < size
+        id = docs.size
+        doc = "<?xml version=\"1.0\"?><message id=\"#{id}\" priority=\"high\"><to>queue-#{id % 16}</to>" \
+              "<from>producer</from><body>payload #{id}</body></message>"
+        bytes += doc.bytesize
+        docs << doc
+      end
+      docs
+    end
+
+    def comment_heavy(size)
+      out = +"<log>\n"
+      entry = 0
+      while out.bytesize < size
+        out << "  <!-- entry #{entry}: <not> &parsed; markup - with a hyphen -->\n"
+        out << "  <entry n=\"#{entry}\"><!--inline--></entry>\n"
+        entry += 1
+      end
+      out << "</log>\n"
+    end
+
+    # Each contender reads element names, every attribute and all text, returning the number of nodes seen
+    CONTENDERS = {}
+
+    CONTENDERS["ruxml each"] = lambda do |xml|
+      parser = RUXML::Parser.new
+      parser.open_string("bench", xml)
+      count = 0
+      parser.each do |node|
+        count += 1
+        case node.type
+        when :begin
+          node.text
+          parser.each_attribute { |_name, _value| } if node.attribute_count > 0
+        when :text
+          node.text
+        end
+      end
+      count
+    end
+
+    CONTENDERS["ruxml accessors"] = lambda do |xml|
+      parser = RUXML::Parser.new
+      parser.open_string("bench", xml)
+      count = 0
+      parser.each_node do
+        count += 1
+        case parser.node_type
+        when :begin
+          parser.node_text
+          parser.each_attribute { |_name, _value| } if parser.node_attribute_count > 0
+        when :text
+          parser.node_text
+        end
+      end
+      count
+    end
+
+    begin
+      require 'nokogiri'
+
+      class NokogiriCounter < Nokogiri::XML::SAX::Document
+        attr_reader :count
+
+        def initialize
+          @count = 0
+        end
+
+        def start_element(_name, attrs = [])
+          attrs.each { |_name, _value| }
+          @count += 1
+        end
+
+        def end_element(_name)
+          @count += 1
+        end
+
+        def characters(_text)
+          @count += 1
+        end
+
+        def comment(_text)
+          @count += 1
+        end
+      end
+
+      CONTENDERS["nokogiri sax"] = lambda do |xml|
+        document = NokogiriCounter.new
+        Nokogiri::XML::SAX::Parser.new(document).parse(xml)
+        document.count
+      end
+
+      CONTENDERS["nokogiri reader"] = lambda do |xml|
+        count = 0
+        Nokogiri::XML::Reader(xml).each do |node|
+          count += 1
+          node.name
+          node.attributes if node.attributes?
+          node.value if node.value?
+        end
+        count
+      end
+    rescue LoadError
+    end
+
+    begin
+      require 'ox'
+
+      class OxCounter < ::Ox::Sax
+        attr_reader :count
+
+        def initialize
+          @count = 0
+        end
+
+        def start_element(_name)
+          @count += 1
+        end
+
+        def end_element(_name)
+          @count += 1
+        end
+
+        def attr(_name, _value); end
+
+        def text(_value)
+          @count += 1
+        end
+
+        def comment(_value)
+          @count += 1
+        end
+      end
+
+      CONTENDERS["ox sax"] = lambda do |xml|
+        handler = OxCounter.new
+        ::Ox.sax_parse(handler, StringIO.new(xml))
+        handler.count
+      end
+    rescue LoadError
+    end
+
+    begin
+      require 'rexml/parsers/pullparser'
+
+      CONTENDERS["rexml pull"] = lambda do |xml|
+        parser = REXML::Parsers::PullParser.new(xml)
+        count = 0
+        while parser.has_next?
+          event = parser.pull
+          event[1].each { |_name, _value| } if event.start_element?
+          count += 1
+        end
+        count
+      end
+    rescue LoadError
+    end
+
+    def gc_time_ms
+      stat = GC.stat
+      return stat[:time] if stat.key?(:time)
+      GC::Profiler.total_time * 1000.0
+    end
+
+    def measure(contender, documents)
+      GC.start
+      GC::Profiler.clear
+      objects = GC.stat(:total_allocated_objects)
+      gc_time = gc_time_ms
+      start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      nodes = documents.sum { |xml| contender.call(xml) }
+      seconds = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+      [seconds, nodes, GC.stat(:total_allocated_objects) - objects, gc_time_ms - gc_time]
+    end
+
+    def run(corpora, runs: 3)
+      GC::Profiler.enable unless GC.stat.key?(:time)
+
+      puts format("%-16s %-16s %10s %12s %14s %10s", "corpus", "parser", "MB/s", "nodes/s", "objects", "GC ms")
+      corpora.each do |name, documents|
+        documents = Array(documents)
+        megabytes = documents.sum(&:bytesize) / (1024.0 * 1024.0)
+
+        CONTENDERS.each do |contender_name, contender|
+          # REXML is orders of magnitude slower, keep it to the smaller inputs
+          next if contender_name.start_with?("rexml") && megabytes > 1
+
+          begin
+            seconds, nodes, objects, gc_ms = Array.new(runs) { measure(contender, documents) }.min_by(&:first)
+          rescue StandardError => e
+            puts format("%-16s %-16s failed: %s", name, contender_name, e.message)
+            next
+          end
+
+          puts format("%-16s %-16s %10.1f %12.0f %14d %10.1f", name, contender_name, megabytes / seconds,
+                      nodes / seconds, objects, gc_ms)
+        end
+      end
+    end
+  end
+end
+
+if $PROGRAM_NAME == __FILE__
+  files = ARGV + (ENV["BENCH_FILES"] || "").split(",")
+  corpora =
+    if files.empty?
+      size = (ENV["BENCH_SIZE_MB"] || 4).to_f * 1024 * 1024
+      RUXML::Bench.corpora(size.to_i)
+    else
+      files.to_h { |file| [File.basename(file), File.binread(file)] }
+    end
+
+  RUXML::Bench.run(corpora, runs: (ENV["BENCH_RUNS"] || 3).to_i)
+end
@@ -0,0 +1,498 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ruby/ruby.h>
+
+#include "ruxml/cache.hpp"
+#include "ruxml/parser.hpp"
+#include "ruxml/pipeline.hpp"
+
+extern "C" void Init_ruxml();
+
+//
+// Allocation counting
+//
+
+static uint64_t allocation_count = 0;
+
+#if defined(__GLIBC__)
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) {
+  allocation_count++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  allocation_count++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  allocation_count++;
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+//
+// Corpus generation
+//
+
+struct Corpus {
+  const char *name;
+  char *data;          // Stretchy array
+  int64_t *doc_starts; // Stretchy array, set for corpora of separate documents
+};
+
+static void corpus_print(Corpus *corpus, const char *fmt, ...) {
+  char buffer[1024];
+  va_list v;
+  va_start(v, fmt);
+  auto length = vsnprintf(buffer, sizeof(buffer), fmt, v);
+  va_end(v);
+  assert(length >= 0 && length < (int) sizeof(buffer));
+
+  auto at = alen(corpus->data);
+  asetlen(corpus->data, at + length);
+  memcpy(corpus->data + at, buffer, length);
+}
+
+static const char *words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed",
+                              "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "&amp;", "magna", "aliqua"};
+
+static void generate_text_heavy(Corpus *corpus, int64_t size) {
+  corpus_print(corpus, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<book>\n");
+  uint32_t seed = 1;
+  while (alen(corpus->data) < size) {
+    corpus_print(corpus, "  <p>");
+    for (int i = 0; i < 120; i++) {
+      seed = seed * 1103515245 + 12345;
+      corpus_print(corpus, i ? " %s" : "%s", words[(seed >> 16) % array_size(words)]);
+    }
+    corpus_print(corpus, "</p>\n");
+  }
+  corpus_print(corpus, "</book>\n");
+}
+
+static void generate_attribute_heavy(Corpus *corpus, int64_t size) {
+  corpus_print(corpus, "<rows>\n");
+  int64_t row = 0;
+  while (alen(corpus->data) < size) {
+    corpus_print(corpus, "  <row id=\"%lld\"", (long long) row);
+    for (int i = 0; i < 24; i++) corpus_print(corpus, " attr%d=\"value %lld-%d\"", i, (long long) row, i);
+    corpus_print(corpus, " sku='SKU-%08lld'/>\n", (long long) row);
+    row++;
+  }
+  corpus_print(corpus, "</rows>\n");
+}
+
+static void generate_deeply_nested(Corpus *corpus, int64_t size) {
+  corpus_print(corpus, "<root>");
+  while (alen(corpus->data) < size) {
+    for (int depth = 0; depth < 256; depth++) corpus_print(corpus, "<level%d n=\"%d\">", depth % 8, depth);
+    corpus_print(corpus, "leaf");
+    for (int depth = 255; depth >= 0; depth--) corpus_print(corpus, "</level%d>", depth % 8);
+  }
+  corpus_print(corpus, "</root>");
+}
+
+static void generate_small_docs(Corpus *corpus, int64_t size) {
+  int64_t id = 0;
+  while (alen(corpus->data) < size) {
+    apush(corpus->doc_starts, (int64_t) alen(corpus->data));
+    corpus_print(corpus, "<?xml version=\"1.0\"?><message id=\"%lld\" priority=\"high\">", (long long) id);
+    corpus_print(corpus, "<to>queue-%lld</to><from>producer</from><body>payload %lld</body></message>",
+                 (long long) (id % 16), (long long) id);
+    id++;
+  }
+}
+
+// The lexer does not understand CDATA sections, so this corpus is built from comments only
+static void generate_comment_heavy(Corpus *corpus, int64_t size) {
+  corpus_print(corpus, "<log>\n");
+  int64_t entry = 0;
+  while (alen(corpus->data) < size) {
+    corpus_print(corpus, "  <!-- entry %lld: <not> &parsed; markup - with a hyphen -->\n", (long long) entry);
+    corpus_print(corpus, "  <entry n=\"%lld\"><!--inline--></entry>\n", (long long) entry);
+    entry++;
+  }
+  corpus_print(corpus, "</log>\n");
+}
+
+static int64_t corpus_doc_end(Corpus *corpus, int64_t index) {
+  return index + 1 < alen(corpus->doc_starts) ? corpus->doc_starts[index + 1] : alen(corpus->data);
+}
+
+static bool corpus_write(Corpus *corpus, const char *directory) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.xml", directory, corpus->name);
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Could not write %s\n", path);
+    return false;
+  }
+  fwrite(corpus->data, 1, alen(corpus->data), file);
+  fclose(file);
+  printf("Wrote %s\n", path);
+  return true;
+}
+
+//
+// Measurement
+//
+
+struct Result {
+  double seconds;
+  uint64_t items;
+  uint64_t allocations;
+};
+
+static double now_seconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t lex_document(const char *data, int64_t length) {
+  uint64_t tokens = 0;
+  Parser parser = {};
+  parser_init(&parser);
+  parser_open_memory(&parser, "bench"_str, data, 0, length);
+  while (get_token(&parser).type) tokens++;
+  parser_destroy(&parser);
+  return tokens;
+}
+
+static uint64_t parse_document_with(const char *data, int64_t length, ParserOptions options) {
+  uint64_t nodes = 0;
+  Parser parser = {};
+  parser_init(&parser);
+  parser.options = options;
+  parser_open_memory(&parser, "bench"_str, data, 0, length);
+  while (get_node(&parser).type) nodes++;
+  if (parser.errored) fprintf(stderr, "Benchmark corpus failed to parse\n");
+  parser_destroy(&parser);
+  return nodes;
+}
+
+static uint64_t parse_document(const char *data, int64_t length) { return parse_document_with(data, length, {}); }
+
+// Element names only, as a consumer filtering on them would: attributes are skipped and never read
+static uint64_t parse_document_lazy(const char *data, int64_t length) {
+  ParserOptions options = {};
+  options.lazy_attributes = true;
+  return parse_document_with(data, length, options);
+}
+
+// The variant without line and column counting or comment nodes, as a consumer after the data alone would pick
+static uint64_t parse_document_bare(const char *data, int64_t length) {
+  ParserOptions options = {};
+  options.skip_positions = true;
+  options.skip_comments = true;
+  return parse_document_with(data, length, options);
+}
+
+// Lexing and tree building on a second thread, the caller only replays the recorded nodes
+static uint64_t parse_document_pipelined(const char *data, int64_t length) {
+  uint64_t nodes = 0;
+  Parser parser = {};
+  parser_init(&parser);
+  parser_open_memory(&parser, "bench"_str, data, 0, length);
+  pipeline_start(&parser);
+  while (get_node(&parser).type) nodes++;
+  if (parser.errored) fprintf(stderr, "Benchmark corpus failed to parse\n");
+  parser_destroy(&parser);
+  return nodes;
+}
+
+static Result run_native(Corpus *corpus, uint64_t (*run)(const char *data, int64_t length)) {
+  Result result = {};
+  auto allocations = allocation_count;
+  auto start = now_seconds();
+
+  if (alen(corpus->doc_starts)) {
+    for (int64_t i = 0; i < alen(corpus->doc_starts); i++) {
+      auto doc_start = corpus->doc_starts[i];
+      result.items += run(corpus->data + doc_start, corpus_doc_end(corpus, i) - doc_start);
+    }
+  } else {
+    result.items = run(corpus->data, alen(corpus->data));
+  }
+
+  result.seconds = now_seconds() - start;
+  result.allocations = allocation_count - allocations;
+  return result;
+}
+
+struct RubyBench {
+  ID id_new;
+  ID id_open_string;
+  ID id_next_node;
+  ID id_node_type;
+  ID id_node_text;
+  VALUE parser_class;
+  VALUE total_allocated_objects;
+};
+
+static RubyBench ruby_bench;
+
+static uint64_t parse_ruby_document(VALUE name, VALUE source) {
+  uint64_t nodes = 0;
+  VALUE parser = rb_funcall(ruby_bench.parser_class, ruby_bench.id_new, 0);
+  rb_funcall(parser, ruby_bench.id_open_string, 2, name, source);
+  while (RTEST(rb_funcall(parser, ruby_bench.id_next_node, 0))) {
+    rb_funcall(parser, ruby_bench.id_node_type, 0);
+    rb_funcall(parser, ruby_bench.id_node_text, 0);
+    nodes++;
+  }
+  return nodes;
+}
+
+// Allocations are Ruby objects here, as reported by GC.stat
+static Result run_ruby(Corpus *corpus) {
+  Result result = {};
+  VALUE name = rb_str_new_cstr("bench");
+
+  int64_t doc_count = alen(corpus->doc_starts) ? alen(corpus->doc_starts) : 1;
+  VALUE sources = rb_ary_new_capa(doc_count);
+  for (int64_t i = 0; i < doc_count; i++) {
+    int64_t doc_start = alen(corpus->doc_starts) ? corpus->doc_starts[i] : 0;
+    int64_t doc_end = alen(corpus->doc_starts) ? corpus_doc_end(corpus, i) : alen(corpus->data);
+    rb_ary_push(sources, rb_str_new(corpus->data + doc_start, doc_end - doc_start));
+  }
+
+  auto objects = rb_gc_stat(ruby_bench.total_allocated_objects);
+  auto start = now_seconds();
+  for (int64_t i = 0; i < doc_count; i++) result.items += parse_ruby_document(name, rb_ary_entry(sources, i));
+  result.seconds = now_seconds() - start;
+  result.allocations = rb_gc_stat(ruby_bench.total_allocated_objects) - objects;
+
+  RB_GC_GUARD(sources);
+  return result;
+}
+
+static void report(Corpus *corpus, const char *stage, const char *unit, Result result) {
+  double megabytes = alen(corpus->data) / (1024.0 * 1024.0);
+  printf("%-16s %-10s %10.1f MB/s %10.2f M%s/s %12llu allocs\n", corpus->name, stage, megabytes / result.seconds,
+         result.items / result.seconds / 1e6, unit, (unsigned long long) result.allocations);
+}
+
+static Result best_of(int runs, Result (*run)(Corpus *), Corpus *corpus) {
+  Result best = {};
+  for (int i = 0; i < runs; i++) {
+    auto result = run(corpus);
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+  return best;
+}
+
+static Result run_lexer(Corpus *corpus) { return run_native(corpus, lex_document); }
+
+// Drops the file's pages from the page cache, which works without privileges for clean pages
+static bool evict_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  fdatasync(fd);
+  int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return err == 0;
+}
+
+static Result run_file_cold(char *path, IoStrategy io) {
+  Result result = {};
+  if (!evict_file(path)) fprintf(stderr, "Could not evict %s from the page cache\n", path);
+
+  auto allocations = allocation_count;
+  auto start = now_seconds();
+  Parser parser = {};
+  parser_init(&parser);
+  IoOptions options = {};
+  options.strategy = io;
+  if (parser_open_file(&parser, as_zstring(path), 0, 0, options)) {
+    while (get_node(&parser).type) result.items++;
+  } else {
+    print_error(&parser);
+  }
+  parser_destroy(&parser);
+  result.seconds = now_seconds() - start;
+  result.allocations = allocation_count - allocations;
+  return result;
+}
+
+// Parses each corpus from a file whose pages were just evicted, once per io strategy
+static void report_cold(Corpus *corpus, const char *directory, int runs) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.xml", directory, corpus->name);
+  for (int io = IO_MMAP; io < MAX_IO_STRATEGIES; io++) {
+    Result best = {};
+    for (int i = 0; i < runs; i++) {
+      auto result = run_file_cold(path, (IoStrategy) io);
+      if (i == 0 || result.seconds < best.seconds) best = result;
+    }
+    report(corpus, io_strategy_name((IoStrategy) io), "nodes", best);
+  }
+}
+
+static Result run_file_cached(char *path, char *cache_path, bool cached) {
+  Result result = {};
+  auto allocations = allocation_count;
+  auto start = now_seconds();
+  Parser parser = {};
+  parser_init(&parser);
+  if (cached) {
+    auto status = cache_open(&parser, as_zstring(path), as_zstring(cache_path));
+    if (status != CACHE_CURRENT) fprintf(stderr, "The cache of %s is %s\n", path, cache_status_name(status));
+  } else {
+    parser_open_file(&parser, as_zstring(path));
+  }
+  while (get_node(&parser).type) result.items++;
+  parser_destroy(&parser);
+  result.seconds = now_seconds() - start;
+  result.allocations = allocation_count - allocations;
+  return result;
+}
+
+// Parses each corpus from a warm file, then replays it from an event cache built once up front
+static void report_cached(Corpus *corpus, const char *directory, int runs) {
+  char path[1024];
+  char cache_path[1040];
+  snprintf(path, sizeof(path), "%s/%s.xml", directory, corpus->name);
+  snprintf(cache_path, sizeof(cache_path), "%s.cache", path);
+
+  Parser parser = {};
+  parser_init(&parser);
+  bool built = cache_build(&parser, as_zstring(path), as_zstring(cache_path));
+  parser_destroy(&parser);
+  if (!built) {
+    fprintf(stderr, "Could not write %s\n", cache_path);
+    return;
+  }
+
+  for (int cached = 0; cached < 2; cached++) {
+    Result best = {};
+    for (int i = 0; i < runs; i++) {
+      auto result = run_file_cached(path, cache_path, cached);
+      if (i == 0 || result.seconds < best.seconds) best = result;
+    }
+    report(corpus, cached ? "cached" : "file", "nodes", best);
+  }
+
+  struct stat cache_stat;
+  if (stat(cache_path, &cache_stat) == 0) {
+    printf("%-16s %-10s %10.1fx the source\n", corpus->name, "cache", cache_stat.st_size / (double) alen(corpus->data));
+  }
+}
+
+static Result run_parser(Corpus *corpus) { return run_native(corpus, parse_document); }
+static Result run_parser_lazy(Corpus *corpus) { return run_native(corpus, parse_document_lazy); }
+static Result run_parser_bare(Corpus *corpus) { return run_native(corpus, parse_document_bare); }
+static Result run_parser_pipelined(Corpus *corpus) { return run_native(corpus, parse_document_pipelined); }
+
+//
+// Main
+//
+
+int main(int argc, char **argv) {
+  int64_t size = 16 * 1024 * 1024;
+  int runs = 3;
+  bool ruby = true;
+  const char *write_directory = nullptr;
+  const char *cold_directory = nullptr;
+  const char *cached_directory = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      size = atoll(argv[++i]) * 1024 * 1024;
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--no-ruby") == 0) {
+      ruby = false;
+    } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+      write_directory = argv[++i];
+    } else if (strcmp(argv[i], "--cold") == 0 && i + 1 < argc) {
+      cold_directory = argv[++i];
+    } else if (strcmp(argv[i], "--cached") == 0 && i + 1 < argc) {
+      cached_directory = argv[++i];
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--size MB] [--runs N] [--no-ruby] [--write DIRECTORY] [--cold DIRECTORY] "
+              "[--cached DIRECTORY]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  Corpus corpora[] = {
+      {"text_heavy", nullptr, nullptr},
+      {"attribute_heavy", nullptr, nullptr},
+      {"deeply_nested", nullptr, nullptr},
+      {"small_docs", nullptr, nullptr},
+      {"comment_heavy", nullptr, nullptr},
+  };
+  generate_text_heavy(&corpora[0], size);
+  generate_attribute_heavy(&corpora[1], size);
+  generate_deeply_nested(&corpora[2], size);
+  generate_small_docs(&corpora[3], size);
+  generate_comment_heavy(&corpora[4], size);
+
+  if (write_directory) {
+    for (auto &corpus : corpora) {
+      if (!corpus_write(&corpus, write_directory)) return 1;
+    }
+    return 0;
+  }
+
+  if (cold_directory) {
+    for (auto &corpus : corpora) {
+      if (!corpus_write(&corpus, cold_directory)) return 1;
+      report_cold(&corpus, cold_directory, runs);
+      afree(corpus.data);
+      afree(corpus.doc_starts);
+    }
+    return 0;
+  }
+
+  if (cached_directory) {
+    for (auto &corpus : corpora) {
+      if (!corpus_write(&corpus, cached_directory)) return 1;
+      report_cached(&corpus, cached_directory, runs);
+      afree(corpus.data);
+      afree(corpus.doc_starts);
+    }
+    return 0;
+  }
+
+  if (ruby) {
+    RUBY_INIT_STACK;
+    ruby_init();
+    Init_ruxml();
+    ruby_bench.id_new = rb_intern("new");
+    ruby_bench.id_open_string = rb_intern("open_string");
+    ruby_bench.id_next_node = rb_intern("next_node");
+    ruby_bench.id_node_type = rb_intern("node_type");
+    ruby_bench.id_node_text = rb_intern("node_text");
+    ruby_bench.parser_class = rb_path2class("RUXML::Parser");
+    ruby_bench.total_allocated_objects = ID2SYM(rb_intern("total_allocated_objects"));
+  }
+
+  for (auto &corpus : corpora) {
+    report(&corpus, "lexer", "tokens", best_of(runs, run_lexer, &corpus));
+    report(&corpus, "parser", "nodes", best_of(runs, run_parser, &corpus));
+    report(&corpus, "lazy", "nodes", best_of(runs, run_parser_lazy, &corpus));
+    report(&corpus, "bare", "nodes", best_of(runs, run_parser_bare, &corpus));
+    report(&corpus, "pipeline", "nodes", best_of(runs, run_parser_pipelined, &corpus));
+    if (ruby) report(&corpus, "ruby", "nodes", best_of(runs, run_ruby, &corpus));
+    afree(corpus.data);
+    afree(corpus.doc_starts);
+  }
+
+  if (ruby) ruby_cleanup(0);
+  return 0;
+}
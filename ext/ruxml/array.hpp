@@ -31,5 +31,7 @@ void *acat_(void *array, void *other, uint32_t element_size);
 #define asetlen(array, new_len) ((array) = (decltype(array))afit_((array), new_len, sizeof(*array)), ahdr(array)->len = new_len)
 #define aempty(array) (ahdr(array)->len = 0)
 #define apush(array, item) ((array) = (decltype(array))afit_((array), alen(array) + 1, sizeof(*array)), array[ahdr(array)->len++] = (item))
+#define apop(array) ((array)[--ahdr((array))->len])
+#define adrop(array) ((void) --ahdr((array))->len)
 #define adel(array, index) ((array)[(index)] = (array)[--ahdr((array))->len])
 #define acat(array, other) ((array) = (decltype(array))acat_((array), (other), sizeof(*array)))
\ No newline at end of file
@@ -0,0 +1,573 @@
+#include "cache.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "writer.hpp"
+
+static_assert(sizeof(CachedNode) == 64, "CachedNode is written as is");
+static_assert(sizeof(CachedPositions) == 12, "CachedPositions is written as is");
+static_assert(sizeof(CachedAttribute) == 28, "CachedAttribute is written as is");
+static_assert(sizeof(CachedWideNode) == 128, "CachedWideNode is written as is");
+static_assert(sizeof(CachedWideAttribute) == 56, "CachedWideAttribute is written as is");
+static_assert(sizeof(CacheHeader) == 168, "CacheHeader is written as is");
+
+const char *cache_status_name(CacheStatus status) {
+  switch (status) {
+    case CACHE_CURRENT: return "current";
+    case CACHE_MISSING: return "missing";
+    case CACHE_STALE: return "stale";
+    default: return "unknown";
+  }
+}
+
+static uint32_t cache_options(const ParserOptions *options) {
+  return (uint32_t) options->recover | (uint32_t) options->resolve_namespaces << 1 |
+         (uint32_t) options->validate_utf8 << 2 | (uint32_t) options->skip_whitespace_text << 3 |
+         (uint32_t) options->trim_text << 4 | (uint32_t) options->skip_comments << 5 |
+         (uint32_t) options->lazy_attributes << 6 | (uint32_t) options->skip_positions << 7;
+}
+
+static int64_t mtime_ns(const struct stat *stat_result) {
+#ifdef __APPLE__
+  return (int64_t) stat_result->st_mtimespec.tv_sec * 1000000000 + stat_result->st_mtimespec.tv_nsec;
+#else
+  return (int64_t) stat_result->st_mtim.tv_sec * 1000000000 + stat_result->st_mtim.tv_nsec;
+#endif
+}
+
+inline uint64_t rotate_left(uint64_t value, int bits) { return value << bits | value >> (64 - bits); }
+
+// Four multiply and rotate lanes over 32 byte stripes, so checking a touched file costs about a read of it. Not meant
+// to stand up to anyone crafting collisions, only to tell edited sources apart.
+static uint64_t content_hash(const char *data, int64_t length) {
+  const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+  const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+  uint64_t lanes[4] = {prime1 + prime2, prime2, 0, 0 - prime1};
+
+  int64_t at = 0;
+  for (; length - at >= 32; at += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      memcpy(&word, data + at + lane * 8, 8);
+      lanes[lane] = rotate_left(lanes[lane] + word * prime2, 31) * prime1;
+    }
+  }
+
+  uint64_t hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) +
+                  rotate_left(lanes[3], 18) + (uint64_t) length;
+  for (; at < length; at++) hash = rotate_left(hash ^ ((uint8_t) data[at] * prime1), 11) * prime2;
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  return hash;
+}
+
+inline CachedSpan cached_span(Parser *parser, String text) {
+  if (!text.data) return CachedSpan{-1, 0};
+  return CachedSpan{(int64_t) (text.data - parser->buffer), text.length};
+}
+
+// False for a span outside the source, which only a cache damaged past its header has
+inline bool span_string(Parser *parser, CachedSpan span, String *text) {
+  if (span.start < 0) {
+    *text = String{};
+    return span.length == 0;
+  }
+  if (span.length < 0 || span.start > parser->length || span.length > parser->length - span.start) return false;
+  *text = String{span.length, parser->buffer + span.start};
+  return true;
+}
+
+static CachedError cached_error(Parser *parser, ParserError *error) {
+  CachedError cached = {};
+  cached.code = error->code;
+  cached.character = error->character;
+  cached.expected = error->expected;
+  cached.got = error->got;
+  cached.system_error = error->system_error;
+  cached.open_name = cached_span(parser, error->open_name);
+  cached.end_name = cached_span(parser, error->end_name);
+  cached.offset = error->offset;
+  cached.line = error->line;
+  cached.column = error->column;
+  return cached;
+}
+
+static ParserError parser_error_from(Parser *parser, CachedError *cached) {
+  ParserError error = {};
+  error.code = (ParserErrorCode) cached->code;
+  error.character = cached->character;
+  error.expected = (TokenType) cached->expected;
+  error.got = (TokenType) cached->got;
+  error.system_error = cached->system_error;
+  span_string(parser, cached->open_name, &error.open_name);
+  span_string(parser, cached->end_name, &error.end_name);
+  error.offset = cached->offset;
+  error.line = cached->line;
+  error.column = cached->column;
+  return error;
+}
+
+inline void write_bytes(Writer *writer, const void *data, int64_t length) {
+  writer_raw(writer, String{length, (char *) data});
+}
+
+// False when value is not within an int32 of base, and the node has to be written wide
+inline bool cached_delta(int64_t value, int64_t base, int32_t *delta) {
+  if (value == -1) {
+    *delta = cached_none;
+    return true;
+  }
+  if (value - base <= cached_none || value - base > INT32_MAX) return false;
+  *delta = (int32_t) (value - base);
+  return true;
+}
+
+inline bool cached_delta_span(Parser *parser, String text, int64_t base, int32_t *start, int32_t *length) {
+  *length = (int32_t) text.length;
+  if (!text.data) return cached_delta(-1, base, start);
+  return text.length <= INT32_MAX && cached_delta(text.data - parser->buffer, base, start);
+}
+
+static bool compact_node(Parser *parser, Node *node, int64_t line, CachedNode *record, CachedPositions *positions) {
+  *record = {};
+  record->type = (uint8_t) node->type;
+  record->flags = (node->self_closing ? CACHED_SELF_CLOSING : 0) | (node->whitespace ? CACHED_WHITESPACE : 0);
+  record->attribute_count = node->attribute_count;
+  record->namespace_id = node->namespace_id;
+  record->depth = (int32_t) node->depth;
+  record->offset = node->offset;
+  auto base = node->offset;
+  *positions = CachedPositions{(int32_t) (node->line - line), (int32_t) node->c0, (int32_t) node->c1};
+  return node->depth <= INT32_MAX && positions->line == node->line - line && positions->c0 == node->c0 &&
+         positions->c1 == node->c1 && cached_delta(node->tag_start, base, &record->tag_start) &&
+         cached_delta(node->tag_end, base, &record->tag_end) &&
+         cached_delta(node->content_start, base, &record->content_start) &&
+         cached_delta(node->content_end, base, &record->content_end) &&
+         cached_delta(node->element_start, base, &record->element_start) &&
+         cached_delta_span(parser, node->xml_namespace, base, &record->namespace_start, &record->namespace_length) &&
+         cached_delta_span(parser, node->text, base, &record->text_start, &record->text_length);
+}
+
+static bool compact_attribute(Parser *parser, Attribute *attribute, int64_t base, CachedAttribute *record) {
+  record->namespace_id = attribute->namespace_id;
+  return cached_delta_span(parser, attribute->xml_namespace, base, &record->namespace_start,
+                           &record->namespace_length) &&
+         cached_delta_span(parser, attribute->name, base, &record->name_start, &record->name_length) &&
+         cached_delta_span(parser, attribute->value, base, &record->value_start, &record->value_length);
+}
+
+static void write_wide_node(Writer *writer, Parser *parser, Node *node) {
+  CachedWideNode record = {};
+  record.type = (uint8_t) node->type;
+  record.flags = CACHED_WIDE | (node->self_closing ? CACHED_SELF_CLOSING : 0) |
+                 (node->whitespace ? CACHED_WHITESPACE : 0);
+  record.attribute_count = node->attribute_count;
+  record.namespace_id = node->namespace_id;
+  record.depth = node->depth;
+  record.line = node->line;
+  record.c0 = node->c0;
+  record.c1 = node->c1;
+  record.offset = node->offset;
+  record.tag_start = node->tag_start;
+  record.tag_end = node->tag_end;
+  record.content_start = node->content_start;
+  record.content_end = node->content_end;
+  record.element_start = node->element_start;
+  record.xml_namespace = cached_span(parser, node->xml_namespace);
+  record.text = cached_span(parser, node->text);
+  write_bytes(writer, &record, sizeof(record));
+}
+
+static void write_wide_attribute(Writer *writer, Parser *parser, Attribute *attribute) {
+  CachedWideAttribute record = {};
+  record.namespace_id = attribute->namespace_id;
+  record.xml_namespace = cached_span(parser, attribute->xml_namespace);
+  record.name = cached_span(parser, attribute->name);
+  record.value = cached_span(parser, attribute->value);
+  write_bytes(writer, &record, sizeof(record));
+}
+
+// Writes the current node and its attributes, compact when they all fit. Returns the bytes written.
+static int64_t write_node(Writer *writer, Parser *parser, int64_t line) {
+  auto node = &parser->node;
+  CachedNode record;
+  CachedPositions positions;
+  CachedAttribute cached;
+  bool compact = compact_node(parser, node, line, &record, &positions);
+  rewind_attributes(parser);
+  for (int i = 0; i < node->attribute_count && compact; i++) {
+    auto attribute = get_attribute(parser);
+    compact = compact_attribute(parser, &attribute, node->offset, &cached);
+  }
+
+  rewind_attributes(parser);
+  if (compact) {
+    bool skip_positions = parser->options.skip_positions;
+    write_bytes(writer, &record, sizeof(record));
+    if (!skip_positions) write_bytes(writer, &positions, sizeof(positions));
+    for (int i = 0; i < node->attribute_count; i++) {
+      auto attribute = get_attribute(parser);
+      compact_attribute(parser, &attribute, node->offset, &cached);
+      write_bytes(writer, &cached, sizeof(cached));
+    }
+    return sizeof(record) + (skip_positions ? 0 : sizeof(positions)) + node->attribute_count * sizeof(cached);
+  }
+
+  write_wide_node(writer, parser, node);
+  for (int i = 0; i < node->attribute_count; i++) {
+    auto attribute = get_attribute(parser);
+    write_wide_attribute(writer, parser, &attribute);
+  }
+  return sizeof(CachedWideNode) + node->attribute_count * sizeof(CachedWideAttribute);
+}
+
+static bool write_failed(int fd, char *temporary) {
+  int system_error = errno;
+  if (fd >= 0) close(fd);
+  unlink(temporary);
+  raw_free(temporary);
+  errno = system_error;
+  return false;
+}
+
+bool cache_build(Parser *parser, String filename, String cache_path, IoOptions io) {
+  // Created first, a cache that can not be written fails before any of the file is parsed. Each build gets a file of
+  // its own next to the cache, so builds running at once never rename a half written one into place.
+  auto temporary = (char *) raw_allocate_size(cache_path.length + 8);
+  snprintf(temporary, cache_path.length + 8, "%.*s.XXXXXX", str_prt(cache_path));
+  int fd = mkstemp(temporary);
+  if (fd < 0) {
+    raw_free(temporary);
+    return false;
+  }
+  if (fchmod(fd, 0644) != 0) return write_failed(fd, temporary); // mkstemp leaves it readable by the owner alone
+
+  auto path = str_to_zstr(filename);
+  struct stat source_stat;
+  bool found = stat(path, &source_stat) == 0;
+  raw_free(path);
+  // Stat first, a change landing while the file is parsed then leaves the cache stale rather than wrongly current
+  if (!parser_open_file(parser, filename, 0, 0, io) || !found) {
+    int system_error = parser->errored ? parser->error.system_error : errno;
+    write_failed(fd, temporary);
+    errno = system_error;
+    return false;
+  }
+
+  Writer writer;
+  writer_init_fd(&writer, fd);
+  CacheHeader header = {};
+  write_bytes(&writer, &header, sizeof(header)); // Filled in once the counts are known
+
+  int64_t line = 0;
+  while (get_node(parser).type) {
+    parse_attributes(parser);
+    header.records_length += write_node(&writer, parser, line);
+    header.node_count++;
+    header.attribute_count += parser->node.attribute_count;
+    line = parser->node.line;
+  }
+
+  // The URIs go along, as namespace ids are only meaningful to the parser that interned them
+  header.namespace_count = alen(parser->namespaces);
+  int64_t uri_start = 0;
+  for (int64_t i = 0; i < header.namespace_count; i++) {
+    auto uri = parser->namespaces[i].uri;
+    CachedSpan span = {uri_start, uri.length};
+    write_bytes(&writer, &span, sizeof(span));
+    uri_start += uri.length;
+  }
+  for (int64_t i = 0; i < header.namespace_count; i++) writer_raw(&writer, parser->namespaces[i].uri);
+
+  header.magic = cache_magic;
+  header.version = cache_version;
+  header.options = cache_options(&parser->options);
+  header.file_size = source_stat.st_size;
+  header.file_mtime_ns = mtime_ns(&source_stat);
+  header.source_length = parser->length;
+  header.content_hash = content_hash(parser->buffer, parser->length);
+  header.error_count = parser->error_count;
+  header.error = cached_error(parser, &parser->error);
+  header.errored = parser->errored;
+
+  bool written = writer_flush(&writer);
+  writer_destroy(&writer);
+  if (!written || pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+    return write_failed(fd, temporary);
+  }
+  if (close(fd) != 0) return write_failed(-1, temporary);
+
+  auto final_path = str_to_zstr(cache_path);
+  bool renamed = rename(temporary, final_path) == 0;
+  raw_free(final_path);
+  if (!renamed) return write_failed(-1, temporary);
+  raw_free(temporary);
+  return true;
+}
+
+// Reads and checks the header, and whether the source still has the size and mtime the cache was written for
+static CacheStatus check_header(Parser *parser, String filename, int fd, CacheHeader *header, bool *touched) {
+  struct stat cache_stat;
+  if (fstat(fd, &cache_stat) != 0) return CACHE_MISSING;
+  if (pread(fd, header, sizeof(*header), 0) != (ssize_t) sizeof(*header)) return CACHE_MISSING;
+  if (header->magic != cache_magic || header->version != cache_version) return CACHE_MISSING;
+  auto size = (int64_t) cache_stat.st_size - (int64_t) sizeof(*header);
+  if (header->records_length < 0 || header->records_length > size) return CACHE_MISSING; // Cut short
+  if (header->node_count < 0 || header->node_count > header->records_length / (int64_t) sizeof(CachedNode)) {
+    return CACHE_MISSING;
+  }
+  if (header->attribute_count < 0 || header->attribute_count > size / (int64_t) sizeof(CachedAttribute)) {
+    return CACHE_MISSING;
+  }
+  if (header->namespace_count < 0 || header->namespace_count > size / (int64_t) sizeof(CachedSpan)) {
+    return CACHE_MISSING;
+  }
+  auto table = header->namespace_count * (int64_t) sizeof(CachedSpan);
+  if (header->records_length + table > size) return CACHE_MISSING;
+  if (header->options != cache_options(&parser->options)) return CACHE_STALE;
+
+  auto path = str_to_zstr(filename);
+  struct stat source_stat;
+  bool found = stat(path, &source_stat) == 0;
+  raw_free(path);
+  if (!found || source_stat.st_size != header->file_size) return CACHE_STALE;
+  *touched = mtime_ns(&source_stat) != header->file_mtime_ns;
+  return CACHE_CURRENT;
+}
+
+static bool map_cache(NodeCache *cache, int fd, CacheHeader *header) {
+  struct stat cache_stat;
+  if (fstat(fd, &cache_stat) != 0) return false;
+  auto mapping = mmap(nullptr, cache_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) return false;
+  madvise(mapping, cache_stat.st_size, MADV_SEQUENTIAL);
+
+  cache->mapping = (char *) mapping;
+  cache->mapping_length = cache_stat.st_size;
+  cache->events = cache->mapping + sizeof(*header);
+  cache->events_end = cache->events + header->records_length;
+  return true;
+}
+
+// Interns the cached namespace URIs into parser, which may well give them other ids than the writer did
+static bool map_namespaces(Parser *parser, NodeCache *cache, CacheHeader *header) {
+  auto spans = (const CachedSpan *) cache->events_end;
+  auto uris = cache->events_end + header->namespace_count * sizeof(CachedSpan);
+  auto uris_length = cache->mapping + cache->mapping_length - uris;
+  for (int64_t i = 0; i < header->namespace_count; i++) {
+    auto span = spans[i];
+    if (span.start < 0 || span.length < 0 || span.start > uris_length || span.length > uris_length - span.start) {
+      return false;
+    }
+    apush(cache->namespace_ids, intern_namespace(parser, String{span.length, (char *) uris + span.start}));
+  }
+  return true;
+}
+
+CacheStatus cache_open(Parser *parser, String filename, String cache_path, IoOptions io) {
+  auto path = str_to_zstr(cache_path);
+  int fd = open(path, O_RDONLY);
+  raw_free(path);
+
+  CacheHeader header = {};
+  bool touched = false;
+  auto status = fd < 0 ? CACHE_MISSING : check_header(parser, filename, fd, &header, &touched);
+
+  if (status == CACHE_CURRENT) {
+    // A current cache means the source passed validate_utf8 when it was written, or failed it and the cache says so
+    auto options = parser->options;
+    parser->options.validate_utf8 = false;
+    bool opened = parser_open_file(parser, filename, 0, 0, io);
+    parser->options = options;
+    if (!opened || parser->length != header.source_length) {
+      status = CACHE_STALE;
+    } else if (touched && content_hash(parser->buffer, parser->length) != header.content_hash) {
+      status = CACHE_STALE;
+    }
+  }
+
+  auto cache = raw_allocate_type_zero(NodeCache);
+  if (status == CACHE_CURRENT && (!map_cache(cache, fd, &header) || !map_namespaces(parser, cache, &header))) {
+    status = CACHE_MISSING;
+  }
+  if (fd >= 0) close(fd);
+
+  if (status != CACHE_CURRENT) {
+    if (cache->mapping) munmap(cache->mapping, cache->mapping_length);
+    afree(cache->namespace_ids);
+    raw_free(cache);
+    parser_open_file(parser, filename, 0, 0, io);
+    return status;
+  }
+
+  parser->cache = cache;
+  parser->replay = &cache->batch;
+  parser->replay_node = 0;
+  parser->replay_attribute = 0;
+  parser->error_count = header.error_count;
+  cache->batch.errored = header.errored;
+  cache->batch.error = parser_error_from(parser, &header.error);
+  cache->batch.error_count = header.error_count;
+  return CACHE_CURRENT;
+}
+
+void cache_close(Parser *parser) {
+  auto cache = parser->cache;
+  if (!cache) return;
+
+  munmap(cache->mapping, cache->mapping_length);
+  afree(cache->namespace_ids);
+  afree(cache->batch.nodes);
+  afree(cache->batch.attributes);
+  raw_free(cache);
+  parser->cache = nullptr;
+  parser->replay = nullptr;
+}
+
+inline int32_t namespace_id(NodeCache *cache, int32_t id) {
+  return id >= 0 && id < (int32_t) alen(cache->namespace_ids) ? cache->namespace_ids[id] : NAMESPACE_NONE;
+}
+
+// Ends the replay with an error, for records that do not fit the source
+static bool damaged(NodeCache *cache) {
+  cache->events = cache->events_end;
+  cache->batch.errored = true;
+  cache->batch.error = ParserError{};
+  cache->batch.error.code = PE_OPEN_FAILED;
+  cache->batch.error.system_error = EINVAL;
+  return true;
+}
+
+// Offsets are looked up in the buffer, e.g. by passthrough and the replay of a broken element
+inline bool in_source(Parser *parser, int64_t offset) { return offset >= -1 && offset <= parser->length; }
+
+inline int64_t from_delta(int32_t delta, int64_t base) { return delta == cached_none ? -1 : base + delta; }
+
+inline bool delta_string(Parser *parser, int32_t start, int32_t length, int64_t base, String *text) {
+  return span_string(parser, CachedSpan{from_delta(start, base), length}, text);
+}
+
+// Reads a record of type T, false when the records end first
+template <typename T>
+inline bool read_record(NodeCache *cache, T *record) {
+  if (cache->events_end - cache->events < (int64_t) sizeof(T)) return false;
+  memcpy(record, cache->events, sizeof(T));
+  cache->events += sizeof(T);
+  return true;
+}
+
+static bool read_node(Parser *parser, NodeCache *cache, uint8_t flags, Node *node) {
+  if (flags & CACHED_WIDE) {
+    CachedWideNode record;
+    if (!read_record(cache, &record)) return false;
+    node->type = (NodeType) record.type;
+    node->attribute_count = record.attribute_count;
+    node->namespace_id = namespace_id(cache, record.namespace_id);
+    node->depth = record.depth;
+    node->line = record.line;
+    node->c0 = record.c0;
+    node->c1 = record.c1;
+    node->offset = record.offset;
+    node->tag_start = record.tag_start;
+    node->tag_end = record.tag_end;
+    node->content_start = record.content_start;
+    node->content_end = record.content_end;
+    node->element_start = record.element_start;
+    if (!span_string(parser, record.xml_namespace, &node->xml_namespace)) return false;
+    if (!span_string(parser, record.text, &node->text)) return false;
+  } else {
+    CachedNode record;
+    if (!read_record(cache, &record)) return false;
+    CachedPositions positions = {};
+    if (!parser->options.skip_positions && !read_record(cache, &positions)) return false;
+    auto base = record.offset;
+    node->type = (NodeType) record.type;
+    node->attribute_count = record.attribute_count;
+    node->namespace_id = namespace_id(cache, record.namespace_id);
+    node->depth = record.depth;
+    node->line = cache->line + positions.line;
+    node->c0 = positions.c0;
+    node->c1 = positions.c1;
+    node->offset = base;
+    node->tag_start = from_delta(record.tag_start, base);
+    node->tag_end = from_delta(record.tag_end, base);
+    node->content_start = from_delta(record.content_start, base);
+    node->content_end = from_delta(record.content_end, base);
+    node->element_start = from_delta(record.element_start, base);
+    if (!delta_string(parser, record.namespace_start, record.namespace_length, base, &node->xml_namespace)) {
+      return false;
+    }
+    if (!delta_string(parser, record.text_start, record.text_length, base, &node->text)) return false;
+  }
+  node->self_closing = flags & CACHED_SELF_CLOSING;
+  node->whitespace = flags & CACHED_WHITESPACE;
+  cache->line = node->line;
+  return node->type != NODE_INVALID && node->type < MAX_NODE_TYPES && node->attribute_count >= 0 &&
+         in_source(parser, node->offset) && in_source(parser, node->tag_start) && in_source(parser, node->tag_end) &&
+         in_source(parser, node->content_start) && in_source(parser, node->content_end) &&
+         in_source(parser, node->element_start);
+}
+
+static bool read_attribute(Parser *parser, NodeCache *cache, bool wide, int64_t base, Attribute *attribute) {
+  if (wide) {
+    CachedWideAttribute record;
+    if (!read_record(cache, &record)) return false;
+    attribute->namespace_id = namespace_id(cache, record.namespace_id);
+    return span_string(parser, record.xml_namespace, &attribute->xml_namespace) &&
+           span_string(parser, record.name, &attribute->name) && span_string(parser, record.value, &attribute->value);
+  }
+
+  CachedAttribute record;
+  if (!read_record(cache, &record)) return false;
+  attribute->namespace_id = namespace_id(cache, record.namespace_id);
+  return delta_string(parser, record.namespace_start, record.namespace_length, base, &attribute->xml_namespace) &&
+         delta_string(parser, record.name_start, record.name_length, base, &attribute->name) &&
+         delta_string(parser, record.value_start, record.value_length, base, &attribute->value);
+}
+
+bool cache_next(Parser *parser) {
+  auto cache = parser->cache;
+  if (cache->events == cache->events_end) return false;
+
+  auto batch = &cache->batch;
+  aclear(batch->nodes);
+  aclear(batch->attributes);
+  auto vocabulary = vocabulary_empty(&parser->vocabulary) ? nullptr : &parser->vocabulary;
+
+  // Decoded in place, a Node is twice the size of its record and copying it again shows in the replay
+  asetlen(batch->nodes, cache_batch_nodes);
+  int64_t count = 0;
+  bool intact = true;
+  while (intact && count < cache_batch_nodes && cache->events != cache->events_end) {
+    auto node = &batch->nodes[count];
+    uint8_t flags = cache->events_end - cache->events > 1 ? (uint8_t) cache->events[1] : 0;
+    intact = read_node(parser, cache, flags, node);
+    node->name_id = 0;
+    if (intact && vocabulary && (node->type == NODE_ELEMENT_BEGIN || node->type == NODE_ELEMENT_END)) {
+      node->name_id = vocabulary_lookup(vocabulary, node->text);
+    }
+
+    for (int i = 0; intact && i < node->attribute_count; i++) {
+      Attribute attribute = {};
+      intact = read_attribute(parser, cache, flags & CACHED_WIDE, node->offset, &attribute);
+      attribute.name_id = vocabulary ? vocabulary_lookup(vocabulary, attribute.name) : 0;
+      apush(batch->attributes, attribute);
+    }
+    if (intact) count++; // After its attributes, a node cut off by damage is never handed out
+  }
+  asetlen(batch->nodes, count);
+  if (!intact) damaged(cache);
+
+  parser->replay = batch;
+  parser->replay_node = 0;
+  parser->replay_attribute = 0;
+  return true;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+
+#include "parser.hpp"
+
+// An event cache holds the node stream of one file as parsed with one set of options, so that later opens of the file
+// replay it through get_node instead of lexing the text again. Layout, in host byte order:
+//
+//   CacheHeader
+//   node_count node records, each followed by its attribute_count attribute records
+//   namespace_count CachedSpan entries, spans of the namespace URI bytes that follow them
+//
+// A node is a CachedNode, then CachedPositions unless the options skip positions, and its attributes are
+// CachedAttribute records. Offsets in these are int32 deltas from the node's offset, which is enough for any node whose
+// tag and text fit in 2 GB; one that does not, such as the end of a larger element, is written wide instead, as a
+// CachedWideNode with CachedWideAttribute records. Records hold no pointers, text is a span of the source buffer. The
+// source is mapped as usual when the cache is opened, so it has to hold the same bytes: a cache is current when the
+// file has the recorded size and either the recorded mtime or, after a touch or a copy, the recorded content hash.
+
+static const uint64_t cache_magic = 0x3156454C4D585552ull; // "RUXMLEV1"
+static const uint32_t cache_version = 2;
+static const int64_t cache_batch_nodes = 4096;
+
+enum CacheStatus : uint8_t {
+  CACHE_CURRENT, // Nodes come from the cache
+  CACHE_MISSING, // No cache file, or not one this version can read
+  CACHE_STALE,   // The file changed, or the cache was written with different options
+
+  MAX_CACHE_STATUSES
+};
+
+struct CachedSpan {
+  int64_t start; // Offset in the source buffer, -1 for a null String
+  int64_t length;
+};
+
+static const int32_t cached_none = INT32_MIN; // A delta for an offset of -1 or the start of a null String
+
+struct CachedNode {
+  uint8_t type;
+  uint8_t flags; // CACHED_SELF_CLOSING, CACHED_WHITESPACE, CACHED_WIDE
+  uint16_t reserved;
+  int32_t attribute_count;
+  int32_t namespace_id; // As interned by the parser that wrote the cache, see CacheHeader::namespace_count
+  int32_t depth;
+  int64_t offset;
+  int32_t tag_start; // This and the rest relative to offset
+  int32_t tag_end;
+  int32_t content_start;
+  int32_t content_end;
+  int32_t element_start;
+  int32_t namespace_start;
+  int32_t namespace_length;
+  int32_t text_start;
+  int32_t text_length;
+  int32_t reserved2;
+};
+
+struct CachedPositions {
+  int32_t line; // Relative to the line of the node before
+  int32_t c0;
+  int32_t c1;
+};
+
+struct CachedAttribute {
+  int32_t namespace_id;
+  int32_t namespace_start; // This and the rest relative to the offset of the node
+  int32_t namespace_length;
+  int32_t name_start;
+  int32_t name_length;
+  int32_t value_start;
+  int32_t value_length;
+};
+
+static const uint8_t CACHED_SELF_CLOSING = 1;
+static const uint8_t CACHED_WHITESPACE = 2;
+static const uint8_t CACHED_WIDE = 4;
+
+// Type and flags come first as in CachedNode, which tells the two apart
+struct CachedWideNode {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t reserved;
+  int32_t attribute_count;
+  int32_t namespace_id;
+  int32_t reserved2;
+  int64_t depth;
+  int64_t line;
+  int64_t c0;
+  int64_t c1;
+  int64_t offset;
+  int64_t tag_start;
+  int64_t tag_end;
+  int64_t content_start;
+  int64_t content_end;
+  int64_t element_start;
+  CachedSpan xml_namespace;
+  CachedSpan text;
+};
+
+struct CachedWideAttribute {
+  int32_t namespace_id;
+  int32_t reserved;
+  CachedSpan xml_namespace;
+  CachedSpan name;
+  CachedSpan value;
+};
+
+struct CachedError {
+  uint8_t code;
+  char character;
+  uint16_t expected;
+  uint16_t got;
+  uint16_t reserved;
+  int32_t system_error;
+  int32_t reserved2;
+  CachedSpan open_name;
+  CachedSpan end_name;
+  int64_t offset;
+  int64_t line;
+  int64_t column;
+};
+
+struct CacheHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t options;      // Bits of the ParserOptions the stream was parsed with
+  int64_t file_size;     // Of the source file
+  int64_t file_mtime_ns; // Of the source file
+  int64_t source_length; // Of the parser buffer, which differs from file_size for a UTF-16 source
+  uint64_t content_hash; // Of the parser buffer
+  int64_t node_count;
+  int64_t attribute_count;
+  int64_t records_length; // Bytes of node and attribute records
+  int64_t namespace_count;
+  int64_t error_count;
+  CachedError error;
+  uint8_t errored;
+  uint8_t reserved[7];
+};
+
+// Maps a cache and decodes it a batch at a time into a recording that replay_node hands out, as a NodePipeline does
+struct NodeCache {
+  char *mapping;
+  int64_t mapping_length;
+  const char *events;     // Next record to decode
+  const char *events_end; // Where the namespace table starts
+  int64_t line;           // Of the last node decoded, CachedPositions::line is relative to it
+  int32_t *namespace_ids; // Stretchy array, the reading parser's id for each namespace id in the cache
+  ParserRecording batch;  // Stretchy arrays are cleared and refilled for every batch
+};
+
+// Parses filename to the end with the options of parser and writes its event cache to cache_path, through a temporary
+// file renamed into place. Parse errors are cached along with the nodes. Returns false when the file could not be
+// opened, see Parser::error, or when the cache could not be written, with errno set. A temporary file that can not be
+// created fails the build before the file is opened.
+bool cache_build(Parser *parser, String filename, String cache_path, IoOptions io = {});
+// Opens filename for get_node to replay from the cache at cache_path when it is current for the file and the options
+// of parser. Otherwise opens filename to be parsed as usual and says why the cache was not used.
+CacheStatus cache_open(Parser *parser, String filename, String cache_path, IoOptions io = {});
+// Unmaps the cache, called by reset_state and parser_destroy
+void cache_close(Parser *parser);
+
+// Moves parser on to the next batch of cached nodes. False after the last one.
+bool cache_next(Parser *parser);
+
+const char *cache_status_name(CacheStatus status);
@@ -0,0 +1,183 @@
+#include "columns.hpp"
+
+static const int64_t max_timestamp_seconds = INT64_MAX / 1000000000 - 1;
+
+inline void set_bit(uint8_t *bits, int64_t index, bool value) {
+  if (value) bits[index >> 3] |= (uint8_t) (1 << (index & 7));
+}
+
+// Grows a bitmap to hold row index, new bytes start out zero
+inline void fit_bits(uint8_t **bits_ptr, int64_t index) {
+  auto bits = *bits_ptr;
+  int64_t length = alen(bits);
+  if (index >> 3 < length) return;
+  asetlen(bits, (index >> 3) + 1);
+  bits[length] = 0;
+  *bits_ptr = bits;
+}
+
+template <typename T>
+inline void push_fixed(char **data_ptr, T value) {
+  auto data = *data_ptr;
+  auto at = alen(data);
+  asetlen(data, at + sizeof(T));
+  memcpy(data + at, &value, sizeof(T));
+  *data_ptr = data;
+}
+
+static __int128 power_of_ten(int32_t exponent) {
+  __int128 result = 1;
+  while (exponent-- > 0) result *= 10;
+  return result;
+}
+
+void columns_init(ColumnTable *table, RecordSchema *schema) {
+  *table = ColumnTable{};
+  table->schema = schema;
+  asetlen(table->columns, schema->field_count);
+  for (int i = 0; i < schema->field_count; i++) {
+    table->columns[i] = Column{};
+    table->columns[i].type = schema->fields[i].type;
+  }
+  columns_clear(table);
+}
+
+void columns_destroy(ColumnTable *table) {
+  for (int i = 0; i < (int) alen(table->columns); i++) {
+    afree(table->columns[i].validity);
+    afree(table->columns[i].offsets);
+    afree(table->columns[i].data);
+  }
+  afree(table->columns);
+  afree(table->pending);
+}
+
+void columns_clear(ColumnTable *table) {
+  table->row_count = 0;
+  for (int i = 0; i < (int) alen(table->columns); i++) {
+    auto column = &table->columns[i];
+    column->null_count = 0;
+    column->scale = 0;
+    aclear(column->validity);
+    aclear(column->data);
+    aclear(column->offsets);
+    if (column->type == VT_STRING) apush(column->offsets, 0);
+  }
+}
+
+static bool value_fits(Value *value) {
+  if (value->state == VS_INVALID) return false;
+  if (value->state == VS_PRESENT && value->type == VT_TIME) {
+    auto seconds = value->time.seconds;
+    return seconds >= -max_timestamp_seconds && seconds <= max_timestamp_seconds;
+  }
+  return true;
+}
+
+static void append_decimal(Column *column, int64_t row, Decimal decimal) {
+  if (decimal.scale > column->scale) {
+    // Rescale what is there already, this happens at most once per extra digit of scale
+    auto factor = power_of_ten(decimal.scale - column->scale);
+    for (int64_t i = 0; i < row; i++) {
+      __int128 stored;
+      memcpy(&stored, column->data + i * sizeof(stored), sizeof(stored));
+      stored *= factor;
+      memcpy(column->data + i * sizeof(stored), &stored, sizeof(stored));
+    }
+    column->scale = decimal.scale;
+  }
+  push_fixed(&column->data, (__int128) decimal.unscaled * power_of_ten(column->scale - decimal.scale));
+}
+
+// Arrow string offsets are int32, so no column of a batch grows past INT32_MAX bytes, nor a batch past INT32_MAX rows
+static bool row_fits(ColumnTable *table, Value *values) {
+  if (table->row_count >= INT32_MAX) return false;
+  for (int i = 0; i < (int) alen(table->columns); i++) {
+    auto column = &table->columns[i];
+    bool string = column->type == VT_STRING && values[i].state == VS_PRESENT;
+    int64_t size = string ? values[i].text.length : (int64_t) sizeof(__int128);
+    if ((int64_t) alen(column->data) + size > INT32_MAX) return false;
+  }
+  return true;
+}
+
+int columns_append(ColumnTable *table, Value *values) {
+  int field_count = (int) alen(table->columns);
+  for (int i = 0; i < field_count; i++) {
+    if (!value_fits(&values[i])) return i;
+  }
+  if (!row_fits(table, values)) {
+    if (table->row_count) return columns_full;
+    for (int i = 0; i < field_count; i++) {
+      if (values[i].state == VS_PRESENT && values[i].text.length > INT32_MAX) {
+        values[i].state = VS_INVALID;
+        return i;
+      }
+    }
+  }
+
+  auto row = table->row_count;
+  for (int i = 0; i < field_count; i++) {
+    auto column = &table->columns[i];
+    auto value = &values[i];
+    bool present = value->state == VS_PRESENT;
+
+    fit_bits(&column->validity, row);
+    set_bit(column->validity, row, present);
+    if (!present) column->null_count++;
+
+    switch (column->type) {
+      case VT_STRING: {
+        if (present) {
+          auto at = alen(column->data);
+          asetlen(column->data, at + value->text.length);
+          memcpy(column->data + at, value->text.data, value->text.length);
+        }
+        apush(column->offsets, (int32_t) alen(column->data));
+        break;
+      }
+      case VT_INT64: push_fixed(&column->data, present ? value->int64 : (int64_t) 0); break;
+      case VT_FLOAT: push_fixed(&column->data, present ? value->float64 : 0.0); break;
+      case VT_BOOL: {
+        auto bits = (uint8_t *) column->data;
+        fit_bits(&bits, row);
+        set_bit(bits, row, present && value->boolean);
+        column->data = (char *) bits;
+        break;
+      }
+      case VT_TIME: {
+        int64_t nanoseconds = present ? value->time.seconds * 1000000000 + value->time.nanoseconds : 0;
+        push_fixed(&column->data, nanoseconds);
+        break;
+      }
+      case VT_DECIMAL: append_decimal(column, row, present ? value->decimal : Decimal{}); break;
+      default: break;
+    }
+  }
+
+  table->row_count++;
+  return -1;
+}
+
+int columns_read(Parser *parser, ColumnTable *table, Value *values, int64_t max_rows) {
+  int64_t rows = 0;
+  if (alen(table->pending)) {
+    memcpy(values, table->pending, sizeof(Value) * alen(table->pending));
+    aclear(table->pending);
+    int invalid = columns_append(table, values); // A string too long for any batch
+    if (invalid >= 0) return invalid;
+    rows++;
+  }
+
+  while ((max_rows == 0 || rows < max_rows) && record_next(parser, table->schema, values)) {
+    int invalid = columns_append(table, values);
+    if (invalid == columns_full) {
+      asetlen(table->pending, alen(table->columns));
+      memcpy(table->pending, values, sizeof(Value) * alen(table->columns));
+      break;
+    }
+    if (invalid >= 0) return invalid;
+    rows++;
+  }
+  return -1;
+}
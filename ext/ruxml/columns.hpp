@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "record.hpp"
+
+// Record fields collected into contiguous column buffers, laid out like Arrow arrays so they can be handed over without
+// conversion:
+//   validity - one bit per row, least significant bit first, set when the row has a value
+//   offsets  - strings only, row_count + 1 int32 offsets into data
+//   data     - string bytes, int64 values, float64 values, bits for bools, int64 nanoseconds since the epoch for times
+//              (timestamp[ns, UTC]), or 16 byte little-endian decimal128 values with the column scale
+struct Column {
+  ValueType type;
+  int32_t scale; // Decimals only: the largest scale seen, every value is stored with it
+  int64_t null_count;
+
+  uint8_t *validity; // Stretchy array
+  int32_t *offsets;  // Stretchy array
+  char *data;        // Stretchy array
+};
+
+struct ColumnTable {
+  RecordSchema *schema;
+  Column *columns; // One per schema field
+  int64_t row_count;
+  Value *pending;  // Stretchy array, the row that ended the previous batch early, see columns_read
+};
+
+static const int columns_full = -2;
+
+void columns_init(ColumnTable *table, RecordSchema *schema);
+void columns_destroy(ColumnTable *table);
+void columns_clear(ColumnTable *table); // Empties the buffers for the next batch, keeping their memory
+
+// Appends a row. Returns the index of a field whose value did not parse (nothing is appended then), columns_full when
+// the row would take a column past 2 GB, the most int32 string offsets can address, or -1. A string value over 2 GB
+// does not fit any batch and is marked invalid.
+int columns_append(ColumnTable *table, Value *values);
+
+// Reads up to max_rows records (0 for all of them) into the table. values is scratch space, one per field. Returns the
+// field index of an invalid value, stopping at its record, or -1. A batch that fills up ends early, keeping the record
+// that did not fit as pending for the next columns_read into the table. Its values point into the parser buffer, so
+// only the same source can be read on.
+int columns_read(Parser *parser, ColumnTable *table, Value *values, int64_t max_rows);
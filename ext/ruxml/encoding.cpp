@@ -0,0 +1,147 @@
+#include "encoding.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const char *source_encoding_name(SourceEncoding encoding) {
+  switch (encoding) {
+    case SE_UTF8: return "UTF-8";
+    case SE_UTF16LE: return "UTF-16LE";
+    case SE_UTF16BE: return "UTF-16BE";
+    default: return "unknown";
+  }
+}
+
+int detect_encoding(const char *data, int64_t length, SourceEncoding *encoding) {
+  auto bytes = (const uint8_t *) data;
+  *encoding = SE_UTF8;
+  if (length >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) return 3;
+  if (length >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+    *encoding = SE_UTF16LE;
+    return 2;
+  }
+  if (length >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+    *encoding = SE_UTF16BE;
+    return 2;
+  }
+
+  // No byte order mark, but "<?" in UTF-16 is unambiguous
+  if (length >= 4 && bytes[0] == '<' && bytes[1] == 0 && bytes[2] == '?' && bytes[3] == 0) *encoding = SE_UTF16LE;
+  if (length >= 4 && bytes[0] == 0 && bytes[1] == '<' && bytes[2] == 0 && bytes[3] == '?') *encoding = SE_UTF16BE;
+  return 0;
+}
+
+inline bool is_continuation(uint8_t c) { return (c & 0xC0) == 0x80; }
+
+// Length of the well-formed sequence starting with a non-ASCII byte, 0 when it is malformed
+static int sequence_length(const uint8_t *ptr, const uint8_t *end) {
+  auto c = ptr[0];
+  auto available = end - ptr;
+  if (c < 0xC2) return 0; // A stray continuation byte, or an overlong two byte form
+  if (c < 0xE0) return available >= 2 && is_continuation(ptr[1]) ? 2 : 0;
+
+  if (c < 0xF0) {
+    if (available < 3) return 0;
+    uint8_t low = c == 0xE0 ? 0xA0 : 0x80; // Overlong
+    uint8_t high = c == 0xED ? 0x9F : 0xBF; // Surrogates
+    return ptr[1] >= low && ptr[1] <= high && is_continuation(ptr[2]) ? 3 : 0;
+  }
+
+  if (c < 0xF5) {
+    if (available < 4) return 0;
+    uint8_t low = c == 0xF0 ? 0x90 : 0x80;  // Overlong
+    uint8_t high = c == 0xF4 ? 0x8F : 0xBF; // Past U+10FFFF
+    return ptr[1] >= low && ptr[1] <= high && is_continuation(ptr[2]) && is_continuation(ptr[3]) ? 4 : 0;
+  }
+  return 0;
+}
+
+int64_t utf8_validate(const char *data, int64_t length) {
+  auto start = (const uint8_t *) data;
+  auto ptr = start;
+  auto end = start + length;
+
+  while (ptr != end) {
+#if defined(__SSE2__)
+    // Markup is almost all ASCII, so skip 16 bytes at a time until a byte has its top bit set
+    while (end - ptr >= 16) {
+      int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ptr));
+      if (mask) {
+        ptr += __builtin_ctz(mask);
+        break;
+      }
+      ptr += 16;
+    }
+    if (ptr == end) break;
+#endif
+
+    if (*ptr < 0x80) {
+      ptr++;
+      continue;
+    }
+    auto sequence = sequence_length(ptr, end);
+    if (!sequence) return ptr - start;
+    ptr += sequence;
+  }
+  return -1;
+}
+
+inline uint32_t load_unit(const uint8_t *ptr, bool big_endian) {
+  return big_endian ? (uint32_t) ptr[0] << 8 | ptr[1] : (uint32_t) ptr[1] << 8 | ptr[0];
+}
+
+int64_t utf16_to_utf8(const char *data, int64_t length, bool big_endian, char *output) {
+  auto start = (const uint8_t *) data;
+  auto ptr = start;
+  auto end = start + (length & ~(int64_t) 1);
+  auto out = (uint8_t *) output;
+
+  while (ptr != end) {
+#if defined(__SSE2__)
+    // Eight ASCII code units narrow to eight bytes with one saturating pack
+    const __m128i non_ascii = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    while (end - ptr >= 16) {
+      __m128i units = _mm_loadu_si128((const __m128i *) ptr);
+      if (big_endian) units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, non_ascii), zero)) != 0xFFFF) break;
+      _mm_storel_epi64((__m128i *) out, _mm_packus_epi16(units, units));
+      ptr += 16;
+      out += 8;
+    }
+    if (ptr == end) break;
+#endif
+
+    // One code unit, or a surrogate pair, at a time until the next chance of an ASCII run
+    auto unit = load_unit(ptr, big_endian);
+    if (unit < 0x80) {
+      *out++ = (uint8_t) unit;
+      ptr += 2;
+    } else if (unit < 0x800) {
+      *out++ = (uint8_t) (0xC0 | unit >> 6);
+      *out++ = (uint8_t) (0x80 | (unit & 0x3F));
+      ptr += 2;
+    } else if (unit >= 0xD800 && unit <= 0xDBFF) {
+      if (end - ptr < 4) return -(ptr - start + 1);
+      auto low = load_unit(ptr + 2, big_endian);
+      if (low < 0xDC00 || low > 0xDFFF) return -(ptr - start + 1);
+      uint32_t code_point = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+      *out++ = (uint8_t) (0xF0 | code_point >> 18);
+      *out++ = (uint8_t) (0x80 | (code_point >> 12 & 0x3F));
+      *out++ = (uint8_t) (0x80 | (code_point >> 6 & 0x3F));
+      *out++ = (uint8_t) (0x80 | (code_point & 0x3F));
+      ptr += 4;
+    } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+      return -(ptr - start + 1);
+    } else {
+      *out++ = (uint8_t) (0xE0 | unit >> 12);
+      *out++ = (uint8_t) (0x80 | (unit >> 6 & 0x3F));
+      *out++ = (uint8_t) (0x80 | (unit & 0x3F));
+      ptr += 2;
+    }
+  }
+
+  if (length & 1) return -length; // The odd trailing byte is at length - 1
+  return (char *) out - output;
+}
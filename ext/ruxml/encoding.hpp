@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+// The encoding a source arrived in. The parser itself always works on UTF-8, UTF-16 sources are transcoded first.
+enum SourceEncoding : uint8_t {
+  SE_UTF8,
+  SE_UTF16LE,
+  SE_UTF16BE,
+
+  MAX_SOURCE_ENCODINGS
+};
+
+// Looks at a byte order mark, or without one at the first characters of an XML declaration (XML 1.0 appendix F).
+// Returns the length of the byte order mark to skip, 0 when there is none.
+int detect_encoding(const char *data, int64_t length, SourceEncoding *encoding);
+
+// Returns the offset of the first byte that is not part of well-formed UTF-8, or -1 when all of it is. Overlong forms,
+// surrogates and code points past U+10FFFF are rejected. ASCII runs are checked 16 bytes at a time.
+int64_t utf8_validate(const char *data, int64_t length);
+
+// Transcodes UTF-16 into output, which needs room for length / 2 * 3 bytes. Returns the number of bytes written, or
+// -(offset + 1) for the input offset of an odd trailing byte or an unpaired surrogate.
+int64_t utf16_to_utf8(const char *data, int64_t length, bool big_endian, char *output);
+
+const char *source_encoding_name(SourceEncoding encoding);
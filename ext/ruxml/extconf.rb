@@ -1,5 +1,11 @@
 require "mkmf"
 
 have_library 'stdc++'
+have_library 'pthread'
+
+# Parser#stats counters sit on the path of every token and node, so they are opt-in like the lexer/parser timings,
+# which cost two clock reads per token. Without them Parser#stats returns nil.
+$defs << "-DPARSER_STATS" if enable_config("stats", false)
+$defs << "-DPARSER_STATS -DPARSER_STATS_TIMING" if enable_config("stats-timing", false)
 
 create_makefile 'ruxml/ruxml'
\ No newline at end of file
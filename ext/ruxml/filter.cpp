@@ -0,0 +1,51 @@
+#include "filter.hpp"
+
+#include <cstring>
+
+inline void copy_source(Parser *parser, Writer *writer, int64_t from, int64_t to) {
+  if (to > from) writer_raw(writer, String{(int64_t) (to - from), parser->buffer + from});
+}
+
+// Consumes nodes up to and including the end of the element begun by node
+static Node skip_element(Parser *parser, Node node) {
+  while (true) {
+    auto next = get_node(parser);
+    if (next.type == NODE_INVALID) return next;
+    if (next.type == NODE_ELEMENT_END && next.depth == node.depth) return next;
+  }
+}
+
+bool filter_passthrough(Parser *parser, Writer *writer, FilterFunc filter, void *data) {
+  if (parser->encoding != SE_UTF8) return false;
+  int64_t copy_from = parser->ptr - parser->buffer;
+  if (copy_from == 3 && !memcmp(parser->buffer, "\xEF\xBB\xBF", 3)) copy_from = 0; // Keeps a skipped byte order mark
+
+  while (true) {
+    auto node = get_node(parser);
+    if (node.type == NODE_INVALID) break;
+    if (node.type == NODE_ELEMENT_END) continue;
+
+    auto action = filter(data, parser, &node);
+    if (action == FILTER_KEEP) continue;
+
+    bool has_content = node.type == NODE_ELEMENT_BEGIN && !node.self_closing;
+    if (action == FILTER_DROP) {
+      copy_source(parser, writer, copy_from, node.tag_start);
+      copy_from = node.tag_end;
+      if (has_content) {
+        auto end = skip_element(parser, node);
+        if (end.type == NODE_INVALID) break;
+        copy_from = end.tag_end;
+      }
+    } else if (has_content) {
+      copy_source(parser, writer, copy_from, node.tag_end);
+      auto end = skip_element(parser, node);
+      if (end.type == NODE_INVALID) break;
+      copy_from = end.tag_start;
+    }
+  }
+
+  if (parser->errored) return false;
+  copy_source(parser, writer, copy_from, parser->length);
+  return !writer->failed;
+}
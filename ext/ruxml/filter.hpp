@@ -0,0 +1,18 @@
+#pragma once
+
+#include "parser.hpp"
+#include "writer.hpp"
+
+enum FilterAction : uint8_t {
+  FILTER_KEEP,
+  FILTER_DROP,         // Drop the node, for an element begin this drops the whole element
+  FILTER_DROP_CONTENT  // Keep the element's tags but drop everything between them
+};
+
+// Called for every node except element ends
+using FilterFunc = FilterAction (*)(void *data, Parser *parser, Node *node);
+
+// Copies the rest of the parser's source to the writer, leaving out what the filter drops. Kept bytes are copied
+// straight from the parser buffer by offset, nothing is re-serialized. Returns false when the source did not parse or
+// the writer failed, and for UTF-16 sources, whose buffer is a UTF-8 copy that would not match their declaration.
+bool filter_passthrough(Parser *parser, Writer *writer, FilterFunc filter, void *data);
@@ -0,0 +1,210 @@
+#include "io.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.hpp"
+
+static const int64_t io_read_chunk = 4 * 1024 * 1024;
+
+struct IoPrefetch {
+  pthread_t thread;
+  const char *data;
+  int64_t length;
+  int64_t page_size;
+  std::atomic<int64_t> position;
+  std::atomic<bool> stop;
+};
+
+const char *io_strategy_name(IoStrategy strategy) {
+  switch (strategy) {
+    case IO_AUTO: return "auto";
+    case IO_MMAP: return "mmap";
+    case IO_SEQUENTIAL: return "sequential";
+    case IO_POPULATE: return "populate";
+    case IO_PREFETCH: return "prefetch";
+    case IO_READ: return "read";
+    default: return "unknown";
+  }
+}
+
+inline int64_t min_int64(int64_t a, int64_t b) { return a < b ? a : b; }
+
+static void advise_sequential(int fd, int64_t offset, int64_t length) {
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+static bool map_file(FileSource *source, int fd, int64_t offset) {
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (source->strategy == IO_POPULATE) flags |= MAP_POPULATE;
+#endif
+  auto mapping = mmap(nullptr, source->mapping_length, PROT_READ, flags, fd, offset);
+  if (mapping == MAP_FAILED) return false;
+  source->mapping = (char *) mapping;
+
+  if (source->strategy == IO_SEQUENTIAL || source->strategy == IO_PREFETCH) {
+    advise_sequential(fd, offset, source->mapping_length);
+    madvise(mapping, source->mapping_length, MADV_SEQUENTIAL);
+    // Gets the first window in flight before the lexer faults on it
+    madvise(mapping, min_int64(source->mapping_length, io_prefetch_window), MADV_WILLNEED);
+  }
+#ifndef MAP_POPULATE
+  if (source->strategy == IO_POPULATE) madvise(mapping, source->mapping_length, MADV_WILLNEED);
+#endif
+  return true;
+}
+
+static bool read_file(FileSource *source, int fd, int64_t offset) {
+  advise_sequential(fd, offset, source->mapping_length);
+
+  auto buffer = (char *) mmap(nullptr, source->mapping_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                              -1, 0);
+  if (buffer == MAP_FAILED) return false;
+#ifdef MADV_HUGEPAGE
+  madvise(buffer, source->mapping_length, MADV_HUGEPAGE);
+#endif
+
+  int64_t done = 0;
+  while (done < source->mapping_length) {
+    auto got = pread(fd, buffer + done, min_int64(source->mapping_length - done, io_read_chunk), offset + done);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) {
+      int system_error = got == 0 ? EIO : errno; // Zero means the range runs past the end of the file
+      munmap(buffer, source->mapping_length);
+      errno = system_error;
+      return false;
+    }
+    done += got;
+  }
+
+  mprotect(buffer, source->mapping_length, PROT_READ);
+  source->mapping = buffer;
+  return true;
+}
+
+static void *prefetch_main(void *data) {
+  auto prefetch = (IoPrefetch *) data;
+  volatile char sink = 0;
+  int64_t touched = 0;
+  while (touched < prefetch->length && !prefetch->stop.load(std::memory_order_relaxed)) {
+    auto limit = min_int64(prefetch->position.load(std::memory_order_relaxed) + io_prefetch_window, prefetch->length);
+    if (touched >= limit) {
+      usleep(100);
+      continue;
+    }
+
+    // One read per page faults it in, checking for stop every 64 pages so closing does not wait for a whole window
+    auto batch_end = min_int64(limit, touched + 64 * prefetch->page_size);
+    for (; touched < batch_end; touched += prefetch->page_size) sink = sink + prefetch->data[touched];
+  }
+  return nullptr;
+}
+
+static void start_prefetch(FileSource *source) {
+  auto prefetch = raw_allocate_type_zero(IoPrefetch);
+  prefetch->data = source->data;
+  prefetch->length = source->length;
+  prefetch->page_size = sysconf(_SC_PAGESIZE);
+  prefetch->position = 0;
+  prefetch->stop = false;
+
+  if (pthread_create(&prefetch->thread, nullptr, prefetch_main, prefetch) != 0) {
+    raw_free(prefetch); // Still a sequential mapping, just without the thread
+    return;
+  }
+  source->prefetch = prefetch;
+}
+
+void io_prefetch_advance(IoPrefetch *prefetch, int64_t position) {
+  prefetch->position.store(position, std::memory_order_relaxed);
+}
+
+void io_release(FileSource *source, int64_t mapped) {
+  int64_t page_size = sysconf(_SC_PAGESIZE);
+  int64_t release_end = (mapped - source->window) & ~(page_size - 1);
+  if (release_end <= source->released) return;
+
+  madvise(source->mapping + source->released, release_end - source->released, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(source->fd, source->file_offset + source->released, release_end - source->released,
+                POSIX_FADV_DONTNEED);
+#endif
+  source->released = release_end;
+}
+
+static bool open_failed(FileSource *source, int fd) {
+  int system_error = errno;
+  if (fd >= 0) close(fd);
+  *source = FileSource{};
+  errno = system_error;
+  return false;
+}
+
+bool io_open(FileSource *source, const char *path, int64_t offset, int64_t length, IoOptions options) {
+  *source = FileSource{};
+  auto strategy = options.strategy;
+  if (options.window && strategy == IO_READ) {
+    errno = EINVAL; // Released pages of a private buffer would read back as zeros
+    return false;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return open_failed(source, fd);
+
+  struct stat stat_result;
+  if (fstat(fd, &stat_result) < 0) return open_failed(source, fd);
+  if (length == 0) length = stat_result.st_size - offset;
+  // A mapping of a range past the end of the file would only fail with SIGBUS once the lexer touches it
+  if (offset < 0 || length < 0 || offset > stat_result.st_size - length) {
+    errno = EINVAL;
+    return open_failed(source, fd);
+  }
+
+  if (strategy == IO_AUTO) {
+    strategy = length <= io_populate_limit && !options.window ? IO_POPULATE : IO_SEQUENTIAL;
+  }
+  source->strategy = strategy;
+  source->length = length;
+  if (length == 0) {
+    close(fd); // Nothing to map, mmap refuses empty ranges
+    return true;
+  }
+
+  // mmap wants a page aligned offset, so the mapping starts up to a page before the requested range
+  int64_t page_size = sysconf(_SC_PAGESIZE);
+  int64_t aligned_offset = offset & ~(page_size - 1);
+  source->mapping_length = offset - aligned_offset + length;
+
+  bool success = strategy == IO_READ ? read_file(source, fd, aligned_offset) : map_file(source, fd, aligned_offset);
+  if (!success) return open_failed(source, fd);
+
+  source->data = source->mapping + (offset - aligned_offset);
+  if (options.window) {
+    source->window = options.window < page_size ? page_size : options.window;
+    source->file_offset = aligned_offset;
+    source->fd = fd;
+  } else {
+    close(fd); // A mapping keeps the file open by itself
+  }
+  if (strategy == IO_PREFETCH) start_prefetch(source);
+  return true;
+}
+
+void io_close(FileSource *source) {
+  if (source->prefetch) {
+    source->prefetch->stop = true;
+    pthread_join(source->prefetch->thread, nullptr);
+    raw_free(source->prefetch);
+  }
+  if (source->mapping) munmap(source->mapping, source->mapping_length);
+  if (source->window) close(source->fd);
+  *source = FileSource{};
+}
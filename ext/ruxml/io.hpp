@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// How a file gets into memory. The parser needs the whole range in one contiguous buffer, since nodes point into it.
+enum IoStrategy : uint8_t {
+  IO_AUTO,       // IO_POPULATE up to io_populate_limit bytes, IO_SEQUENTIAL above
+  IO_MMAP,       // Plain shared mapping, pages fault in as the lexer reaches them
+  IO_SEQUENTIAL, // Mapping with MADV_SEQUENTIAL and POSIX_FADV_SEQUENTIAL, so the kernel reads ahead aggressively
+  IO_POPULATE,   // MAP_POPULATE, every page is read before the open returns
+  IO_PREFETCH,   // IO_SEQUENTIAL plus a thread touching pages up to io_prefetch_window bytes ahead of the reader
+  IO_READ,       // pread into a private buffer, backed by huge pages where the kernel allows it
+
+  MAX_IO_STRATEGIES
+};
+
+static const int64_t io_populate_limit = 4 * 1024 * 1024;
+static const int64_t io_prefetch_window = 16 * 1024 * 1024;
+
+struct IoOptions {
+  IoStrategy strategy;
+  // Streaming window in bytes, 0 to keep the whole file resident. Pages further than this behind the reader are handed
+  // back to the kernel, so memory stays bounded whatever the file size. Nodes pointing behind the window stay valid,
+  // their pages fault back in from the file. Mapped strategies only, IO_READ has no file to fault back in from.
+  int64_t window;
+};
+
+struct IoPrefetch;
+
+struct FileSource {
+  IoStrategy strategy; // As resolved, never IO_AUTO after io_open
+  char *data;          // Start of the requested range
+  int64_t length;
+
+  char *mapping; // Page aligned start of the mapping or read buffer, data lies inside it
+  int64_t mapping_length;
+
+  IoPrefetch *prefetch; // IO_PREFETCH only
+
+  int64_t window;      // See IoOptions::window
+  int64_t released;    // Bytes of the mapping released so far, a page multiple
+  int64_t file_offset; // Where the mapping starts in the file
+  int fd;              // Kept open with a window, to drop released pages from the page cache as well
+};
+
+// Opens length bytes from offset, or the rest of the file for length 0. On failure returns false with errno set, EINVAL
+// for a range that does not lie within the file.
+bool io_open(FileSource *source, const char *path, int64_t offset, int64_t length, IoOptions options);
+void io_close(FileSource *source);
+
+void io_prefetch_advance(IoPrefetch *prefetch, int64_t position);
+// Releases the pages more than a window behind mapped, an offset in the mapping rather than the data
+void io_release(FileSource *source, int64_t mapped);
+
+// Tells the source the reader no longer needs data before position. Feeds the prefetch thread and, once a window's
+// worth has built up behind the window, releases it in one go.
+inline void io_advance(FileSource *source, int64_t position) {
+  if (source->prefetch) io_prefetch_advance(source->prefetch, position);
+  auto mapped = source->data - source->mapping + position; // released counts from the mapping, before a range offset
+  if (source->window && mapped - source->released >= 2 * source->window) io_release(source, mapped);
+}
+
+const char *io_strategy_name(IoStrategy strategy);
@@ -1,14 +1,55 @@
 #include "parser.hpp"
+#include "cache.hpp"
+#include "pipeline.hpp"
 
+#include <cerrno>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef PARSER_STATS_TIMING
+#include <ctime>
+
+inline uint64_t stats_now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+// Compile-time switches for the lexer and node parsers. Every combination is instantiated once and a source is parsed
+// by the one matching its options, so the inner loops carry no checks for features that are off.
+template <bool Positions, bool Comments, bool Namespaces>
+struct ParsePolicy {
+  static const bool positions = Positions;   // Count lines and columns, off with skip_positions
+  static const bool comments = Comments;     // Hand out comment nodes, off with skip_comments
+  static const bool namespaces = Namespaces; // resolve_namespaces
+};
+
+struct ParserVariant {
+  Token (*read_token)(Parser *parser);
+  void (*parse_node)(Parser *parser); // get_node for sources that are not replayed
+  bool (*parse_attribute_list)(Parser *parser, Node *node, Token *end_token, bool *prefixed_attributes);
+};
+
+static const ParserVariant *select_variant(const ParserOptions *options);
 
 void parser_init(Parser *parser) {
+  parser->variant = select_variant(&parser->options);
   parser->line = 1;
   parser->col = 1;
   parser->current_attribute_block = &parser->attribute_block;
 
+  arena_init(&parser->arena, "parser");
+  vocabulary_init(&parser->vocabulary);
+  parser->arena.min_block_size = 64 * 1024;
+
   for (int i = 0; i < 128; i++) parser->tag_initial_map[i] = LA_INVALID;
   for (int i = 128; i < 256; i++) parser->tag_initial_map[i] = LA_IDENTIFIER; // UTF-8 characters are allowed
   parser->tag_initial_map[' '] = LA_WHITESPACE;
@@ -35,85 +76,281 @@ void parser_init(Parser *parser) {
   parser->identifier_map['-'] = 1;
   parser->identifier_map['_'] = 1;
   parser->identifier_map['.'] = 1;
+
+  // Static strings rather than arena copies, so parsers that never resolve a namespace allocate no arena block
+  static const String predefined[] = {String{}, "http://www.w3.org/XML/1998/namespace"_str,
+                                      "http://www.w3.org/2000/xmlns/"_str};
+  for (auto uri : predefined) apush(parser->namespaces, (Namespace{str_hash(uri), uri}));
+}
+
+// Everything that belongs to the previously opened source, so a parser can be opened again
+static void reset_state(Parser *parser) {
+  pipeline_stop(parser); // Before the source goes, the thread is reading it
+  cache_close(parser);
+  if (parser->source_type == PST_FILE) io_close(&parser->file);
+  raw_free(parser->transcoded);
+  parser->transcoded = nullptr;
+  parser->encoding = SE_UTF8;
+  parser->source_type = PST_NONE;
+  parser->buffer = nullptr;
+  parser->length = 0;
+  parser->variant = select_variant(&parser->options);
+  parser->line = 1;
+  parser->col = 1;
+  parser->located_offset = 0;
+  parser->located_line = 0;
+  parser->done = false;
+  parser->errored = false;
+  parser->error = {};
+  parser->error_count = 0;
+  parser->mode = LM_OUT;
+  parser->has_next_token = false;
+  parser->node = {};
+  parser->attribute_block.count = 0;
+  parser->attributes_pending = false;
+  parser->attribute_index_built = false;
+  parser->attribute_id_index_built = false;
+  rewind_attributes(parser);
+  parser->depth = 0;
+  aclear(parser->open_elements);
+  parser->broken_element = {};
+  aclear(parser->namespace_bindings);
+  parser->replay = nullptr;
+#ifdef PARSER_STATS
+  parser->stats = {};
+#endif
+}
+
+// Errors found before parsing starts, located by counting lines from start up to the offending code unit
+static bool encoding_error(Parser *parser, const char *data, int64_t start, int64_t offset, int unit_size) {
+  Token token = {};
+  token.offset = offset;
+  token.line = 1;
+  token.c0 = 1;
+  for (int64_t i = start; i + unit_size <= offset; i += unit_size) {
+    bool newline;
+    if (unit_size == 1) {
+      newline = data[i] == '\n';
+    } else if (parser->encoding == SE_UTF16BE) {
+      newline = !data[i] && data[i + 1] == '\n';
+    } else {
+      newline = data[i] == '\n' && !data[i + 1];
+    }
+
+    if (newline) {
+      token.line++;
+      token.c0 = 1;
+    } else {
+      token.c0++;
+    }
+  }
+  parser_error(parser, PE_INVALID_ENCODING, token, data[offset]);
+  return false;
+}
+
+// Skips a byte order mark, transcodes UTF-16 and, with validate_utf8, checks the source before any of it is parsed
+static bool prepare_source(Parser *parser) {
+  auto skip = detect_encoding(parser->buffer, parser->length, &parser->encoding);
+  if (parser->encoding != SE_UTF8) {
+    auto length = parser->length - skip;
+    auto output = (char *) raw_allocate_size(length / 2 * 3 + 1);
+    auto written = utf16_to_utf8(parser->buffer + skip, length, parser->encoding == SE_UTF16BE, output);
+    if (written < 0) {
+      raw_free(output);
+      return encoding_error(parser, parser->buffer, skip, skip - written - 1, 2);
+    }
+
+    if (parser->source_type == PST_FILE) {
+      auto strategy = parser->file.strategy;
+      io_close(&parser->file); // The UTF-8 copy is all that is needed from here
+      parser->file.strategy = strategy;
+    }
+    parser->transcoded = output;
+    parser->buffer = output;
+    parser->length = written;
+    skip = 0;
+  }
+
+  parser->ptr = parser->buffer + skip;
+  parser->end_ptr = parser->buffer + parser->length;
+  if (parser->options.validate_utf8) {
+    auto invalid = utf8_validate(parser->ptr, parser->end_ptr - parser->ptr);
+    if (invalid >= 0) return encoding_error(parser, parser->buffer, skip, skip + invalid, 1);
+  }
+  return true;
 }
 
 bool parser_open_memory(Parser *parser, String name, const char *memory, int64_t offset, int64_t length) {
+  reset_state(parser);
   parser->source_type = PST_MEMORY;
   parser->source = name;
   parser->buffer = (char *) memory + offset;
   parser->length = length;
-  parser->ptr = parser->buffer;
-  parser->end_ptr = parser->buffer + parser->length;
-  return true;
+  return prepare_source(parser);
 }
 
-bool parser_open_file_mmap(Parser *parser, String filename, int64_t offset, int64_t length) {
-  parser->source_type = PST_MMAP;
+bool parser_open_file(Parser *parser, String filename, int64_t offset, int64_t length, IoOptions io) {
+  reset_state(parser);
   parser->source = filename;
 
   char *cpath = str_to_zstr(filename);
-  int fd = open(cpath, O_RDWR);
+  bool opened = io_open(&parser->file, cpath, offset, length, io);
   raw_free(cpath);
 
-  if (fd < 0) {
-    fprintf(stderr, "\nCould not open file: %.*s\n", str_prt(filename));
+  if (!opened) {
+    Token token = {};
+    token.line = parser->line;
+    token.c0 = parser->col;
+    int system_error = errno;
+    parser_error(parser, PE_OPEN_FAILED, token);
+    parser->error.system_error = system_error;
     return false;
   }
 
-  if (length == 0) {
-    struct stat stat_result;
-    int err = fstat(fd, &stat_result);
-    if (err < 0) {
-      fprintf(stderr, "\nCould not open file: %.*s\n", str_prt(filename));
-      return false;
-    }
-    parser->length = stat_result.st_size - offset;
-  } else {
-    parser->length = length;
-  }
+  parser->source_type = PST_FILE;
+  parser->buffer = parser->file.data;
+  parser->length = parser->file.length;
+  return prepare_source(parser);
+}
 
-  parser->buffer = (char *) mmap(nullptr, parser->length, PROT_READ, MAP_SHARED, fd, offset);
-  if (parser->buffer == MAP_FAILED) {
-    fprintf(stderr, "Could not memory map file: %.*s\n", str_prt(filename));
-    return false;
-  }
+void parser_record(Parser *parser, ParserRecording *recording) {
+  *recording = ParserRecording{};
+  while (get_node(parser).type) parser_record_node(parser, recording);
+  recording->error = parser->error;
+  recording->errored = parser->errored;
+  recording->error_count = parser->error_count;
+  recording->transcoded = parser->transcoded; // Taken over, the nodes point into it
+  recording->transcoded_length = parser->length;
+  parser->transcoded = nullptr;
+}
+
+void parser_record_node(Parser *parser, ParserRecording *recording) {
+  parse_attributes(parser);
+  apush(recording->nodes, parser->node);
+  for (int i = 0; i < parser->node.attribute_count; i++) apush(recording->attributes, get_attribute(parser));
+}
 
+void parser_replay(Parser *parser, String name, const char *buffer, int64_t length, ParserRecording *recording) {
+  reset_state(parser);
+  parser->source_type = PST_MEMORY;
+  parser->source = name;
+  parser->buffer = (char *) buffer;
+  parser->length = length;
+  if (recording && recording->transcoded) {
+    parser->buffer = recording->transcoded;
+    parser->length = recording->transcoded_length;
+  }
   parser->ptr = parser->buffer;
   parser->end_ptr = parser->buffer + parser->length;
+  parser->replay = recording;
+  parser->replay_node = 0;
+  parser->replay_attribute = 0;
+  if (recording) parser->error_count = recording->error_count;
+}
 
-  return true;
+void recording_free(ParserRecording *recording) {
+  afree(recording->nodes);
+  afree(recording->attributes);
+  raw_free(recording->transcoded);
+  *recording = ParserRecording{};
 }
 
-void parser_destroy(Parser *parser) {
-  if (parser->source_type == PST_MMAP) {
-    munmap(parser->buffer, parser->length);
-  }
+// "prefix:name" as one span of the buffer, the prefix and name tokens are adjacent but for a colon
+inline String qualified_name(String xml_namespace, String name) {
+  if (!xml_namespace.length) return name;
+  return String{(int64_t) (name.data + name.length - xml_namespace.data), xml_namespace.data};
+}
+
+static Node replay_node(Parser *parser) {
+  auto recording = parser->replay;
+  parser->replay_attribute += parser->node.attribute_count;
+  rewind_attributes(parser);
 
-  auto block = parser->attribute_block.next;
-  while (block) {
-    auto next = block->next;
-    raw_free(block);
-    block = next;
+  while (parser->replay_node == (int64_t) alen(recording->nodes) &&
+         ((parser->pipeline && pipeline_next(parser)) || (parser->cache && cache_next(parser)))) {
+    recording = parser->replay;
   }
+  if (parser->replay_node == (int64_t) alen(recording->nodes)) {
+    parser->node = {};
+    parser->done = true;
+    parser->errored = recording->errored;
+    parser->error = recording->error;
+    return parser->node;
+  }
+  parser->node = recording->nodes[parser->replay_node++];
+
+  // Keeps open_elements as parsing would have, for parent_name and the path
+  auto node = &parser->node;
+  if (node->type == NODE_ELEMENT_BEGIN && !node->self_closing) {
+    auto name = qualified_name(node->xml_namespace, node->text);
+    apush(parser->open_elements, (OpenElement{node->tag_start, node->content_start, str_hash(name), name}));
+  } else if (node->type == NODE_ELEMENT_END && alen(parser->open_elements)) {
+    adrop(parser->open_elements);
+  } else if (node->type == NODE_ERROR && node->element_start >= 0) {
+    // An element begin broken in its attributes that recover left open, its name is the one written after the '<'
+    auto start = parser->buffer + node->element_start + 1;
+    auto end = start;
+    while (end < parser->end_ptr && (parser->identifier_map[(unsigned char) *end] || *end == ':')) end++;
+    auto name = String{(int64_t) (end - start), start};
+    apush(parser->open_elements, (OpenElement{node->element_start, node->tag_end, str_hash(name), name}));
+  }
+  return parser->node;
+}
+
+void parser_destroy(Parser *parser) {
+  pipeline_stop(parser);
+  cache_close(parser);
+  if (parser->source_type == PST_FILE) io_close(&parser->file);
+  raw_free(parser->transcoded);
+
+  afree(parser->open_elements);
+  afree(parser->attribute_list);
+  afree(parser->attribute_slots);
+  afree(parser->attribute_id_slots);
+  afree(parser->namespaces);
+  afree(parser->namespace_bindings);
+  vocabulary_destroy(&parser->vocabulary);
+  arena_destroy(&parser->arena);
 }
 
+template <typename P>
 inline bool scan_value(Parser *parser, Token *token) {
   auto start = parser->ptr;
   auto end = parser->ptr + 1;
-  while (end != parser->end_ptr && *end != *start) end++;
-  if (end == parser->end_ptr) return false;
+  auto line_start = parser->ptr;
+  auto line = parser->line;
+  if (P::positions) {
+    while (end != parser->end_ptr && *end != *start) {
+      if (*end == '\n') {
+        line_start = end + 1;
+        line++;
+      }
+      end++;
+    }
+  } else {
+    auto quote = (char *) memchr(end, *start, parser->end_ptr - end);
+    end = quote ? quote : parser->end_ptr;
+  }
+  if (end == parser->end_ptr) {
+    parser_error(parser, PE_UNTERMINATED_VALUE, *token);
+    return false;
+  }
   end++;
 
-  int64_t length = end - start;
   token->type = TOK_VALUE;
-  token->text.length = length - 2;
+  token->text.length = end - start - 2;
   token->text.data = start + 1;
 
-  parser->col += length;
+  if (P::positions) {
+    if (line != parser->line) parser->col = 1; // Values may span lines
+    parser->line = line;
+    parser->col += end - line_start;
+  }
   parser->ptr = end;
   return true;
 }
 
+template <typename P>
 inline void scan_identifier(Parser *parser, Token *token) {
   auto start = parser->ptr;
   auto end = parser->ptr;
@@ -124,32 +361,71 @@ inline void scan_identifier(Parser *parser, Token *token) {
   token->text.length = length;
   token->text.data = start;
 
-  parser->col += length;
+  if (P::positions) parser->col += length;
   parser->ptr = end;
 }
 
-void scan_text(Parser *parser, Token *token) {
+template <typename P>
+static void scan_text(Parser *parser, Token *token) {
   auto start = parser->ptr;
   auto end = parser->ptr;
   auto line_start = parser->ptr;
+  bool whitespace = true;
+
+#if defined(__SSE2__)
+  // Finds the '<', counts newlines and checks for whitespace-only text 16 bytes at a time
+  const __m128i open = _mm_set1_epi8('<');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i carriage_return = _mm_set1_epi8('\r');
+  while (parser->end_ptr - end >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *) end);
+    int stop = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, open));
+    int newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+    int blanks = newlines | _mm_movemask_epi8(_mm_or_si128(
+                                _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                                _mm_cmpeq_epi8(chunk, carriage_return)));
+
+    int length = stop ? __builtin_ctz(stop) : 16;
+    int in_text = (int) ((1u << length) - 1);
+    if ((blanks & in_text) != in_text) whitespace = false;
+    newlines &= in_text;
+    if (P::positions && newlines) {
+      parser->line += __builtin_popcount(newlines);
+      parser->col = 1;
+      line_start = end + (31 - __builtin_clz(newlines)) + 1;
+    }
+
+    end += length;
+    if (stop) break;
+  }
+#endif
+
   while (end != parser->end_ptr && *end != '<') {
     if (*end == '\n') {
-      line_start = end + 1;
-      parser->line++;
-      parser->col = 1;
+      if (P::positions) {
+        line_start = end + 1;
+        parser->line++;
+        parser->col = 1;
+      }
+    } else if (*end != ' ' && *end != '\t' && *end != '\r') {
+      whitespace = false;
     }
     end++;
   }
 
   token->type = TOK_TEXT;
+  token->whitespace = whitespace;
   token->text.length = end - start;
   token->text.data = start;
 
-  parser->col += end - line_start;
+  if (P::positions) parser->col += end - line_start;
   parser->ptr = end;
 }
 
-bool scan_comment_start(Parser *parser, Token *token) {
+template <typename P>
+static bool scan_comment_start(Parser *parser, Token *token) {
   if (parser->ptr == parser->end_ptr || *parser->ptr != '<') return false;
   parser->ptr++;
   if (parser->ptr == parser->end_ptr || *parser->ptr != '!') return false;
@@ -160,11 +436,12 @@ bool scan_comment_start(Parser *parser, Token *token) {
   parser->ptr++;
 
   token->type = TOK_COMMENT_START;
-  parser->col += 4;
+  if (P::positions) parser->col += 4;
   return true;
 }
 
-bool scan_comment_end(Parser *parser, Token *token) {
+template <typename P>
+static bool scan_comment_end(Parser *parser, Token *token) {
   if (parser->ptr == parser->end_ptr || *parser->ptr != '-') return false;
   parser->ptr++;
   if (parser->ptr == parser->end_ptr || *parser->ptr != '-') return false;
@@ -173,16 +450,17 @@ bool scan_comment_end(Parser *parser, Token *token) {
   parser->ptr++;
 
   token->type = TOK_COMMENT_END;
-  parser->col += 3;
+  if (P::positions) parser->col += 3;
   return true;
 }
 
-void scan_comment(Parser *parser, Token *token) {
+template <typename P>
+static void scan_comment(Parser *parser, Token *token) {
   auto start = parser->ptr;
   auto end = parser->ptr;
   auto line_start = parser->ptr;
   while (end != parser->end_ptr) {
-    if (*end == '\n') {
+    if (P::positions && *end == '\n') {
       line_start = end + 1;
       parser->line++;
       parser->col = 1;
@@ -200,53 +478,56 @@ void scan_comment(Parser *parser, Token *token) {
   token->text.length = end - start;
   token->text.data = start;
 
-  parser->col += end - line_start;
+  if (P::positions) parser->col += end - line_start;
   parser->ptr = end;
 }
 
-Token read_token(Parser *parser) {
+template <typename P>
+static Token lex_token(Parser *parser) {
   while (parser->ptr != parser->end_ptr) {
     Token token = {};
-    token.line = parser->line;
-    token.c0 = parser->col;
+    if (P::positions) {
+      token.line = parser->line;
+      token.c0 = parser->col;
+    }
     token.offset = parser->ptr - parser->buffer;
 
     auto c = *parser->ptr;
     if (parser->mode == LM_TAG) {
       auto state = parser->tag_initial_map[(unsigned char) c];
       if (state == LA_WHITESPACE) {
-        parser->col++;
+        if (P::positions) parser->col++;
         parser->ptr++;
         continue; // Ignore white space in a tag
       } else if (state == LA_NEWLINE) {
-        parser->line++;
-        parser->col = 1;
+        if (P::positions) {
+          parser->line++;
+          parser->col = 1;
+        }
         parser->ptr++;
         continue; // Ignore white space in a tag
       } else if (state == LA_ONE_CHAR) {
         token.type = (TokenType) c;
-        parser->col++;
+        if (P::positions) parser->col++;
         parser->ptr++;
         parser->mode = (token.type == TOK_R_ANGLED) ? LM_OUT : LM_TAG;
       } else if (state == LA_TWO_CHAR_END) {
         auto c2 = *(parser->ptr + 1);
         if (c2 == '>') {
           token.type = TOKEN2(parser->ptr);
-          parser->col += 2;
+          if (P::positions) parser->col += 2;
           parser->ptr += 2;
           parser->mode = LM_OUT;
         } else {
-          print_error_start(parser, token);
-          printf("Didn't expect '%c' to be followed by '%c'\n", c, c2);
+          parser_error(parser, PE_UNEXPECTED_CHARACTER, token, c2, TOK_R_ANGLED);
           return token;
         }
       } else if (state == LA_IDENTIFIER) {
-        scan_identifier(parser, &token);
+        scan_identifier<P>(parser, &token);
       } else if (state == LA_VALUE) {
-        if (!scan_value(parser, &token)) return token;
+        if (!scan_value<P>(parser, &token)) return token;
       } else {
-        print_error_start(parser, token);
-        printf("Invalid character '%c'\n", c);
+        parser_error(parser, PE_INVALID_CHARACTER, token, c);
         return token;
       }
     } else if (parser->mode == LM_OUT) {
@@ -254,97 +535,259 @@ Token read_token(Parser *parser) {
         auto c2 = *(parser->ptr + 1);
         if (c2 == '?' || c2 == '/') {
           token.type = TOKEN2(parser->ptr);
-          token.c1 = parser->col + 1;
-          parser->col += 2;
+          if (P::positions) parser->col += 2;
           parser->ptr += 2;
           parser->mode = LM_TAG;
         } else if (c2 == '!') {
-          if (!scan_comment_start(parser, &token)) return token;
+          if (!scan_comment_start<P>(parser, &token)) {
+            parser_error(parser, PE_INVALID_COMMENT, token);
+            return token;
+          }
           parser->mode = LM_COMMENT;
         } else {
           token.type = TOK_L_ANGLED;
-          token.c1 = parser->col;
-          parser->col++;
+          if (P::positions) parser->col++;
           parser->ptr++;
           parser->mode = LM_TAG;
         }
       } else {
-        scan_text(parser, &token);
+        scan_text<P>(parser, &token);
       }
     } else {
       if (c == '-' && *(parser->ptr + 1) == '-') {
-        if (!scan_comment_end(parser, &token)) return token;
+        if (!scan_comment_end<P>(parser, &token)) {
+          parser_error(parser, PE_INVALID_COMMENT, token);
+          return token;
+        }
         parser->mode = LM_OUT;
       }
-      if (!token.type) scan_comment(parser, &token);
+      if (!token.type) scan_comment<P>(parser, &token);
     }
 
+    if (P::positions) token.c1 = parser->col - 1;
+    token.end_offset = parser->ptr - parser->buffer;
     return token;
   }
 
   Token token = {};
-  token.line = parser->line;
-  token.c0 = parser->col;
+  if (P::positions) {
+    token.line = parser->line;
+    token.c0 = parser->col;
+  }
   token.offset = parser->ptr - parser->buffer;
+  token.end_offset = token.offset;
+  return token;
+}
+
+template <typename P>
+static Token read_token_as(Parser *parser) {
+#ifdef PARSER_STATS
+  auto mode = parser->mode;
+  auto start = parser->ptr;
+#ifdef PARSER_STATS_TIMING
+  auto start_ns = stats_now_ns();
+#endif
+
+  auto token = lex_token<P>(parser);
+
+#ifdef PARSER_STATS_TIMING
+  parser->stats.lexer_ns += stats_now_ns() - start_ns;
+#endif
+  parser->stats.bytes_scanned[mode] += parser->ptr - start;
+  if (token.type) parser->stats.tokens++;
   return token;
+#else
+  return lex_token<P>(parser);
+#endif
+}
+
+Token read_token(Parser *parser) { return parser->variant->read_token(parser); }
+
+// peek_token and get_token for the parse functions below, calling straight into their variant's lexer
+template <typename P>
+inline Token peek_token_as(Parser *parser) {
+  if (parser->has_next_token) return parser->next_token;
+  parser->next_token = read_token_as<P>(parser);
+  parser->has_next_token = true;
+  return parser->next_token;
+}
+
+template <typename P>
+inline Token get_token_as(Parser *parser) {
+  if (parser->has_next_token) {
+    parser->token = parser->next_token;
+    parser->has_next_token = false;
+  } else {
+    parser->token = read_token_as<P>(parser);
+  }
+
+  if (!parser->token.type) parser->done = true;
+  return parser->token;
+}
+
+// Line and column of offset for errors found without positions, counting newlines on from the last error located
+static void locate_offset(Parser *parser, int64_t offset, int64_t *line, int64_t *column) {
+  if (!parser->located_line || offset < parser->located_offset) {
+    bool byte_order_mark = parser->length >= 3 && !memcmp(parser->buffer, "\xEF\xBB\xBF", 3);
+    parser->located_offset = byte_order_mark ? 3 : 0;
+    parser->located_line = 1;
+    parser->located_col = 1;
+  }
+
+  auto ptr = parser->buffer + parser->located_offset;
+  auto end = parser->buffer + offset;
+  while (auto newline = (char *) memchr(ptr, '\n', end - ptr)) {
+    parser->located_line++;
+    parser->located_col = 1;
+    ptr = newline + 1;
+  }
+  parser->located_col += end - ptr;
+  parser->located_offset = offset;
+  *line = parser->located_line;
+  *column = parser->located_col;
 }
 
-void print_error_start(Parser *parser, Token token) {
+void parser_error(Parser *parser, ParserErrorCode code, Token token, char character, TokenType expected) {
+  if (parser->errored) return; // Keep the first error, later ones tend to be consequences of it
   parser->errored = true;
-  printf("%.*s:%li:%li - ", str_prt(parser->source), token.line, token.c0);
+  parser->done = true;
+  parser->error_count++;
+
+  ParserError error = {};
+  error.code = code;
+  error.character = character;
+  error.expected = expected;
+  error.got = token.type;
+  error.offset = token.offset;
+  error.line = token.line;
+  error.column = token.c0;
+  if (!error.line) locate_offset(parser, error.offset, &error.line, &error.column); // Lexed without positions
+  parser->error = error;
 }
 
-void print_token_type(TokenType type) {
+const char *error_code_name(ParserErrorCode code) {
+  switch (code) {
+    case PE_NONE: return "none";
+    case PE_OPEN_FAILED: return "open_failed";
+    case PE_INVALID_CHARACTER: return "invalid_character";
+    case PE_UNEXPECTED_CHARACTER: return "unexpected_character";
+    case PE_UNTERMINATED_VALUE: return "unterminated_value";
+    case PE_INVALID_COMMENT: return "invalid_comment";
+    case PE_UNEXPECTED_TOKEN: return "unexpected_token";
+    case PE_UNBOUND_PREFIX: return "unbound_prefix";
+    case PE_INVALID_ENCODING: return "invalid_encoding";
+    case PE_MISMATCHED_END_TAG: return "mismatched_end_tag";
+    default: return "unknown";
+  }
+}
+
+int format_token_type(char *buffer, size_t size, TokenType type) {
   if (type == TOK_INVALID) {
-    printf("INVALID");
+    return snprintf(buffer, size, "end of input");
   } else if (type < TOK_ONE_CHAR) {
-    printf("'%c'", type);
+    return snprintf(buffer, size, "'%c'", type);
   } else if (type < TOK_TWO_CHAR) {
-    printf("'%c%c'", type & 0x7F, (type >> 7) & 0x7F);
+    return snprintf(buffer, size, "'%c%c'", type & 0x7F, (type >> 7) & 0x7F);
   } else if (type == TOK_COMMENT_START) {
-    printf("'<!--'");
+    return snprintf(buffer, size, "'<!--'");
   } else if (type == TOK_COMMENT_END) {
-    printf("'-->'");
+    return snprintf(buffer, size, "'-->'");
   } else if (type == TOK_IDENTIFIER) {
-    printf("identifier");
+    return snprintf(buffer, size, "identifier");
   } else if (type == TOK_VALUE) {
-    printf("value");
+    return snprintf(buffer, size, "value");
   } else if (type == TOK_TEXT) {
-    printf("text");
+    return snprintf(buffer, size, "text");
   }
+  return snprintf(buffer, size, "unknown");
+}
+
+static int format_character(char *buffer, size_t size, char c) {
+  if (c >= 32 && c < 127) return snprintf(buffer, size, "'%c'", c);
+  return snprintf(buffer, size, "byte 0x%02x", (unsigned char) c);
+}
+
+int format_error(Parser *parser, char *buffer, size_t size) {
+  auto error = &parser->error;
+  char expected[32];
+  char got[32];
+  format_token_type(expected, sizeof(expected), error->expected);
+
+  auto prefix = snprintf(buffer, size, "%.*s:%lli:%lli - ", str_prt(parser->source), (long long) error->line,
+                         (long long) error->column);
+  if (prefix < 0) return prefix;
+  auto rest = (size_t) prefix < size ? buffer + prefix : nullptr;
+  auto rest_size = (size_t) prefix < size ? size - prefix : 0;
+
+  int length;
+  switch (error->code) {
+    case PE_NONE:
+      length = snprintf(rest, rest_size, "No error");
+      break;
+    case PE_OPEN_FAILED:
+      length = snprintf(rest, rest_size, "Could not open: %s", strerror(error->system_error));
+      break;
+    case PE_INVALID_CHARACTER:
+      format_character(got, sizeof(got), error->character);
+      length = snprintf(rest, rest_size, "Invalid character %s", got);
+      break;
+    case PE_UNEXPECTED_CHARACTER:
+      format_character(got, sizeof(got), error->character);
+      length = snprintf(rest, rest_size, "Expected %s but got %s", expected, got);
+      break;
+    case PE_UNTERMINATED_VALUE:
+      length = snprintf(rest, rest_size, "Attribute value is missing its closing quote");
+      break;
+    case PE_INVALID_COMMENT:
+      length = snprintf(rest, rest_size, "Malformed comment, expected '<!--' or '-->'");
+      break;
+    case PE_UNEXPECTED_TOKEN:
+      format_token_type(got, sizeof(got), error->got);
+      length = snprintf(rest, rest_size, "Expected %s but got %s", expected, got);
+      break;
+    case PE_UNBOUND_PREFIX:
+      length = snprintf(rest, rest_size, "Namespace prefix is not declared");
+      break;
+    case PE_INVALID_ENCODING:
+      length = snprintf(rest, rest_size, "Malformed %s at byte 0x%02X", source_encoding_name(parser->encoding),
+                        (uint8_t) error->character);
+      break;
+    case PE_MISMATCHED_END_TAG:
+      if (error->open_name.length) {
+        length = snprintf(rest, rest_size, "Expected </%.*s> but got </%.*s>", str_prt(error->open_name),
+                          str_prt(error->end_name));
+      } else {
+        length = snprintf(rest, rest_size, "End tag </%.*s> without an open element", str_prt(error->end_name));
+      }
+      break;
+    default:
+      length = snprintf(rest, rest_size, "Unknown error");
+      break;
+  }
+
+  return length < 0 ? length : prefix + length;
+}
+
+void print_error(Parser *parser) {
+  char buffer[1024];
+  format_error(parser, buffer, sizeof(buffer));
+  fprintf(stderr, "%s\n", buffer);
 }
 
 void print_token_type(TokenType type, String str) {
-  if (type == TOK_INVALID) {
-    printf("INVALID");
-  } else if (type < TOK_ONE_CHAR) {
-    printf("'%c'", type);
-  } else if (type < TOK_TWO_CHAR) {
-    printf("'%c%c'", type & 0x7F, (type >> 7) & 0x7F);
-  } else if (type == TOK_COMMENT_START) {
-    printf("'<!--'");
-  } else if (type == TOK_COMMENT_END) {
-    printf("'-->'");
-  } else if (type == TOK_IDENTIFIER) {
-    printf("identifier: %.*s", str_prt(str));
-  } else if (type == TOK_VALUE) {
-    printf("value: %.*s", str_prt(str));
-  } else if (type == TOK_TEXT) {
-    printf("text: %.*s", str_prt(str));
+  char buffer[32];
+  format_token_type(buffer, sizeof(buffer), type);
+  if (type == TOK_IDENTIFIER || type == TOK_VALUE || type == TOK_TEXT) {
+    printf("%s: %.*s", buffer, str_prt(str));
+  } else {
+    printf("%s", buffer);
   }
 }
 
 bool expect_type(Parser *parser, TokenType type) {
   Token token = parser->token;
   if (token.type == type) return true;
-  print_error_start(parser, token);
-  printf("Expected ");
-  print_token_type(type);
-  if (token.type) {
-    printf(" but got ");
-    print_token_type(token.type);
-  }
-  printf("\n");
+  parser_error(parser, PE_UNEXPECTED_TOKEN, token, 0, type);
   return false;
 }
 
@@ -354,9 +797,10 @@ void print_token(Token token) {
   printf("\n");
 }
 
-Node parse_xml_header(Parser *parser) {
-  auto start_token = get_token(parser);
-  auto token = get_token(parser);
+template <typename P>
+static Node parse_xml_header(Parser *parser) {
+  auto start_token = get_token_as<P>(parser);
+  auto token = get_token_as<P>(parser);
   if (!expect_type(parser, TOK_IDENTIFIER)) return {};
 
   Node node = {};
@@ -366,69 +810,150 @@ Node parse_xml_header(Parser *parser) {
   node.c1 = start_token.c1;
   node.offset = token.offset;
   node.depth = parser->depth;
+  node.tag_start = start_token.offset;
+  node.content_start = start_token.end_offset;
+  node.element_start = node.tag_start;
 
   while (!parser->done) {
-    token = get_token(parser);
+    token = get_token_as<P>(parser);
     if (token.type == TOK_TAG_XML_END) break;
   }
   expect_type(parser, TOK_TAG_XML_END);
 
   node.c1 = token.c1;
+  node.tag_end = token.end_offset;
+  node.content_end = token.offset;
   return node;
 }
 
-Attribute* get_next_attribute_slot(Parser *parser) {
-  auto cur = parser->current_attribute_block;
-  if (cur->count + 1 == array_size(cur->attributes)) {
-    if (!cur->next) cur->next = raw_allocate_type(AttributeBlock);
-    parser->current_attribute_block = cur = cur->next;
-    cur->count = 0;
+int32_t intern_namespace(Parser *parser, String uri) {
+  auto hash = str_hash(uri);
+  for (int32_t i = 0; i < (int32_t) alen(parser->namespaces); i++) {
+    auto ns = &parser->namespaces[i];
+    if (ns->hash == hash && str_equal(ns->uri, uri)) return i;
   }
-  return &cur->attributes[cur->count++];
+
+  Namespace ns = {};
+  ns.hash = hash;
+  ns.uri = str_empty(uri) ? String{} : str_dup(arena_allocator(&parser->arena), uri);
+  apush(parser->namespaces, ns);
+  return (int32_t) alen(parser->namespaces) - 1;
 }
 
-Node parse_element_begin(Parser *parser) {
-  auto start_token = get_token(parser);
-  auto token = get_token(parser);
-  if (!expect_type(parser, TOK_IDENTIFIER)) return {};
+String namespace_uri(Parser *parser, int32_t namespace_id) {
+  if (namespace_id < 0 || namespace_id >= (int32_t) alen(parser->namespaces)) return String{};
+  return parser->namespaces[namespace_id].uri;
+}
 
-  Node node = {};
-  node.type = NODE_ELEMENT_BEGIN;
-  node.line = start_token.line;
-  node.c0 = start_token.c0;
-  node.offset = token.offset;
-  node.depth = parser->depth;
+// Returns -1 for a prefix that is not bound
+static int32_t resolve_prefix(Parser *parser, String prefix) {
+  for (int64_t i = (int64_t) alen(parser->namespace_bindings) - 1; i >= 0; i--) {
+    auto binding = &parser->namespace_bindings[i];
+    if (str_equal(binding->prefix, prefix)) return binding->namespace_id;
+  }
+  if (str_empty(prefix)) return NAMESPACE_NONE;
+  if (str_equal(prefix, "xml", 3)) return NAMESPACE_XML;
+  return -1;
+}
 
-  auto colon_token = peek_token(parser);
-  if (colon_token.type == TOK_COLON) {
-    get_token(parser);
-    auto second_ident_token = get_token(parser);
-    if (!expect_type(parser, TOK_IDENTIFIER)) return {};
-    node.xml_namespace = token.text;
-    node.text = second_ident_token.text;
+static void pop_namespace_bindings(Parser *parser, int64_t depth) {
+  auto bindings = parser->namespace_bindings;
+  while (alen(bindings) && bindings[alen(bindings) - 1].depth >= depth) ahdr(bindings)->len--;
+}
+
+// xmlns declarations are bound right away, other prefixed attributes are resolved once the whole tag is read as the
+// declaration may follow them. Returns true when the attribute still needs resolving.
+static bool declare_namespace(Parser *parser, Attribute *attribute, int64_t depth) {
+  String prefix;
+  if (str_empty(attribute->xml_namespace)) {
+    attribute->namespace_id = NAMESPACE_NONE;
+    if (!str_equal(attribute->name, "xmlns", 5)) return false;
+    prefix = String{};
+  } else if (str_equal(attribute->xml_namespace, "xmlns", 5)) {
+    prefix = attribute->name;
   } else {
-    node.text = token.text;
+    return true;
   }
 
-  parser->current_attribute_block = &parser->attribute_block;
-  parser->current_attribute_index = 0;
+  attribute->namespace_id = NAMESPACE_XMLNS;
+  apush(parser->namespace_bindings, (NamespaceBinding{prefix, intern_namespace(parser, attribute->value), depth}));
+  return false;
+}
+
+static bool unbound_prefix(Parser *parser, Node *node) {
+  Token token = {};
+  token.type = TOK_IDENTIFIER;
+  token.line = node->line;
+  token.c0 = node->c0;
+  token.offset = node->tag_start;
+  parser_error(parser, PE_UNBOUND_PREFIX, token);
+  return false;
+}
+
+static bool resolve_namespaces(Parser *parser, Node *node, bool prefixed_attributes) {
+  node->namespace_id = resolve_prefix(parser, node->xml_namespace);
+  if (node->namespace_id < 0) return unbound_prefix(parser, node);
+  if (!prefixed_attributes) return true;
+
+  auto block = &parser->attribute_block;
+  int remaining = node->attribute_count;
+  while (remaining > 0) {
+    for (int i = 0; i < block->count && i < remaining; i++) {
+      auto attribute = &block->attributes[i];
+      if (str_empty(attribute->xml_namespace) || attribute->namespace_id == NAMESPACE_XMLNS) continue;
+      attribute->namespace_id = resolve_prefix(parser, attribute->xml_namespace);
+      if (attribute->namespace_id < 0) return unbound_prefix(parser, node);
+    }
+    remaining -= block->count;
+    block = block->next;
+  }
+  return true;
+}
+
+String parent_name(Parser *parser) {
+  auto depth = parser->node.depth;
+  if (depth <= 0 || depth > (int64_t) alen(parser->open_elements)) return String{};
+  return parser->open_elements[depth - 1].name;
+}
+
+Attribute* get_next_attribute_slot(Parser *parser) {
+  auto cur = parser->current_attribute_block;
+  if (cur->count == array_size(cur->attributes)) {
+    if (!cur->next) {
+      cur->next = arena_alloc_type(&parser->arena, AttributeBlock);
+      cur->next->next = nullptr;
+    }
+    parser->current_attribute_block = cur = cur->next;
+    cur->count = 0;
+#ifdef PARSER_STATS
+    parser->stats.attribute_block_overflows++;
+#endif
+  }
+  return &cur->attributes[cur->count++];
+}
+
+// Tokenizes attributes up to the '>' or '/>' closing the tag, which is left in end_token
+template <typename P>
+static bool parse_attribute_list(Parser *parser, Node *node, Token *end_token, bool *prefixed_attributes) {
+  auto vocabulary = vocabulary_empty(&parser->vocabulary) ? nullptr : &parser->vocabulary;
 
   while (!parser->done) {
-    token = get_token(parser);
+    auto token = get_token_as<P>(parser);
+    *end_token = token;
     if (token.type == TOK_TAG_SELF_CLOSE) {
-      node.self_closing = true;
+      node->self_closing = true;
       break;
     }
     if (token.type == TOK_R_ANGLED) break;
 
     auto attribute = get_next_attribute_slot(parser);
 
-    if (!expect_type(parser, TOK_IDENTIFIER)) return {};
-    colon_token = peek_token(parser);
+    if (!expect_type(parser, TOK_IDENTIFIER)) return false;
+    auto colon_token = peek_token_as<P>(parser);
     if (colon_token.type == TOK_COLON) {
-      get_token(parser);
-      auto second_ident_token = get_token(parser);
-      if (!expect_type(parser, TOK_IDENTIFIER)) return {};
+      get_token_as<P>(parser);
+      auto second_ident_token = get_token_as<P>(parser);
+      if (!expect_type(parser, TOK_IDENTIFIER)) return false;
       attribute->xml_namespace = token.text;
       attribute->name = second_ident_token.text;
     } else {
@@ -436,25 +961,192 @@ Node parse_element_begin(Parser *parser) {
       attribute->name = token.text;
     }
 
-    get_token(parser);
-    if (!expect_type(parser, TOK_EQUALS)) return {};
+    get_token_as<P>(parser);
+    if (!expect_type(parser, TOK_EQUALS)) return false;
 
-    auto value_token = get_token(parser);
-    if (!expect_type(parser, TOK_VALUE)) return {};
+    auto value_token = get_token_as<P>(parser);
+    if (!expect_type(parser, TOK_VALUE)) return false;
     attribute->value = value_token.text;
+    attribute->namespace_id = NAMESPACE_NONE;
+    attribute->name_id = vocabulary ? vocabulary_lookup(vocabulary, attribute->name) : 0;
+    if (P::namespaces && declare_namespace(parser, attribute, node->depth)) *prefixed_attributes = true;
 
-    node.attribute_count++;
+    node->attribute_count++;
   }
+  return true;
+}
+
+// Skips from the first attribute to the '>' of the tag without tokenizing anything, 16 bytes at a time. Quotes are
+// tracked so a '>' inside a value does not end the tag. Returns false with the lexer untouched when the tag runs into
+// a '<' or the end of the input, leaving the error to parse_attribute_list.
+template <typename P>
+static bool skip_attributes(Parser *parser, Token *end_token) {
+  auto ptr = parser->ptr;
+  auto end = parser->end_ptr;
+  auto line = parser->line;
+  auto col = parser->col;
+  auto line_start = ptr;
+  char quote = 0;
+
+  while (true) {
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i double_quote = _mm_set1_epi8('"');
+    const __m128i single_quote = _mm_set1_epi8('\'');
+    const __m128i close = _mm_set1_epi8('>');
+    const __m128i open = _mm_set1_epi8('<');
+    while (end - ptr >= 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i *) ptr);
+      int stops;
+      if (quote) {
+        stops = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote == '"' ? double_quote : single_quote));
+      } else {
+        stops = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, double_quote), _mm_cmpeq_epi8(chunk, single_quote)),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, close), _mm_cmpeq_epi8(chunk, open))));
+      }
+
+      int length = stops ? __builtin_ctz(stops) : 16;
+      int newlines = P::positions ? _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) & (int) ((1u << length) - 1) : 0;
+      if (newlines) {
+        line += __builtin_popcount(newlines);
+        col = 1;
+        line_start = ptr + (31 - __builtin_clz(newlines)) + 1;
+      }
+
+      ptr += length;
+      if (stops) break;
+    }
+#endif
+
+    while (ptr != end && (quote ? *ptr != quote : *ptr != '"' && *ptr != '\'' && *ptr != '>' && *ptr != '<')) {
+      if (P::positions && *ptr == '\n') {
+        line++;
+        col = 1;
+        line_start = ptr + 1;
+      }
+      ptr++;
+    }
+
+    if (ptr == end || (!quote && *ptr == '<')) return false;
+    if (!quote && *ptr == '>') break;
+    quote = quote ? 0 : *ptr;
+    ptr++;
+  }
+
+  bool self_closing = ptr[-1] == '/';
+  auto token_start = self_closing ? ptr - 1 : ptr;
+  ptr++;
+
+  *end_token = Token{};
+  end_token->type = self_closing ? TOK_TAG_SELF_CLOSE : TOK_R_ANGLED;
+  end_token->offset = token_start - parser->buffer;
+  end_token->end_offset = ptr - parser->buffer;
+  if (P::positions) {
+    col += ptr - line_start;
+    end_token->line = line;
+    end_token->c0 = col - (ptr - token_start);
+    end_token->c1 = col - 1;
+  }
+
+  parser->ptr = ptr;
+  parser->line = line;
+  parser->col = col;
+  parser->mode = LM_OUT;
+  return true;
+}
+
+static void reset_attribute_cursor(Parser *parser) {
+  parser->current_attribute_block = &parser->attribute_block;
+  parser->current_attribute_index = 0;
+  parser->attributes_read = 0;
+}
+
+template <typename P>
+static Node parse_element_begin(Parser *parser) {
+  auto start_token = get_token_as<P>(parser);
+  auto token = get_token_as<P>(parser);
+  if (!expect_type(parser, TOK_IDENTIFIER)) return {};
+
+  Node node = {};
+  node.type = NODE_ELEMENT_BEGIN;
+  node.line = start_token.line;
+  node.c0 = start_token.c0;
+  node.offset = token.offset;
+  node.depth = parser->depth;
+  node.tag_start = start_token.offset;
+  node.element_start = node.tag_start;
+
+  auto colon_token = peek_token_as<P>(parser);
+  if (colon_token.type == TOK_COLON) {
+    get_token_as<P>(parser);
+    auto second_ident_token = get_token_as<P>(parser);
+    if (!expect_type(parser, TOK_IDENTIFIER)) return {};
+    node.xml_namespace = token.text;
+    node.text = second_ident_token.text;
+  } else {
+    node.text = token.text;
+  }
+
+  if (!vocabulary_empty(&parser->vocabulary)) node.name_id = vocabulary_lookup(&parser->vocabulary, node.text);
+
+  parser->current_attribute_block = &parser->attribute_block;
+  parser->attribute_block.count = 0;
+
+  bool prefixed_attributes = false;
+  if (P::namespaces) pop_namespace_bindings(parser, node.depth); // Left over when an earlier element failed to parse
+
+  // Lazily only when there are attributes to skip, "<a>" is a single token away from its end either way
+  auto first_token = peek_token_as<P>(parser);
+  bool lazy = !P::namespaces && parser->options.lazy_attributes && first_token.type == TOK_IDENTIFIER;
+  if (lazy) {
+    parser->ptr = parser->buffer + first_token.offset;
+    parser->line = first_token.line;
+    parser->col = first_token.c0;
+    parser->has_next_token = false;
+    lazy = skip_attributes<P>(parser, &token);
+  }
+
+  if (lazy) {
+    node.self_closing = token.type == TOK_TAG_SELF_CLOSE;
+    node.attribute_count = -1;
+    parser->attributes_pending = true;
+    parser->pending_offset = first_token.offset;
+    parser->pending_line = first_token.line;
+    parser->pending_col = first_token.c0;
+  } else {
+    if (!parse_attribute_list<P>(parser, &node, &token, &prefixed_attributes)) {
+      auto name = qualified_name(node.xml_namespace, node.text);
+      if (parser->options.recover) parser->broken_element = OpenElement{node.tag_start, -1, str_hash(name), name};
+      return {};
+    }
+    if (P::namespaces && !resolve_namespaces(parser, &node, prefixed_attributes)) return {};
+  }
+  reset_attribute_cursor(parser);
 
   node.c1 = token.c1;
+  node.tag_end = token.end_offset;
+  node.content_start = node.tag_end;
 
-  if (!node.self_closing) parser->depth++;
+  if (node.self_closing) {
+    node.content_end = node.tag_end;
+    if (P::namespaces) pop_namespace_bindings(parser, node.depth);
+  } else {
+    node.content_end = -1;
+    auto name = qualified_name(node.xml_namespace, node.text);
+    apush(parser->open_elements, (OpenElement{node.tag_start, node.content_start, str_hash(name), name}));
+    parser->depth++;
+#ifdef PARSER_STATS
+    if (parser->depth > parser->stats.max_depth) parser->stats.max_depth = parser->depth;
+#endif
+  }
   return node;
 }
 
-Node parse_element_end(Parser *parser) {
-  auto start_token = get_token(parser);
-  auto token = get_token(parser);
+template <typename P>
+static Node parse_element_end(Parser *parser) {
+  auto start_token = get_token_as<P>(parser);
+  auto token = get_token_as<P>(parser);
   if (!expect_type(parser, TOK_IDENTIFIER)) return {};
 
   Node node = {};
@@ -463,31 +1155,58 @@ Node parse_element_end(Parser *parser) {
   node.c0 = start_token.c0;
   node.offset = start_token.offset;
   node.depth = parser->depth - 1;
+  node.tag_start = start_token.offset;
+  node.content_end = node.tag_start;
 
-  auto next = peek_token(parser);
+  auto next = peek_token_as<P>(parser);
   if (next.type == TOK_COLON) {
-    get_token(parser);
-    auto second_ident_token = get_token(parser);
+    get_token_as<P>(parser);
+    auto second_ident_token = get_token_as<P>(parser);
     if (!expect_type(parser, TOK_IDENTIFIER)) return {};
     node.xml_namespace = token.text;
     node.text = second_ident_token.text;
   } else {
     node.text = token.text;
   }
+  if (!vocabulary_empty(&parser->vocabulary)) node.name_id = vocabulary_lookup(&parser->vocabulary, node.text);
+
+  // Left open on a mismatch, so in recover mode a later matching end tag still closes the element
+  auto name = qualified_name(node.xml_namespace, node.text);
+  auto open_element = alen(parser->open_elements) ? &parser->open_elements[alen(parser->open_elements) - 1] : nullptr;
+  if (!open_element || open_element->name_hash != str_hash(name) || !str_equal(open_element->name, name)) {
+    parser_error(parser, PE_MISMATCHED_END_TAG, token);
+    parser->error.open_name = open_element ? open_element->name : String{};
+    parser->error.end_name = name;
+    return {};
+  }
+  node.element_start = open_element->tag_start;
+  node.content_start = open_element->content_start;
+  adrop(parser->open_elements);
 
   while (!parser->done) {
-    token = get_token(parser);
+    token = get_token_as<P>(parser);
     if (token.type == TOK_R_ANGLED) break;
   }
 
   node.c1 = token.c1;
+  node.tag_end = token.end_offset;
+
+  if (P::namespaces) {
+    node.namespace_id = resolve_prefix(parser, node.xml_namespace);
+    pop_namespace_bindings(parser, node.depth);
+    if (node.namespace_id < 0) {
+      unbound_prefix(parser, &node);
+      return {};
+    }
+  }
 
   parser->depth--;
   return node;
 }
 
-Node parse_text(Parser *parser) {
-  auto token = get_token(parser);
+template <typename P>
+static Node parse_text(Parser *parser) {
+  auto token = get_token_as<P>(parser);
   if (!expect_type(parser, TOK_TEXT)) return {};
 
   Node node = {};
@@ -497,62 +1216,401 @@ Node parse_text(Parser *parser) {
   node.c1 = token.c1;
   node.offset = token.offset;
   node.depth = parser->depth;
+  node.tag_start = token.offset;
+  node.tag_end = token.end_offset;
+  node.content_start = node.tag_start;
+  node.content_end = node.tag_end;
+  node.element_start = -1;
+  node.whitespace = token.whitespace;
   node.text = token.text;
   return node;
 }
 
-Node parse_comment(Parser *parser) {
-  auto start_token = get_token(parser);
+template <typename P>
+static Node parse_comment(Parser *parser) {
+  auto start_token = get_token_as<P>(parser);
   Node node = {};
   node.line = start_token.line;
   node.c0 = start_token.c0;
   node.offset = start_token.offset;
+  node.tag_start = start_token.offset;
+  node.element_start = -1;
 
-  auto token = get_token(parser);
+  auto token = get_token_as<P>(parser);
   if (!expect_type(parser, TOK_TEXT)) return node;
   node.depth = parser->depth;
   node.text = token.text;
+  node.content_start = token.offset;
+  node.content_end = token.end_offset;
 
-  auto end_token = get_token(parser);
+  auto end_token = get_token_as<P>(parser);
   if (!expect_type(parser, TOK_COMMENT_END)) return node;
   node.type = NODE_COMMENT;
   node.c1 = end_token.c1;
+  node.tag_end = end_token.end_offset;
   return node;
 }
 
+// Skips from the node that failed to the next '<' after the error, returning the skipped bytes as a NODE_ERROR node
+// and leaving the lexer outside of any tag, ready to read what follows
+static Node recover(Parser *parser, Token start_token) {
+  auto error = parser->error;
+  auto start = parser->buffer + start_token.offset;
+  auto from = parser->buffer + error.offset + 1; // Always make progress, even when the error is at a '<'
+  if (from > parser->end_ptr) from = parser->end_ptr;
+  auto resync = (char *) memchr(from, '<', parser->end_ptr - from);
+  if (!resync) resync = parser->end_ptr;
+
+  // The lexer may have stopped anywhere between the error and the resync point, count lines from the error
+  auto line = error.line;
+  auto col = error.column;
+  for (auto ptr = parser->buffer + error.offset; ptr < resync; ptr++) {
+    if (*ptr == '\n') {
+      line++;
+      col = 1;
+    } else {
+      col++;
+    }
+  }
+
+  Node node = {};
+  node.type = NODE_ERROR;
+  node.line = start_token.line;
+  node.c0 = start_token.c0;
+  node.c1 = parser->options.skip_positions ? 0 : col - 1;
+  node.offset = start_token.offset;
+  node.depth = alen(parser->open_elements);
+  node.tag_start = start_token.offset;
+  node.tag_end = resync - parser->buffer;
+  node.content_start = node.tag_start;
+  node.content_end = node.tag_end;
+  node.element_start = -1;
+  node.text = String{(int64_t) (resync - start), start};
+
+  // An element begin broken in its attributes still opens its element, unless it was meant to close itself, so that
+  // its end tag does not fail to match as well
+  auto broken = parser->broken_element;
+  parser->broken_element = {};
+  auto last = resync;
+  while (last > start && is_xml_whitespace(last[-1])) last--;
+  if (broken.name.length && last - start >= 2 && last[-1] == '>' && last[-2] != '/') {
+    broken.content_start = node.tag_end;
+    apush(parser->open_elements, broken);
+    node.element_start = broken.tag_start;
+  }
+
+  parser->ptr = resync;
+  parser->line = line;
+  parser->col = col;
+  parser->mode = LM_OUT;
+  parser->has_next_token = false;
+  parser->depth = alen(parser->open_elements);
+  parser->attribute_block.count = 0;
+  rewind_attributes(parser);
+  parser->errored = false;
+  parser->done = false;
+  return node;
+}
+
+// Applies skip_whitespace_text and trim_text, true when the node should not be handed out. Comments are skipped
+// before they become nodes.
+static bool filter_node(Parser *parser, Node *node) {
+  auto options = &parser->options;
+  if (node->type == NODE_TEXT) {
+    if (node->whitespace) return options->skip_whitespace_text || options->trim_text;
+    if (options->trim_text) node->text = trim_whitespace(node->text);
+  }
+  return false;
+}
+
+// Moves the lexer from just after a peeked "<!--" to past its "-->" without making tokens of the comment. False with
+// the lexer untouched for a comment that is empty, unterminated or has "--" inside, parse_comment reports those.
+template <typename P>
+static bool skip_comment(Parser *parser) {
+  auto start = parser->ptr;
+  auto ptr = start;
+  while (true) {
+    ptr = (char *) memchr(ptr, '-', parser->end_ptr - ptr);
+    if (!ptr || parser->end_ptr - ptr < 3) return false;
+    if (ptr[1] == '-') break;
+    ptr++;
+  }
+  if (ptr == start || ptr[2] != '>') return false;
+
+  auto end = ptr + 3;
+  if (P::positions) {
+    auto line_start = start;
+    for (auto newline = start; (newline = (char *) memchr(newline, '\n', end - newline)); newline++) {
+      parser->line++;
+      parser->col = 1;
+      line_start = newline + 1;
+    }
+    parser->col += end - line_start;
+  }
+  parser->ptr = end;
+  parser->mode = LM_OUT;
+  parser->has_next_token = false;
+  return true;
+}
+
+template <typename P>
+static void parse_node(Parser *parser) {
+#ifdef PARSER_STATS_TIMING
+  auto start_ns = stats_now_ns();
+  auto lexer_ns = parser->stats.lexer_ns;
+#endif
+
+  Token token;
+  while (true) {
+    token = peek_token_as<P>(parser);
+    if (token.type == TOK_TAG_XML_START) {
+      parser->node = parse_xml_header<P>(parser);
+    } else if (token.type == TOK_TAG_START_CLOSE) {
+      parser->node = parse_element_end<P>(parser);
+    } else if (token.type == TOK_L_ANGLED) {
+      parser->node = parse_element_begin<P>(parser);
+    } else if (token.type == TOK_COMMENT_START) {
+      if (!P::comments && skip_comment<P>(parser)) continue;
+      parser->node = parse_comment<P>(parser);
+      if (!P::comments && !parser->errored) continue;
+    } else if (token.type == TOK_INVALID) {
+      parser->node = {};
+      get_token_as<P>(parser);
+    } else {
+      parser->node = parse_text<P>(parser);
+    }
+    if (parser->errored || !filter_node(parser, &parser->node)) break;
+  }
+
+  if (parser->errored && parser->options.recover) parser->node = recover(parser, token);
+  if (parser->node.type) io_advance(&parser->file, parser->node.offset); // Nothing before the node is needed now
+
+#ifdef PARSER_STATS
+  if (parser->node.type) parser->stats.nodes[parser->node.type]++;
+#endif
+#ifdef PARSER_STATS_TIMING
+  parser->stats.parser_ns += stats_now_ns() - start_ns - (parser->stats.lexer_ns - lexer_ns);
+#endif
+}
+
+template <bool Positions, bool Comments, bool Namespaces>
+static const ParserVariant parser_variant() {
+  typedef ParsePolicy<Positions, Comments, Namespaces> P;
+  return ParserVariant{read_token_as<P>, parse_node<P>, parse_attribute_list<P>};
+}
+
+// Indexed by positions, comments and namespaces as bits 2, 1 and 0
+static const ParserVariant parser_variants[8] = {
+    parser_variant<false, false, false>(), parser_variant<false, false, true>(), parser_variant<false, true, false>(),
+    parser_variant<false, true, true>(),   parser_variant<true, false, false>(),  parser_variant<true, false, true>(),
+    parser_variant<true, true, false>(),   parser_variant<true, true, true>(),
+};
+
+static const ParserVariant *select_variant(const ParserOptions *options) {
+  int index = (options->skip_positions ? 0 : 4) | (options->skip_comments ? 0 : 2);
+  if (options->resolve_namespaces) index |= 1;
+  return &parser_variants[index];
+}
+
 Node get_node(Parser *parser) {
   if (parser->done || parser->errored) return {};
-
-  auto token = peek_token(parser);
-  if (token.type == TOK_TAG_XML_START) {
-    parser->node = parse_xml_header(parser);
-  } else if (token.type == TOK_TAG_START_CLOSE) {
-    parser->node = parse_element_end(parser);
-  } else if (token.type == TOK_L_ANGLED) {
-    parser->node = parse_element_begin(parser);
-  } else if (token.type == TOK_COMMENT_START) {
-    parser->node = parse_comment(parser);
-  } else if (token.type == TOK_INVALID) {
-    parser->node = {};
-    get_token(parser);
+  parser->attributes_pending = false;
+  parser->attribute_index_built = false;
+  parser->attribute_id_index_built = false;
+  parser->node_serial++;
+  if (parser->replay) {
+    replay_node(parser);
+    if (parser->node.type) io_advance(&parser->file, parser->node.offset);
   } else {
-    parser->node = parse_text(parser);
+    parser->variant->parse_node(parser);
   }
-
   return parser->node;
 }
 
 Attribute get_attribute(Parser* parser) {
+  if (parser->attributes_pending) parse_attributes(parser);
+  if (parser->attributes_read >= parser->node.attribute_count) return {};
+  if (parser->replay) return parser->replay->attributes[parser->replay_attribute + parser->attributes_read++];
+
   auto cur_block = parser->current_attribute_block;
-  if (parser->current_attribute_index == cur_block->count) {
-    if (cur_block->count < array_size(cur_block->attributes)) return {};
+  if (parser->current_attribute_index == array_size(cur_block->attributes)) {
     parser->current_attribute_block = cur_block = cur_block->next;
     parser->current_attribute_index = 0;
   }
   assert(cur_block);
+  parser->attributes_read++;
   return cur_block->attributes[parser->current_attribute_index++];
 }
 
+void rewind_attributes(Parser *parser) {
+  if (parser->attributes_pending) parse_attributes(parser);
+  reset_attribute_cursor(parser);
+}
+
+// The lexer has long moved past the tag, so the attributes are tokenized with its state set aside
+bool parse_attributes(Parser *parser) {
+  if (!parser->attributes_pending) return true;
+  parser->attributes_pending = false;
+
+  auto ptr = parser->ptr;
+  auto line = parser->line;
+  auto col = parser->col;
+  auto mode = parser->mode;
+  auto has_next_token = parser->has_next_token;
+  auto next_token = parser->next_token;
+  auto token = parser->token;
+  auto done = parser->done;
+
+  parser->ptr = parser->buffer + parser->pending_offset;
+  parser->line = parser->pending_line;
+  parser->col = parser->pending_col;
+  parser->mode = LM_TAG;
+  parser->has_next_token = false;
+  parser->node.attribute_count = 0;
+  parser->current_attribute_block = &parser->attribute_block;
+  parser->attribute_block.count = 0;
+
+  Token end_token;
+  bool prefixed_attributes = false;
+  bool success = parser->variant->parse_attribute_list(parser, &parser->node, &end_token, &prefixed_attributes);
+
+  parser->ptr = ptr;
+  parser->line = line;
+  parser->col = col;
+  parser->mode = mode;
+  parser->has_next_token = has_next_token;
+  parser->next_token = next_token;
+  parser->token = token;
+  parser->done = done || parser->errored;
+  // The nodes after the tag are fine, so in recover mode the error is only recorded and parsing carries on
+  if (parser->errored && parser->options.recover) {
+    parser->errored = false;
+    parser->done = done;
+  }
+  reset_attribute_cursor(parser);
+  return success;
+}
+
+inline uint64_t attribute_hash(String xml_namespace, String name) {
+  return str_hash(name) ^ str_hash(xml_namespace) * 0x9E3779B97F4A7C15ull;
+}
+
+inline bool same_attribute_name(Attribute *attribute, String xml_namespace, String name) {
+  return str_equal(attribute->name, name) && str_equal(attribute->xml_namespace, xml_namespace);
+}
+
+inline uint64_t attribute_id_hash(int32_t namespace_id, String name) {
+  return str_hash(name) ^ (uint64_t) (uint32_t) namespace_id * 0x9E3779B97F4A7C15ull;
+}
+
+inline uint64_t attribute_slot_count(int count) {
+  uint64_t slot_count = 8;
+  while (slot_count < (uint64_t) count * 2) slot_count <<= 1;
+  return slot_count;
+}
+
+// Fills the table with linear probing at a load of at most one half; a name already in there is a duplicate
+static void build_attribute_index(Parser *parser) {
+  parse_attributes(parser);
+  parser->attribute_index_built = true;
+  parser->attribute_id_index_built = false;
+  parser->duplicate_attribute = -1;
+  aclear(parser->attribute_list);
+  aclear(parser->attribute_slots);
+
+  int count = parser->node.attribute_count;
+  if (count <= 0) return;
+  if (parser->replay) {
+    auto attributes = parser->replay->attributes + parser->replay_attribute;
+    for (int i = 0; i < count; i++) apush(parser->attribute_list, &attributes[i]);
+  } else {
+    int collected = 0;
+    for (auto block = &parser->attribute_block; block && collected < count; block = block->next) {
+      for (int i = 0; i < block->count && collected < count; i++, collected++) {
+        apush(parser->attribute_list, &block->attributes[i]);
+      }
+    }
+  }
+
+  auto slot_count = attribute_slot_count(count);
+  asetlen(parser->attribute_slots, slot_count);
+  memset(parser->attribute_slots, 0, slot_count * sizeof(int32_t));
+
+  auto mask = slot_count - 1;
+  for (int i = 0; i < count; i++) {
+    auto attribute = parser->attribute_list[i];
+    auto slot = attribute_hash(attribute->xml_namespace, attribute->name) & mask;
+    while (parser->attribute_slots[slot]) {
+      auto other = parser->attribute_list[parser->attribute_slots[slot] - 1];
+      if (same_attribute_name(other, attribute->xml_namespace, attribute->name)) break;
+      slot = (slot + 1) & mask;
+    }
+    if (parser->attribute_slots[slot]) {
+      if (parser->duplicate_attribute < 0) parser->duplicate_attribute = i; // The first one stays findable
+      continue;
+    }
+    parser->attribute_slots[slot] = i + 1;
+  }
+}
+
+Attribute *find_attribute(Parser *parser, String name, String xml_namespace) {
+  if (!parser->attribute_index_built || parser->attributes_pending) build_attribute_index(parser);
+  if (!alen(parser->attribute_slots)) return nullptr;
+
+  auto mask = alen(parser->attribute_slots) - 1;
+  auto slot = attribute_hash(xml_namespace, name) & mask;
+  while (parser->attribute_slots[slot]) {
+    auto attribute = parser->attribute_list[parser->attribute_slots[slot] - 1];
+    if (same_attribute_name(attribute, xml_namespace, name)) return attribute;
+    slot = (slot + 1) & mask;
+  }
+  return nullptr;
+}
+
+// The first attribute with a given namespace id and local name takes the slot, as in build_attribute_index
+static void build_attribute_id_index(Parser *parser) {
+  parser->attribute_id_index_built = true;
+  aclear(parser->attribute_id_slots);
+  int count = (int) alen(parser->attribute_list);
+  if (!count) return;
+
+  auto slot_count = attribute_slot_count(count);
+  asetlen(parser->attribute_id_slots, slot_count);
+  memset(parser->attribute_id_slots, 0, slot_count * sizeof(int32_t));
+
+  auto mask = slot_count - 1;
+  for (int i = 0; i < count; i++) {
+    auto attribute = parser->attribute_list[i];
+    auto slot = attribute_id_hash(attribute->namespace_id, attribute->name) & mask;
+    while (parser->attribute_id_slots[slot]) {
+      auto other = parser->attribute_list[parser->attribute_id_slots[slot] - 1];
+      if (other->namespace_id == attribute->namespace_id && str_equal(other->name, attribute->name)) break;
+      slot = (slot + 1) & mask;
+    }
+    if (!parser->attribute_id_slots[slot]) parser->attribute_id_slots[slot] = i + 1;
+  }
+}
+
+Attribute *find_attribute_by_namespace_id(Parser *parser, String name, int32_t namespace_id) {
+  if (!parser->attribute_index_built || parser->attributes_pending) build_attribute_index(parser);
+  if (!parser->attribute_id_index_built) build_attribute_id_index(parser);
+  if (!alen(parser->attribute_id_slots)) return nullptr;
+
+  auto mask = alen(parser->attribute_id_slots) - 1;
+  auto slot = attribute_id_hash(namespace_id, name) & mask;
+  while (parser->attribute_id_slots[slot]) {
+    auto attribute = parser->attribute_list[parser->attribute_id_slots[slot] - 1];
+    if (attribute->namespace_id == namespace_id && str_equal(attribute->name, name)) return attribute;
+    slot = (slot + 1) & mask;
+  }
+  return nullptr;
+}
+
+int find_duplicate_attribute(Parser *parser) {
+  if (!parser->attribute_index_built || parser->attributes_pending) build_attribute_index(parser);
+  return parser->duplicate_attribute;
+}
+
 void print_node(Node node) {
   printf("%5li:%3li: [%li] ", node.line, node.c0, node.depth);
   if (node.type == NODE_ELEMENT_BEGIN) {
@@ -576,6 +1634,8 @@ void print_node(Node node) {
     printf("Comment: \"%.*s\"\n", str_prt(node.text));
   } else if (node.type == NODE_XML_HEADER) {
     printf("XML header\n");
+  } else if (node.type == NODE_ERROR) {
+    printf("Error: \"%.*s\"\n", str_prt(node.text));
   }
 }
 
@@ -3,6 +3,10 @@
 #include <cstdint>
 
 #include "str.hpp"
+#include "array.hpp"
+#include "encoding.hpp"
+#include "io.hpp"
+#include "vocabulary.hpp"
 
 #define TOKEN2(a) (TokenType)(((uint16_t)((a)[1])<<7)+(uint16_t)((a)[0]))
 
@@ -33,10 +37,12 @@ enum TokenType : uint16_t {
 
 struct Token {
   TokenType type;
+  bool whitespace; // Text only: nothing but XML whitespace
   int64_t line;
   int64_t c0;
   int64_t c1;
   int64_t offset;
+  int64_t end_offset;
   String text;
 };
 
@@ -56,10 +62,39 @@ enum LexerMode : uint8_t {
   LM_COMMENT
 };
 
+enum ParserErrorCode : uint8_t {
+  PE_NONE = 0,
+  PE_OPEN_FAILED,          // The source could not be opened or mapped, see ParserError::system_error
+  PE_INVALID_CHARACTER,    // A character that can not appear inside a tag
+  PE_UNEXPECTED_CHARACTER, // '/' or '?' not followed by '>'
+  PE_UNTERMINATED_VALUE,   // An attribute value without its closing quote
+  PE_INVALID_COMMENT,      // '<!' not followed by '--', or '--' inside a comment not followed by '>'
+  PE_UNEXPECTED_TOKEN,     // The parser expected a different token
+  PE_UNBOUND_PREFIX,       // A namespace prefix without an xmlns declaration in scope, with resolve_namespaces
+  PE_INVALID_ENCODING,     // Malformed UTF-16, or malformed UTF-8 with validate_utf8; found when the source is opened
+  PE_MISMATCHED_END_TAG,   // An end tag not matching the innermost open element, or with no element open
+
+  MAX_PARSER_ERRORS
+};
+
+// Errors are recorded, not printed; use format_error or print_error to get a message
+struct ParserError {
+  ParserErrorCode code;
+  char character;     // The offending byte for character errors
+  TokenType expected; // For PE_UNEXPECTED_TOKEN and PE_UNEXPECTED_CHARACTER
+  TokenType got;      // For PE_UNEXPECTED_TOKEN, TOK_INVALID at the end of the input
+  int system_error;   // errno for PE_OPEN_FAILED
+  String open_name;   // For PE_MISMATCHED_END_TAG, the element left open, empty when there is none
+  String end_name;    // For PE_MISMATCHED_END_TAG, the name in the end tag
+  int64_t offset;
+  int64_t line;
+  int64_t column;
+};
+
 enum ParserSourceType {
   PST_NONE = 0,
   PST_MEMORY,
-  PST_MMAP
+  PST_FILE
 };
 
 enum NodeType {
@@ -69,10 +104,28 @@ enum NodeType {
   NODE_TEXT,
   NODE_XML_HEADER,
   NODE_COMMENT,
+  NODE_ERROR, // Only in recover mode: the bytes skipped after an error, see ParserOptions::recover
 
   MAX_NODE_TYPES
 };
 
+// Compiled in with PARSER_STATS, timings additionally need PARSER_STATS_TIMING as they cost two clock reads per token
+struct ParserStats {
+  uint64_t bytes_scanned[LM_COMMENT + 1]; // Indexed by the LexerMode a token started in
+  uint64_t tokens;
+  uint64_t nodes[MAX_NODE_TYPES];
+  uint64_t attribute_block_overflows;
+  int64_t max_depth;
+  uint64_t lexer_ns;
+  uint64_t parser_ns; // Time in get_node excluding the lexer
+};
+
+// Byte spans are offsets into the parser buffer, end exclusive:
+//   tag_start/tag_end          - the node's own markup, '<' up to and including '>' (or the text/comment span)
+//   content_start/content_end  - what lies between the tags; content_end is -1 on an element begin until the end tag
+//                                is reached, so it is only known on NODE_ELEMENT_END
+//   element_start              - start of the opening tag of the element the node opens or closes
+//                                (or, on a NODE_ERROR, of the broken element begin that recovery leaves open)
 struct Node {
   NodeType type;
   int64_t line;
@@ -81,29 +134,117 @@ struct Node {
   int64_t offset;
   int64_t depth;
 
-  int attribute_count;
+  int64_t tag_start;
+  int64_t tag_end;
+  int64_t content_start;
+  int64_t content_end;
+  int64_t element_start;
+
+  int attribute_count; // -1 on an element begin whose attributes are still pending, see ParserOptions::lazy_attributes
   bool self_closing;
+  bool whitespace; // NODE_TEXT made of nothing but XML whitespace, e.g. indentation between tags
+  int32_t namespace_id; // With resolve_namespaces, see intern_namespace
+  int32_t name_id;      // Id of the element name in Parser::vocabulary, 0 when it is not in there
   String xml_namespace;
   String text;
 };
 
 struct Attribute {
+  int32_t namespace_id;
+  int32_t name_id;
   String xml_namespace;
   String name;
   String value;
 };
 
+// Interned namespace URIs, the id is the index in Parser::namespaces. Ids stay valid for the lifetime of the parser,
+// across documents, so they can be looked up once and compared as integers.
+enum NamespaceId : int32_t {
+  NAMESPACE_NONE = 0,
+  NAMESPACE_XML,   // http://www.w3.org/XML/1998/namespace, always bound to the xml prefix
+  NAMESPACE_XMLNS, // http://www.w3.org/2000/xmlns/, the namespace of xmlns declarations themselves
+
+  PREDEFINED_NAMESPACES
+};
+
+struct Namespace {
+  uint64_t hash;
+  String uri; // Copied into the parser arena, static for the predefined ones
+};
+
+// An xmlns declaration in scope, bound on the element at depth and dropped when that element ends
+struct NamespaceBinding {
+  String prefix; // Empty for the default namespace
+  int32_t namespace_id;
+  int64_t depth;
+};
+
 struct AttributeBlock {
   int count;
   Attribute attributes[32];
   AttributeBlock* next;
 };
 
+// An element whose end tag has not been reached, end tags are checked against its name with a hash compare first
+struct OpenElement {
+  int64_t tag_start;
+  int64_t content_start;
+  uint64_t name_hash;
+  String name; // Qualified name as written, pointing into the buffer
+};
+
+// A whole document parsed ahead of time, e.g. on another thread, that get_node and get_attribute hand out again
+struct ParserRecording {
+  Node *nodes;           // Stretchy array
+  Attribute *attributes; // Stretchy array, the attributes of every node in order
+  char *transcoded;      // Owned UTF-8 copy of a UTF-16 source, the nodes point into it instead of the source
+  int64_t transcoded_length;
+  ParserError error;
+  bool errored;
+  int64_t error_count;
+};
+
+struct ParserOptions {
+  // Instead of stopping at the first error, skip to the next '<' after it, return the skipped bytes as a NODE_ERROR
+  // node and carry on. Parser::error then holds the most recent error.
+  bool recover;
+
+  // Resolve element and attribute prefixes to interned namespace ids, using the xmlns declarations in scope
+  bool resolve_namespaces;
+
+  // Check that the whole source is well-formed UTF-8 when it is opened, so text handed out never needs checking again
+  bool validate_utf8;
+
+  // Drop text nodes that are only whitespace. trim_text also strips leading and trailing whitespace off the text of
+  // the remaining ones, which implies dropping the whitespace-only ones as nothing would be left of them.
+  bool skip_whitespace_text;
+  bool trim_text;
+  bool skip_comments;
+
+  // Only find the '>' of a begin tag, tokenizing its attributes on the first rewind_attributes or get_attribute. Until
+  // then Node::attribute_count is -1, and errors inside the attributes only surface once they are read. Ignored with
+  // resolve_namespaces, which has to see every xmlns declaration.
+  bool lazy_attributes;
+
+  // Don't count lines and columns, Node::line, c0 and c1 are then 0. Errors still carry them, worked out from the
+  // error's offset.
+  bool skip_positions;
+};
+
+struct NodePipeline;
+struct NodeCache;
+struct ParserVariant;
+
 struct Parser {
+  ParserOptions options; // Read when a source is opened, which picks the variant of the lexer and node parsers
+  const ParserVariant *variant;
   String source;
   ParserSourceType source_type;
   char *buffer;
   int64_t length;
+  FileSource file; // For PST_FILE, buffer is file.data
+  SourceEncoding encoding;
+  char *transcoded; // Owned UTF-8 copy of a UTF-16 source, buffer points to it
 
   char *ptr;
   char *end_ptr;
@@ -111,8 +252,15 @@ struct Parser {
   int64_t line;
   int64_t col;
 
+  // With skip_positions, how far errors have been located so far, so locating the next one picks up from there
+  int64_t located_offset;
+  int64_t located_line;
+  int64_t located_col;
+
   bool done;
   bool errored;
+  ParserError error;
+  int64_t error_count;
   LexerMode mode;
 
   LexerAction tag_initial_map[256];
@@ -127,21 +275,88 @@ struct Parser {
   AttributeBlock attribute_block;
   uint64_t current_attribute_index;
   AttributeBlock* current_attribute_block;
+  int attributes_read;
+
+  // Open addressing table over the current node's attributes, built by the first find_attribute for the node
+  Attribute **attribute_list; // Stretchy array, the node's attributes in order
+  int32_t *attribute_slots;   // Stretchy array, an index in attribute_list + 1, or 0 for a free slot
+  int duplicate_attribute;    // Index of the first attribute repeating an earlier name, -1 when there is none
+  bool attribute_index_built;
+  int32_t *attribute_id_slots; // Stretchy array, the same over resolved namespace id and local name, built on demand
+  bool attribute_id_index_built;
+
+  uint64_t node_serial; // Counts nodes handed out by get_node, never reset, so copies can tell if they are current
+
+  // With lazy_attributes, where the attributes of the current begin tag start while they are pending
+  bool attributes_pending;
+  int64_t pending_offset;
+  int64_t pending_line;
+  int64_t pending_col;
 
   int64_t depth;
+  OpenElement *open_elements; // Stretchy array, innermost last
+  OpenElement broken_element; // An element begin that failed in its attributes, for recover to still open it
+
+  Namespace *namespaces; // Stretchy array
+  NamespaceBinding *namespace_bindings; // Stretchy array, innermost last
+
+  Vocabulary vocabulary; // Names to stamp on nodes and attributes as name_id
+
+  ParserRecording *replay; // Set by parser_replay, nodes then come from the recording instead of the lexer
+  int64_t replay_node;
+  int64_t replay_attribute; // Index of the current node's first attribute in the recording
+  NodePipeline *pipeline;   // Set by pipeline_start, replay then moves from batch to batch as the thread fills them
+  NodeCache *cache;         // Set by cache_open, replay then moves from batch to batch as the cache is decoded
+
+  MemoryArena arena;
+
+#ifdef PARSER_STATS
+  ParserStats stats;
+#endif
 };
 
 void parser_init(Parser *parser);
 bool parser_open_memory(Parser *parser, String name, const char *memory, int64_t offset = 0, int64_t length = 0);
-bool parser_open_file_mmap(Parser *parser, String filename, int64_t offset = 0, int64_t length = 0);
+bool parser_open_file(Parser *parser, String filename, int64_t offset = 0, int64_t length = 0, IoOptions io = {});
 void parser_destroy(Parser *parser);
 
-void print_error_start(Parser *parser, Token token);
+// Parses the rest of the opened source into recording, which keeps pointing into the source buffer
+void parser_record(Parser *parser, ParserRecording *recording);
+void parser_record_node(Parser *parser, ParserRecording *recording); // Appends the current node and its attributes
+// Opens a recording made from buffer, or stops replaying when recording is null
+void parser_replay(Parser *parser, String name, const char *buffer, int64_t length, ParserRecording *recording);
+void recording_free(ParserRecording *recording);
+
+void parser_error(Parser *parser, ParserErrorCode code, Token token, char character = 0,
+                  TokenType expected = TOK_INVALID);
 bool expect_type(Parser *parser, TokenType type);
 
+const char *error_code_name(ParserErrorCode code);
+int format_token_type(char *buffer, size_t size, TokenType type);
+int format_error(Parser *parser, char *buffer, size_t size); // snprintf style, "source:line:column - message"
+void print_error(Parser *parser);
+
+// Qualified name of the element enclosing the current node, empty at the top level. The open elements enclosing it
+// are open_elements[0] up to open_elements[node.depth - 1].
+String parent_name(Parser *parser);
+
+int32_t intern_namespace(Parser *parser, String uri);
+String namespace_uri(Parser *parser, int32_t namespace_id); // Empty for unknown ids
+
 Token read_token(Parser *parser); // Internal only: use get_token instead
 Node get_node(Parser *parser);
 Attribute get_attribute(Parser* parser);
+void rewind_attributes(Parser *parser); // Restart get_attribute at the first attribute of the current node
+bool parse_attributes(Parser *parser);  // Tokenizes pending lazy attributes, false on an error in them
+
+// Looks an attribute of the current node up by name and namespace prefix as written, through a hash table over the
+// node's attributes that the first lookup for a node builds. Null when the node has no such attribute.
+Attribute *find_attribute(Parser *parser, String name, String xml_namespace = {});
+// The same by local name and resolved namespace id, through a second table that the first such lookup builds
+Attribute *find_attribute_by_namespace_id(Parser *parser, String name, int32_t namespace_id);
+// Index of the first attribute of the current node repeating an earlier name, -1 when all names are unique. Comes out
+// of building the same table.
+int find_duplicate_attribute(Parser *parser);
 
 inline Token peek_token(Parser *parser) {
   if (parser->has_next_token) return parser->next_token;
@@ -0,0 +1,135 @@
+#include "pipeline.hpp"
+
+#include <sched.h>
+#include <unistd.h>
+
+// Yields for a while first, as the other side is usually about to catch up, then sleeps
+static void back_off(int *spins) {
+  if ((*spins)++ < 64) {
+    sched_yield();
+  } else {
+    usleep(50);
+  }
+}
+
+static void *pipeline_main(void *data) {
+  auto pipeline = (NodePipeline *) data;
+  auto parser = &pipeline->producer;
+
+  for (uint64_t head = 0;; head++) {
+    int spins = 0;
+    while (head - pipeline->tail.load(std::memory_order_acquire) >= pipeline_batch_count) {
+      if (pipeline->stop.load(std::memory_order_relaxed)) return nullptr;
+      back_off(&spins);
+    }
+    if (pipeline->stop.load(std::memory_order_relaxed)) return nullptr;
+
+    auto batch = &pipeline->batches[head % pipeline_batch_count];
+    auto recording = &batch->recording;
+    aclear(recording->nodes);
+    aclear(recording->attributes);
+
+    bool more = true;
+    while (alen(recording->nodes) < pipeline_batch_nodes) {
+      if (!get_node(parser).type) {
+        more = false;
+        break;
+      }
+      parser_record_node(parser, recording);
+    }
+    recording->error = parser->error;
+    recording->errored = parser->errored;
+    recording->error_count = parser->error_count;
+    batch->last = !more;
+
+    pipeline->head.store(head + 1, std::memory_order_release);
+    if (batch->last) return nullptr;
+  }
+}
+
+bool pipeline_start(Parser *parser) {
+  if (parser->pipeline || parser->replay || parser->source_type == PST_NONE) return false;
+  if (parser->node.type || parser->done || parser->errored) return false;
+
+  auto pipeline = raw_allocate_type_zero(NodePipeline);
+  pipeline->head = 0;
+  pipeline->tail = 0;
+  pipeline->stop = false;
+  pipeline->interrupted = false;
+
+  auto producer = &pipeline->producer;
+  parser_init(producer);
+  producer->options = parser->options;
+  producer->options.resolve_namespaces = false; // Ids interned on the thread would mean nothing to the consumer
+  producer->options.validate_utf8 = false;      // Already done when the consumer opened the source
+  for (int32_t id = 1; id < (int32_t) alen(parser->vocabulary.names); id++) {
+    vocabulary_add(&producer->vocabulary, parser->vocabulary.names[id]);
+  }
+  parser_open_memory(producer, parser->source, parser->buffer, 0, parser->length);
+
+  if (pthread_create(&pipeline->thread, nullptr, pipeline_main, pipeline) != 0) {
+    parser_destroy(producer);
+    raw_free(pipeline);
+    return false;
+  }
+
+  parser->pipeline = pipeline;
+  parser->replay = &pipeline->empty;
+  parser->replay_node = 0;
+  parser->replay_attribute = 0;
+  return true;
+}
+
+void pipeline_stop(Parser *parser) {
+  auto pipeline = parser->pipeline;
+  if (!pipeline) return;
+
+  pipeline->stop = true;
+  pthread_join(pipeline->thread, nullptr);
+  for (auto &batch : pipeline->batches) recording_free(&batch.recording);
+  parser_destroy(&pipeline->producer);
+  raw_free(pipeline);
+  parser->pipeline = nullptr;
+  parser->replay = nullptr;
+}
+
+bool pipeline_next(Parser *parser) {
+  auto pipeline = parser->pipeline;
+  if (pipeline->holding) {
+    if (pipeline->batches[pipeline->current % pipeline_batch_count].last) return false;
+    pipeline->current++;
+    pipeline->tail.store(pipeline->current, std::memory_order_release);
+  }
+
+  int spins = 0;
+  while (pipeline->head.load(std::memory_order_acquire) <= pipeline->current) back_off(&spins);
+
+  auto recording = &pipeline->batches[pipeline->current % pipeline_batch_count].recording;
+  pipeline->holding = true;
+  parser->replay = recording;
+  parser->replay_node = 0;
+  parser->replay_attribute = 0;
+  parser->error_count = recording->error_count; // In recover mode the count may run up to a batch ahead
+  if (recording->error_count) parser->error = recording->error;
+  return true;
+}
+
+bool pipeline_ready(Parser *parser) {
+  auto pipeline = parser->pipeline;
+  if (parser->replay_node < (int64_t) alen(parser->replay->nodes)) return true;
+  if (pipeline->holding && pipeline->batches[pipeline->current % pipeline_batch_count].last) return true;
+  auto wanted = pipeline->holding ? pipeline->current + 1 : pipeline->current;
+  return pipeline->head.load(std::memory_order_acquire) > wanted;
+}
+
+void pipeline_wait(Parser *parser) {
+  int spins = 0;
+  while (!pipeline_ready(parser)) {
+    if (parser->pipeline->interrupted.exchange(false)) return;
+    back_off(&spins);
+  }
+}
+
+void pipeline_interrupt(NodePipeline *pipeline) {
+  pipeline->interrupted = true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+#include "parser.hpp"
+
+static const int64_t pipeline_batch_nodes = 4096;
+static const uint64_t pipeline_batch_count = 8; // Slots in the ring, how many batches the producer may run ahead
+
+struct PipelineBatch {
+  ParserRecording recording; // Stretchy arrays are cleared and refilled every time the slot comes around
+  bool last;                 // Nothing follows, the recording holds the final error state
+};
+
+// A thread running get_node ahead of a consumer parser, handing nodes and their attributes over in batches through a
+// single-producer single-consumer ring. Batch indices only ever grow, the slot is the index modulo the ring size. The
+// producer fills slots up to tail + pipeline_batch_count and publishes them by advancing head; the consumer replays
+// them in order and releases each by advancing tail. Neither side takes a lock, a side that gets ahead backs off.
+struct NodePipeline {
+  Parser producer; // Parses the consumer's buffer, so node offsets and text point into the same bytes
+  pthread_t thread;
+  PipelineBatch batches[pipeline_batch_count];
+  ParserRecording empty; // Replayed until the first batch arrives
+
+  std::atomic<uint64_t> head; // Batches published
+  char padding[64];            // Keeps the producer's and the consumer's index on separate cache lines
+  std::atomic<uint64_t> tail; // Batches released
+  uint64_t current; // Consumer only: the batch being replayed once holding is set
+  bool holding;
+
+  std::atomic<bool> stop;
+  std::atomic<bool> interrupted; // Makes pipeline_wait return early
+};
+
+// Starts parsing the freshly opened source of parser on a thread, get_node then replays what it produced. Element and
+// attribute name ids carry over from the vocabulary, namespaces are not resolved. Returns false when parser has already
+// read nodes, or the thread could not be started. Pays off for large documents with a consumer doing real work per
+// node on a machine with a core to spare, otherwise the hand-off costs more than the overlap saves.
+bool pipeline_start(Parser *parser);
+// Joins the thread, called by reset_state and parser_destroy
+void pipeline_stop(Parser *parser);
+
+// Moves parser on to the next batch, waiting for it when needed. False after the last one.
+bool pipeline_next(Parser *parser);
+// True when get_node would not wait for the producer
+bool pipeline_ready(Parser *parser);
+// Waits until pipeline_ready, or until pipeline_interrupt is called from another thread
+void pipeline_wait(Parser *parser);
+void pipeline_interrupt(NodePipeline *pipeline);
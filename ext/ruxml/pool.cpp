@@ -0,0 +1,107 @@
+#include "pool.hpp"
+
+struct PoolWorker {
+  ParsePool *pool;
+  int index;
+};
+
+static void worker_run_batch(Parser *parser, ParseBatch *batch) {
+  while (!batch->cancelled.load(std::memory_order_relaxed)) {
+    auto index = batch->next.fetch_add(1);
+    if (index >= batch->count) break;
+
+    parser->options = batch->options;
+    auto document = batch->documents[index];
+    parser_open_memory(parser, "document"_str, document.data, 0, document.length);
+    parser_record(parser, &batch->recordings[index]);
+  }
+}
+
+static void *worker_main(void *data) {
+  auto pool = ((PoolWorker *) data)->pool;
+  auto index = ((PoolWorker *) data)->index;
+  auto parser = &pool->parsers[index];
+  raw_free(data);
+
+  uint64_t seen = 0;
+  while (true) {
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->stopping && pool->generation == seen) pthread_cond_wait(&pool->work_ready, &pool->mutex);
+    if (pool->stopping) {
+      pthread_mutex_unlock(&pool->mutex);
+      return nullptr;
+    }
+    seen = pool->generation;
+    auto batch = pool->batch;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (index < batch->thread_count) worker_run_batch(parser, batch);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->busy == 0) pthread_cond_broadcast(&pool->work_done);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+bool parse_pool_init(ParsePool *pool, int thread_count) {
+  *pool = ParsePool{};
+  pthread_mutex_init(&pool->mutex, nullptr);
+  pthread_cond_init(&pool->work_ready, nullptr);
+  pthread_cond_init(&pool->work_done, nullptr);
+
+  pool->threads = (pthread_t *) raw_allocate_size(sizeof(pthread_t) * thread_count);
+  pool->parsers = (Parser *) raw_allocate_size(sizeof(Parser) * thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    pool->parsers[i] = Parser{};
+    parser_init(&pool->parsers[i]);
+
+    auto worker = raw_allocate_type(PoolWorker);
+    *worker = PoolWorker{pool, i};
+    if (pthread_create(&pool->threads[i], nullptr, worker_main, worker) != 0) {
+      raw_free(worker);
+      parser_destroy(&pool->parsers[i]);
+      break;
+    }
+    pool->thread_count++;
+  }
+
+  if (pool->thread_count == 0) {
+    parse_pool_destroy(pool);
+    return false;
+  }
+  return true;
+}
+
+void parse_pool_destroy(ParsePool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (int i = 0; i < pool->thread_count; i++) {
+    pthread_join(pool->threads[i], nullptr);
+    parser_destroy(&pool->parsers[i]);
+  }
+
+  raw_free(pool->threads);
+  raw_free(pool->parsers);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_cond_destroy(&pool->work_done);
+  *pool = ParsePool{};
+}
+
+void parse_pool_run(ParsePool *pool, ParseBatch *batch) {
+  batch->next = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->batch) pthread_cond_wait(&pool->work_done, &pool->mutex); // Another caller's batch is running
+  pool->batch = batch;
+  pool->busy = pool->thread_count;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_ready);
+  while (pool->busy > 0) pthread_cond_wait(&pool->work_done, &pool->mutex);
+  pool->batch = nullptr;
+  pthread_cond_broadcast(&pool->work_done);
+  pthread_mutex_unlock(&pool->mutex);
+}
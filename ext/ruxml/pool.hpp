@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+#include "parser.hpp"
+
+// One call's worth of documents. Workers take the next document index until all are parsed, so results land in
+// recordings in input order whatever thread parsed them.
+struct ParseBatch {
+  String *documents;
+  ParserRecording *recordings; // One per document
+  int64_t count;
+  ParserOptions options;
+  int thread_count; // Workers that take part, the rest of the pool sits the batch out
+
+  std::atomic<int64_t> next;
+  std::atomic<bool> cancelled; // Set from another thread to stop handing out documents
+};
+
+// Threads that each own a Parser, reused from batch to batch so only the first batch pays for parser_init. Only
+// destroy a pool that no caller is in parse_pool_run on.
+struct ParsePool {
+  int thread_count;
+  pthread_t *threads;
+  Parser *parsers;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  ParseBatch *batch;
+  uint64_t generation; // Bumped for every batch, workers wait for it to change
+  int busy;
+  bool stopping;
+};
+
+bool parse_pool_init(ParsePool *pool, int thread_count);
+void parse_pool_destroy(ParsePool *pool);
+
+// Blocks until every document in batch is recorded, or the batch was cancelled. Batches from several callers take
+// turns.
+void parse_pool_run(ParsePool *pool, ParseBatch *batch);
@@ -0,0 +1,66 @@
+#include "record.hpp"
+
+void record_schema_init(RecordSchema *schema, Parser *parser, String record_name, RecordField *fields, String *names,
+                        int field_count) {
+  schema->record_name_id = vocabulary_add(&parser->vocabulary, record_name);
+  schema->fields = fields;
+  schema->field_count = field_count;
+  for (int i = 0; i < field_count; i++) fields[i].name_id = vocabulary_add(&parser->vocabulary, names[i]);
+}
+
+static int find_field(RecordSchema *schema, int32_t name_id, bool attribute) {
+  for (int i = 0; i < schema->field_count; i++) {
+    auto field = &schema->fields[i];
+    if (field->name_id == name_id && field->attribute == attribute) return i;
+  }
+  return -1;
+}
+
+bool record_next(Parser *parser, RecordSchema *schema, Value *values) {
+  Node node;
+  do {
+    node = get_node(parser);
+    if (!node.type) return false;
+  } while (node.type != NODE_ELEMENT_BEGIN || node.name_id != schema->record_name_id);
+
+  for (int i = 0; i < schema->field_count; i++) {
+    values[i] = Value{};
+    values[i].type = schema->fields[i].type;
+  }
+
+  rewind_attributes(parser);
+  for (int i = 0; i < parser->node.attribute_count; i++) {
+    auto attribute = get_attribute(parser);
+    auto field = find_field(schema, attribute.name_id, true);
+    if (field >= 0) parse_value(attribute.value, schema->fields[field].type, &values[field]);
+  }
+  rewind_attributes(parser);
+  if (node.self_closing) return true;
+
+  // Child element text sits two levels below the record, the first text node of a field wins
+  auto record_depth = node.depth;
+  int field = -1;
+  while (true) {
+    node = get_node(parser);
+    if (!node.type) return !parser->errored; // Input that ends inside a record ends on an error
+
+    if (node.type == NODE_ELEMENT_END) {
+      if (node.depth == record_depth) return true;
+      if (node.depth == record_depth + 1 && field >= 0 && values[field].state == VS_MISSING) {
+        parse_value(String{}, schema->fields[field].type, &values[field]);
+      }
+      if (node.depth == record_depth + 1) field = -1;
+    } else if (node.type == NODE_ELEMENT_BEGIN && node.depth == record_depth + 1) {
+      field = find_field(schema, node.name_id, false);
+      if (node.self_closing) {
+        if (field >= 0 && values[field].state == VS_MISSING) {
+          parse_value(String{}, schema->fields[field].type, &values[field]);
+        }
+        field = -1;
+      }
+    } else if (node.type == NODE_TEXT && node.depth == record_depth + 2 && field >= 0 &&
+               values[field].state == VS_MISSING) {
+      parse_value(node.text, schema->fields[field].type, &values[field]);
+    }
+  }
+}
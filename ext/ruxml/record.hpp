@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+#include "parser.hpp"
+#include "values.hpp"
+
+// A field of a record: an attribute of the record element, or the text of one of its child elements
+struct RecordField {
+  int32_t name_id; // From the parser vocabulary
+  bool attribute;
+  ValueType type;
+};
+
+// Describes the repeated elements to extract, e.g. <order id="1"><total>9.5</total></order>. Fields are stored by the
+// caller.
+struct RecordSchema {
+  int32_t record_name_id;
+  RecordField *fields;
+  int field_count;
+};
+
+// Registers the record and field names in the parser vocabulary and fills in their ids
+void record_schema_init(RecordSchema *schema, Parser *parser, String record_name, RecordField *fields, String *names,
+                        int field_count);
+
+// Advances to the next record element and parses its fields into values, one per field and in the same order, without
+// copying any text. Returns false at the end of the input or when the parser stops on an error.
+bool record_next(Parser *parser, RecordSchema *schema, Value *values);
@@ -1,5 +1,16 @@
 #include "parser.hpp"
+#include "writer.hpp"
+#include "filter.hpp"
+#include "sax.hpp"
+#include "pipeline.hpp"
+#include "cache.hpp"
+#include "record.hpp"
+#include "columns.hpp"
+#include "pool.hpp"
 #include <ruby/ruby.h>
+#include <ruby/encoding.h>
+#include <ruby/thread.h>
+#include <unistd.h>
 
 extern "C"
 {
@@ -7,8 +18,19 @@ extern "C"
 VALUE ruxmlModule;
 VALUE ruxmlParser;
 VALUE ruxmlNode;
+VALUE ruxmlWriter;
 
 ID node_type_ids[MAX_NODE_TYPES];
+ID value_type_ids[MAX_VALUE_TYPES];
+ID id_write;
+ID id_new;
+ID id_drop;
+ID id_drop_content;
+ID id_start_element;
+ID id_attr;
+ID id_end_element;
+ID id_text;
+ID id_comment;
 
 //
 // Helpers
@@ -16,18 +38,40 @@ ID node_type_ids[MAX_NODE_TYPES];
 
 VALUE rbstr_from_str(String str) { return rb_str_export_locale(rb_str_new(str.data, str.length)); }
 
-String str_from_rbstr(VALUE rbstr) { return String{(int) RSTRING_LEN(rbstr), StringValuePtr(rbstr)}; }
+String str_from_rbstr(VALUE rbstr) { return String{(int64_t) RSTRING_LEN(rbstr), StringValuePtr(rbstr)}; }
+
+VALUE offset_or_nil(int64_t offset) { return offset < 0 ? Qnil : LL2NUM(offset); }
 
 //
 // Node
 //
 
+// A copy of a parser's node, remembering the parser so attributes can be read while it is still the current node
+struct RubyNode {
+  Node node;
+  VALUE parser;           // Qnil for nodes made with Node.new
+  VALUE source;           // The Ruby object holding the bytes the strings point into, Qnil when the parser owns them
+  uint64_t serial;        // Parser::node_serial when the copy was made
+  uint64_t source_serial; // RubyParser::source_serial when the copy was made
+};
+
+static uint64_t Parser_source_serial(VALUE self);
+
+static RubyNode *RubyNode_instance(VALUE self) {
+  return (RubyNode *) RDATA(self)->data;
+}
+
 static Node *Node_instance(VALUE self) {
-  return (Node *) RDATA(self)->data;
+  return &RubyNode_instance(self)->node;
 }
 
 static size_t Node_size(const void *data) {
-  return sizeof(Node);
+  return sizeof(RubyNode);
+}
+
+static void Node_mark(void *data) {
+  rb_gc_mark(((RubyNode *) data)->parser);
+  rb_gc_mark(((RubyNode *) data)->source);
 }
 
 static void Node_free(void *data) {
@@ -36,50 +80,106 @@ static void Node_free(void *data) {
 
 rb_data_type_t Node_data_type = {
     "Node",
-    {NULL, Node_free, Node_size},
+    {Node_mark, Node_free, Node_size},
     0, 0,
     RUBY_TYPED_FREE_IMMEDIATELY
 };
 
 static VALUE Node_allocate(VALUE self) {
-  Node *node;
-  return TypedData_Make_Struct(self, Node, &Node_data_type, node);
+  RubyNode *node;
+  VALUE result = TypedData_Make_Struct(self, RubyNode, &Node_data_type, node);
+  node->parser = Qnil;
+  node->source = Qnil;
+  return result;
 }
 
 static VALUE Node_initialize(VALUE self) {
-  Node *node;
-  TypedData_Get_Struct(self, Node, &Node_data_type, node);
-  *node = Node{};
+  RubyNode *node;
+  TypedData_Get_Struct(self, RubyNode, &Node_data_type, node);
+  *node = RubyNode{};
+  node->parser = Qnil;
+  node->source = Qnil;
   return self;
 }
 
 static VALUE Node_column_start(VALUE self) {
   auto node = Node_instance(self);
-  return INT2NUM(node->c0);
+  return LL2NUM(node->c0);
+}
+
+static VALUE Node_column_end(VALUE self) {
+  auto node = Node_instance(self);
+  return LL2NUM(node->c1);
 }
 
 static VALUE Node_line(VALUE self) {
   auto node = Node_instance(self);
-  return INT2NUM(node->line);
+  return LL2NUM(node->line);
 }
 
 static VALUE Node_offset(VALUE self) {
   auto node = Node_instance(self);
-  return INT2NUM(node->offset);
+  return LL2NUM(node->offset);
+}
+
+static VALUE Node_tag_start(VALUE self) {
+  auto node = Node_instance(self);
+  return offset_or_nil(node->tag_start);
+}
+
+static VALUE Node_tag_end(VALUE self) {
+  auto node = Node_instance(self);
+  return offset_or_nil(node->tag_end);
+}
+
+static VALUE Node_content_start(VALUE self) {
+  auto node = Node_instance(self);
+  return offset_or_nil(node->content_start);
+}
+
+static VALUE Node_content_end(VALUE self) {
+  auto node = Node_instance(self);
+  return offset_or_nil(node->content_end);
+}
+
+static VALUE Node_element_start(VALUE self) {
+  auto node = Node_instance(self);
+  return offset_or_nil(node->element_start);
+}
+
+// Bytes the parser owns, a mapped file or a transcoded copy, are gone once it opens another source, so reading them
+// through an older node raises instead
+static String Node_string(VALUE self, String string) {
+  auto node = RubyNode_instance(self);
+  if (NIL_P(node->source) && !NIL_P(node->parser) && Parser_source_serial(node->parser) != node->source_serial) {
+    rb_raise(rb_eRuntimeError, "the parser has opened another source since this node");
+  }
+  return string;
 }
 
 static VALUE Node_namespace(VALUE self) {
   auto node = Node_instance(self);
-  return rbstr_from_str(node->xml_namespace);
+  return rbstr_from_str(Node_string(self, node->xml_namespace));
+}
+
+static VALUE Node_namespace_id(VALUE self) {
+  auto node = Node_instance(self);
+  return INT2NUM(node->namespace_id);
+}
+
+static VALUE Node_name_id(VALUE self) {
+  auto node = Node_instance(self);
+  return INT2NUM(node->name_id);
 }
 
 static VALUE Node_text(VALUE self) {
   auto node = Node_instance(self);
-  return rbstr_from_str(node->text);
+  return rbstr_from_str(Node_string(self, node->text));
 }
 
 static VALUE Node_attribute_count(VALUE self) {
   auto node = Node_instance(self);
+  if (node->attribute_count < 0) return Qnil; // Copied while lazy attributes were still pending
   return INT2NUM(node->attribute_count);
 }
 
@@ -93,41 +193,100 @@ static VALUE Node_self_closing(VALUE self) {
   return node->self_closing ? Qtrue : Qfalse;
 }
 
+static VALUE Node_whitespace(VALUE self) {
+  auto node = Node_instance(self);
+  return node->whitespace ? Qtrue : Qfalse;
+}
+
 //
 // Parser
 //
 
+// The parser and the Ruby strings its source and name point into. Marking pins them, so they stay alive and in place
+// for as long as the parser, or its pipeline thread, reads them.
+struct RubyParser {
+  Parser parser;
+  VALUE source;
+  VALUE name;
+  uint64_t source_serial; // Counts opened sources, see RubyNode::source
+  Value *pending_row;     // Stretchy array, ColumnTable::pending kept from one read_columns batch to the next
+};
+
+static RubyParser *RubyParser_instance(VALUE self) {
+  return (RubyParser *) RDATA(self)->data;
+}
+
 static Parser *Parser_instance(VALUE self) {
-  return (Parser *) RDATA(self)->data;
+  return &RubyParser_instance(self)->parser;
 }
 
 static size_t Parser_size(const void *data) {
-  return sizeof(Parser);
+  return sizeof(RubyParser);
+}
+
+static void Parser_mark(void *data) {
+  rb_gc_mark(((RubyParser *) data)->source);
+  rb_gc_mark(((RubyParser *) data)->name);
 }
 
 static void Parser_free(void *data) {
-  parser_destroy((Parser *) data);
+  parser_destroy(&((RubyParser *) data)->parser);
+  afree(((RubyParser *) data)->pending_row);
   free(data);
 }
 
 rb_data_type_t Parser_data_type = {
     "Parser",
-    {NULL, Parser_free, Parser_size},
+    {Parser_mark, Parser_free, Parser_size},
     0, 0,
     RUBY_TYPED_FREE_IMMEDIATELY
 };
 
 static VALUE Parser_allocate(VALUE self) {
-  Parser *parser;
-  return TypedData_Make_Struct(self, Parser, &Parser_data_type, parser);
+  RubyParser *parser;
+  VALUE result = TypedData_Make_Struct(self, RubyParser, &Parser_data_type, parser);
+  parser->source = Qnil;
+  parser->name = Qnil;
+  return result;
 }
 
-static VALUE Parser_initialize(VALUE self) {
-  Parser *parser;
-  TypedData_Get_Struct(self, Parser, &Parser_data_type, parser);
+static void Parser_keep_source(VALUE self, VALUE name, VALUE source) {
+  RubyParser_instance(self)->name = name;
+  RubyParser_instance(self)->source = source;
+  RubyParser_instance(self)->source_serial++;
+  aclear(RubyParser_instance(self)->pending_row); // It points into the previous source
+}
 
-  *parser = Parser{};
+static uint64_t Parser_source_serial(VALUE self) {
+  return RubyParser_instance(self)->source_serial;
+}
+
+static ParserOptions parser_options_from_hash(VALUE options) {
+  ParserOptions result = {};
+  result.recover = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("recover"))));
+  result.resolve_namespaces = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("resolve_namespaces"))));
+  result.validate_utf8 = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("validate_utf8"))));
+  result.skip_whitespace_text = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("skip_whitespace_text"))));
+  result.trim_text = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("trim_text"))));
+  result.skip_comments = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("skip_comments"))));
+  result.lazy_attributes = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("lazy_attributes"))));
+  result.skip_positions = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("skip_positions"))));
+  return result;
+}
+
+static VALUE Parser_initialize(int argc, VALUE* argv, VALUE self) {
+  VALUE options;
+  rb_scan_args(argc, argv, "0:", &options);
+
+  RubyParser *ruby_parser;
+  TypedData_Get_Struct(self, RubyParser, &Parser_data_type, ruby_parser);
+
+  auto parser = &ruby_parser->parser;
+  *ruby_parser = RubyParser{};
+  ruby_parser->source = Qnil;
+  ruby_parser->name = Qnil;
   parser_init(parser);
+  if (!NIL_P(options)) parser->options = parser_options_from_hash(options);
   return self;
 }
 
@@ -144,60 +303,355 @@ static VALUE Parser_open_string(int argc, VALUE* argv, VALUE self) {
   int64_t data_offset = 0;
   if (!NIL_P(offset)) {
     Check_Type(offset, T_FIXNUM);
-    data_offset = NUM2INT(offset);
+    data_offset = NUM2LL(offset);
   }
 
   int64_t data_length;
   if (NIL_P(length)) {
-    data_length = RSTRING_LEN(data);
+    data_length = RSTRING_LEN(data) - data_offset;
   } else {
     Check_Type(length, T_FIXNUM);
-    data_length = NUM2INT(length);
+    data_length = NUM2LL(length);
+  }
+  if (data_offset < 0 || data_length < 0 || data_offset + data_length > RSTRING_LEN(data)) {
+    rb_raise(rb_eArgError, "offset %lld and length %lld do not fit in a string of %ld bytes", (long long) data_offset,
+             (long long) data_length, RSTRING_LEN(data));
   }
 
+  // A frozen copy shares the bytes until the caller changes the string, which then leaves them to the parser, as nodes
+  // and a pipeline thread read them long after open_string returns
   auto parser = Parser_instance(self);
-  auto success = parser_open_memory(parser, str_from_rbstr(name), StringValuePtr(data), data_offset, data_length);
+  data = rb_str_new_frozen(data);
+  Parser_keep_source(self, name, data);
+  auto success = parser_open_memory(parser, str_from_rbstr(name), RSTRING_PTR(data), data_offset, data_length);
   return success ? Qtrue : Qfalse;
 }
 
+static IoStrategy io_strategy_from_symbol(VALUE io) {
+  Check_Type(io, T_SYMBOL);
+  auto id = SYM2ID(io);
+  for (int i = 0; i < MAX_IO_STRATEGIES; i++) {
+    if (rb_intern(io_strategy_name((IoStrategy) i)) == id) return (IoStrategy) i;
+  }
+  rb_raise(rb_eArgError, "Unknown io strategy :%s, expected auto, mmap, sequential, populate, prefetch or read",
+           rb_id2name(id));
+}
+
+// The io: and window: options of open_file
+static IoOptions io_options_from_hash(VALUE options) {
+  IoOptions io = {};
+  if (!NIL_P(options)) {
+    VALUE io_option = rb_hash_aref(options, ID2SYM(rb_intern("io")));
+    if (!NIL_P(io_option)) io.strategy = io_strategy_from_symbol(io_option);
+    VALUE window = rb_hash_aref(options, ID2SYM(rb_intern("window")));
+    if (!NIL_P(window)) io.window = NUM2LL(window);
+    if (io.window < 0) rb_raise(rb_eArgError, "window must not be negative");
+  }
+  return io;
+}
+
+// open_file(filename, offset = nil, length = nil, io: :auto, window: nil)
 static VALUE Parser_open_file(int argc, VALUE* argv, VALUE self) {
   VALUE filename;
   VALUE offset;
   VALUE length;
-  rb_scan_args(argc, argv, "12", &filename, &offset, &length);
+  VALUE options;
+  rb_scan_args(argc, argv, "12:", &filename, &offset, &length, &options);
 
   Check_Type(filename, T_STRING);
 
   int64_t data_offset = 0;
   if (!NIL_P(offset)) {
     Check_Type(offset, T_FIXNUM);
-    data_offset = NUM2INT(offset);
+    data_offset = NUM2LL(offset);
   }
 
   int64_t data_length = 0;
   if (!NIL_P(length)) {
     Check_Type(length, T_FIXNUM);
-    data_length = NUM2INT(length);
+    data_length = NUM2LL(length);
   }
 
   auto parser = Parser_instance(self);
-  auto success = parser_open_file_mmap(parser, str_from_rbstr(filename), data_offset, data_length);
+  Parser_keep_source(self, filename, Qnil);
+  auto io = io_options_from_hash(options);
+  auto success = parser_open_file(parser, str_from_rbstr(filename), data_offset, data_length, io);
   return success ? Qtrue : Qfalse;
 }
 
+// Parses filename to the end and writes its event cache to cache_path. False when the file could not be opened, see
+// error, raises SystemCallError when the cache could not be written.
+static VALUE Parser_build_cache(int argc, VALUE* argv, VALUE self) {
+  VALUE filename;
+  VALUE cache_path;
+  VALUE options;
+  rb_scan_args(argc, argv, "2:", &filename, &cache_path, &options);
+  Check_Type(filename, T_STRING);
+  Check_Type(cache_path, T_STRING);
+
+  auto parser = Parser_instance(self);
+  auto io = io_options_from_hash(options);
+  Parser_keep_source(self, filename, Qnil);
+  if (cache_build(parser, str_from_rbstr(filename), str_from_rbstr(cache_path), io)) return Qtrue;
+  if (parser->errored && parser->error.code == PE_OPEN_FAILED) return Qfalse;
+  rb_sys_fail(RSTRING_PTR(cache_path));
+}
+
+// Opens filename replaying the event cache at cache_path when that is current, otherwise to be parsed as usual.
+// Returns :current, :missing or :stale.
+static VALUE Parser_open_cache(int argc, VALUE* argv, VALUE self) {
+  VALUE filename;
+  VALUE cache_path;
+  VALUE options;
+  rb_scan_args(argc, argv, "2:", &filename, &cache_path, &options);
+  Check_Type(filename, T_STRING);
+  Check_Type(cache_path, T_STRING);
+
+  auto parser = Parser_instance(self);
+  auto io = io_options_from_hash(options);
+  Parser_keep_source(self, filename, Qnil);
+  auto status = cache_open(parser, str_from_rbstr(filename), str_from_rbstr(cache_path), io);
+  return ID2SYM(rb_intern(cache_status_name(status)));
+}
+
+// The encoding the source arrived in, detected from its byte order mark or XML declaration. Text is always UTF-8.
+static VALUE Parser_encoding(VALUE self) {
+  auto parser = Parser_instance(self);
+  return rb_enc_from_encoding(rb_enc_find(source_encoding_name(parser->encoding)));
+}
+
+// The strategy an open file was read with, nil for other sources
+static VALUE Parser_io(VALUE self) {
+  auto parser = Parser_instance(self);
+  if (parser->source_type != PST_FILE) return Qnil;
+  return ID2SYM(rb_intern(io_strategy_name(parser->file.strategy)));
+}
+
+// Parses the rest of the freshly opened source on a native thread, next_node and each then drain what it produced
+static VALUE Parser_start_pipeline(VALUE self) {
+  auto parser = Parser_instance(self);
+  if (parser->pipeline) return Qtrue;
+  if (parser->node.type || parser->replay) {
+    rb_raise(rb_eRuntimeError, "the pipeline has to start before the first node");
+  }
+  return pipeline_start(parser) ? Qtrue : Qfalse;
+}
+
 static VALUE Parser_node(VALUE self) {
   auto parser = Parser_instance(self);
-  auto node_ptr = raw_allocate_type(Node);
-  *node_ptr = parser->node;
+  auto node_ptr = raw_allocate_type(RubyNode);
+  node_ptr->node = parser->node;
+  node_ptr->parser = self;
+  node_ptr->serial = parser->node_serial;
+  bool owned = parser->transcoded || parser->source_type == PST_FILE;
+  node_ptr->source = owned ? Qnil : RubyParser_instance(self)->source;
+  node_ptr->source_serial = RubyParser_instance(self)->source_serial;
   return TypedData_Wrap_Struct(ruxmlNode, &Node_data_type, node_ptr);
 }
 
+static void *Parser_pipeline_wait(void *data) {
+  pipeline_wait((Parser *) data);
+  return nullptr;
+}
+
+static void Parser_pipeline_interrupt(void *data) {
+  pipeline_interrupt((NodePipeline *) data);
+}
+
 static VALUE Parser_next_node(VALUE self) {
   auto parser = Parser_instance(self);
+  // Waits for the parsing thread without the GVL, so other Ruby threads run meanwhile
+  while (parser->pipeline && !pipeline_ready(parser)) {
+    rb_thread_call_without_gvl(Parser_pipeline_wait, parser, Parser_pipeline_interrupt, parser->pipeline);
+    rb_thread_check_ints();
+  }
   get_node(parser);
   return parser->done ? Qfalse : Qtrue;
 }
 
+static VALUE rbstr_from_qualified_name(String xml_namespace, String name) {
+  if (str_empty(xml_namespace)) return rbstr_from_str(name);
+  VALUE result = rb_str_buf_new(xml_namespace.length + 1 + name.length);
+  rb_str_cat(result, xml_namespace.data, xml_namespace.length);
+  rb_str_cat(result, ":", 1);
+  rb_str_cat(result, name.data, name.length);
+  return rb_str_export_locale(result);
+}
+
+// An Integer namespace is a resolved namespace id, a String the prefix as written
+static VALUE attribute_value(Parser *parser, String name, VALUE xml_namespace) {
+  Attribute *attribute;
+  if (RB_INTEGER_TYPE_P(xml_namespace)) {
+    attribute = find_attribute_by_namespace_id(parser, name, NUM2INT(xml_namespace));
+  } else {
+    attribute = find_attribute(parser, name, NIL_P(xml_namespace) ? str_empty() : str_from_rbstr(xml_namespace));
+  }
+  return attribute ? rbstr_from_str(attribute->value) : Qnil;
+}
+
+// name is the attribute's local name, or its id from register_name
+static VALUE node_attribute(Parser *parser, VALUE name, VALUE xml_namespace) {
+  if (!RB_INTEGER_TYPE_P(name)) return attribute_value(parser, str_from_rbstr(name), xml_namespace);
+  auto name_id = NUM2INT(name);
+  if (name_id <= 0 || name_id >= (int32_t) alen(parser->vocabulary.names)) return Qnil;
+  return attribute_value(parser, parser->vocabulary.names[name_id], xml_namespace);
+}
+
+static VALUE Parser_node_attribute(int argc, VALUE* argv, VALUE self) {
+  VALUE name;
+  VALUE xml_namespace;
+  rb_scan_args(argc, argv, "11", &name, &xml_namespace);
+  return node_attribute(Parser_instance(self), name, xml_namespace);
+}
+
+// Reads an attribute through the parser, which has to still be at this node
+static VALUE Node_aref(int argc, VALUE* argv, VALUE self) {
+  VALUE name;
+  VALUE xml_namespace;
+  rb_scan_args(argc, argv, "11", &name, &xml_namespace);
+
+  auto node = RubyNode_instance(self);
+  if (NIL_P(node->parser) || Parser_instance(node->parser)->node_serial != node->serial) {
+    rb_raise(rb_eRuntimeError, "attributes can only be read while the parser is at the node");
+  }
+  return node_attribute(Parser_instance(node->parser), name, xml_namespace);
+}
+
+// The qualified name of the first attribute repeating an earlier one, nil when the names are unique
+static VALUE Parser_node_duplicate_attribute(VALUE self) {
+  auto parser = Parser_instance(self);
+  auto index = find_duplicate_attribute(parser);
+  if (index < 0) return Qnil;
+  auto attribute = parser->attribute_list[index];
+  return rbstr_from_qualified_name(attribute->xml_namespace, attribute->name);
+}
+
+// "/a/b" for the elements enclosing the current node, plus the node's own name on element begins and ends
+static VALUE Parser_path(VALUE self) {
+  auto parser = Parser_instance(self);
+  auto node = &parser->node;
+  int64_t open_count = alen(parser->open_elements);
+  auto depth = node->depth < open_count ? node->depth : open_count;
+
+  VALUE result = rb_str_buf_new(64);
+  for (int64_t i = 0; i < depth; i++) {
+    auto name = parser->open_elements[i].name;
+    rb_str_cat(result, "/", 1);
+    rb_str_cat(result, name.data, name.length);
+  }
+  if (node->type == NODE_ELEMENT_BEGIN || node->type == NODE_ELEMENT_END) {
+    rb_str_cat(result, "/", 1);
+    if (!str_empty(node->xml_namespace)) {
+      rb_str_cat(result, node->xml_namespace.data, node->xml_namespace.length);
+      rb_str_cat(result, ":", 1);
+    }
+    rb_str_cat(result, node->text.data, node->text.length);
+  }
+  if (RSTRING_LEN(result) == 0) rb_str_cat(result, "/", 1);
+  return rb_str_export_locale(result);
+}
+
+static VALUE Parser_parent_name(VALUE self) {
+  auto name = parent_name(Parser_instance(self));
+  return str_empty(name) ? Qnil : rbstr_from_str(name);
+}
+
+static VALUE Parser_node_attributes(VALUE self) {
+  auto parser = Parser_instance(self);
+  VALUE result = rb_hash_new();
+  rewind_attributes(parser);
+  for (int i = 0; i < parser->node.attribute_count; i++) {
+    auto attribute = get_attribute(parser);
+    rb_hash_aset(result, rbstr_from_qualified_name(attribute.xml_namespace, attribute.name),
+                 rbstr_from_str(attribute.value));
+  }
+  return result;
+}
+
+static VALUE Parser_each_attribute(VALUE self) {
+  RETURN_ENUMERATOR(self, 0, 0);
+  auto parser = Parser_instance(self);
+  rewind_attributes(parser);
+  for (int i = 0; i < parser->node.attribute_count; i++) {
+    auto attribute = get_attribute(parser);
+    rb_yield_values(3, rbstr_from_str(attribute.name), rbstr_from_str(attribute.value),
+                    rbstr_from_str(attribute.xml_namespace));
+  }
+  return self;
+}
+
+static VALUE Parser_register_namespace(VALUE self, VALUE uri) {
+  auto parser = Parser_instance(self);
+  return INT2NUM(intern_namespace(parser, str_from_rbstr(uri)));
+}
+
+static VALUE Parser_namespace_uri(VALUE self, VALUE namespace_id) {
+  auto parser = Parser_instance(self);
+  auto id = NUM2INT(namespace_id);
+  if (id < 0 || id >= (int32_t) alen(parser->namespaces)) return Qnil;
+  return rbstr_from_str(namespace_uri(parser, id));
+}
+
+static VALUE Parser_register_name(VALUE self, VALUE name) {
+  auto parser = Parser_instance(self);
+  Check_Type(name, T_STRING);
+  return INT2NUM(vocabulary_add(&parser->vocabulary, str_from_rbstr(name)));
+}
+
+static VALUE Parser_name_id(VALUE self, VALUE name) {
+  auto parser = Parser_instance(self);
+  Check_Type(name, T_STRING);
+  return INT2NUM(vocabulary_lookup(&parser->vocabulary, str_from_rbstr(name)));
+}
+
+static VALUE Parser_stats(VALUE self) {
+#ifdef PARSER_STATS
+  auto parser = Parser_instance(self);
+  auto stats = &parser->stats;
+  VALUE result = rb_hash_new();
+
+  VALUE bytes_scanned = rb_hash_new();
+  rb_hash_aset(bytes_scanned, ID2SYM(rb_intern("out")), ULL2NUM(stats->bytes_scanned[LM_OUT]));
+  rb_hash_aset(bytes_scanned, ID2SYM(rb_intern("tag")), ULL2NUM(stats->bytes_scanned[LM_TAG]));
+  rb_hash_aset(bytes_scanned, ID2SYM(rb_intern("comment")), ULL2NUM(stats->bytes_scanned[LM_COMMENT]));
+  rb_hash_aset(result, ID2SYM(rb_intern("bytes_scanned")), bytes_scanned);
+
+  VALUE nodes = rb_hash_new();
+  for (int type = NODE_INVALID + 1; type < MAX_NODE_TYPES; type++) {
+    rb_hash_aset(nodes, ID2SYM(node_type_ids[type]), ULL2NUM(stats->nodes[type]));
+  }
+  rb_hash_aset(result, ID2SYM(rb_intern("nodes")), nodes);
+
+  rb_hash_aset(result, ID2SYM(rb_intern("tokens")), ULL2NUM(stats->tokens));
+  rb_hash_aset(result, ID2SYM(rb_intern("attribute_block_overflows")), ULL2NUM(stats->attribute_block_overflows));
+  rb_hash_aset(result, ID2SYM(rb_intern("max_depth")), LL2NUM(stats->max_depth));
+
+#ifdef PARSER_STATS_TIMING
+  rb_hash_aset(result, ID2SYM(rb_intern("lexer_time")), DBL2NUM(stats->lexer_ns / 1e9));
+  rb_hash_aset(result, ID2SYM(rb_intern("parser_time")), DBL2NUM(stats->parser_ns / 1e9));
+#endif
+
+  uint64_t arena_allocated;
+  uint64_t arena_used;
+  arena_stats(&parser->arena, &arena_allocated, &arena_used);
+  rb_hash_aset(result, ID2SYM(rb_intern("arena_allocated")), ULL2NUM(arena_allocated));
+  rb_hash_aset(result, ID2SYM(rb_intern("arena_used")), ULL2NUM(arena_used));
+  return result;
+#else
+  return Qnil;
+#endif
+}
+
+static VALUE Parser_source_slice(VALUE self, VALUE start, VALUE end) {
+  auto parser = Parser_instance(self);
+  int64_t from = NUM2LL(start);
+  int64_t to = NUM2LL(end);
+  if (from < 0 || to < from || to > parser->length) {
+    rb_raise(rb_eIndexError, "source slice %lld...%lld out of range", (long long) from, (long long) to);
+  }
+  return rbstr_from_str(String{(int64_t) (to - from), parser->buffer + from});
+}
+
 static VALUE Parser_done(VALUE self) {
   auto parser = Parser_instance(self);
   return parser->done ? Qtrue : Qfalse;
@@ -208,19 +662,91 @@ static VALUE Parser_errored(VALUE self) {
   return parser->errored ? Qtrue : Qfalse;
 }
 
+static VALUE Parser_error_count(VALUE self) {
+  auto parser = Parser_instance(self);
+  return LL2NUM(parser->error_count);
+}
+
+// The error that stopped the parser, or in recover mode the most recent one
+static VALUE Parser_error(VALUE self) {
+  auto parser = Parser_instance(self);
+  if (parser->error.code == PE_NONE) return Qnil;
+
+  auto error = &parser->error;
+  char message[1024];
+  format_error(parser, message, sizeof(message));
+
+  VALUE details = rb_hash_new();
+  rb_hash_aset(details, ID2SYM(rb_intern("code")), ID2SYM(rb_intern(error_code_name(error->code))));
+  rb_hash_aset(details, ID2SYM(rb_intern("source")), rbstr_from_str(parser->source));
+  rb_hash_aset(details, ID2SYM(rb_intern("offset")), LL2NUM(error->offset));
+  rb_hash_aset(details, ID2SYM(rb_intern("line")), LL2NUM(error->line));
+  rb_hash_aset(details, ID2SYM(rb_intern("column")), LL2NUM(error->column));
+  if (error->code == PE_UNEXPECTED_TOKEN || error->code == PE_UNEXPECTED_CHARACTER) {
+    char token_type[32];
+    format_token_type(token_type, sizeof(token_type), error->expected);
+    rb_hash_aset(details, ID2SYM(rb_intern("expected")), rb_str_new_cstr(token_type));
+  }
+  if (error->code == PE_UNEXPECTED_TOKEN) {
+    char token_type[32];
+    format_token_type(token_type, sizeof(token_type), error->got);
+    rb_hash_aset(details, ID2SYM(rb_intern("got")), rb_str_new_cstr(token_type));
+  } else if (error->code == PE_INVALID_CHARACTER || error->code == PE_UNEXPECTED_CHARACTER) {
+    rb_hash_aset(details, ID2SYM(rb_intern("got")), rb_str_new(&error->character, 1));
+  } else if (error->code == PE_MISMATCHED_END_TAG) {
+    if (!str_empty(error->open_name)) {
+      rb_hash_aset(details, ID2SYM(rb_intern("expected")), rbstr_from_str(error->open_name));
+    }
+    rb_hash_aset(details, ID2SYM(rb_intern("got")), rbstr_from_str(error->end_name));
+  }
+
+  VALUE parse_error_class = rb_path2class("RUXML::ParseError");
+  return rb_funcall(parse_error_class, id_new, 2, rb_str_new_cstr(message), details);
+}
+
 static VALUE Parser_node_column_start(VALUE self) {
   auto parser = Parser_instance(self);
-  return INT2NUM(parser->node.c0);
+  return LL2NUM(parser->node.c0);
+}
+
+static VALUE Parser_node_column_end(VALUE self) {
+  auto parser = Parser_instance(self);
+  return LL2NUM(parser->node.c1);
 }
 
 static VALUE Parser_node_line(VALUE self) {
   auto parser = Parser_instance(self);
-  return INT2NUM(parser->node.line);
+  return LL2NUM(parser->node.line);
 }
 
 static VALUE Parser_node_offset(VALUE self) {
   auto parser = Parser_instance(self);
-  return INT2NUM(parser->node.offset);
+  return LL2NUM(parser->node.offset);
+}
+
+static VALUE Parser_node_tag_start(VALUE self) {
+  auto parser = Parser_instance(self);
+  return offset_or_nil(parser->node.tag_start);
+}
+
+static VALUE Parser_node_tag_end(VALUE self) {
+  auto parser = Parser_instance(self);
+  return offset_or_nil(parser->node.tag_end);
+}
+
+static VALUE Parser_node_content_start(VALUE self) {
+  auto parser = Parser_instance(self);
+  return offset_or_nil(parser->node.content_start);
+}
+
+static VALUE Parser_node_content_end(VALUE self) {
+  auto parser = Parser_instance(self);
+  return offset_or_nil(parser->node.content_end);
+}
+
+static VALUE Parser_node_element_start(VALUE self) {
+  auto parser = Parser_instance(self);
+  return offset_or_nil(parser->node.element_start);
 }
 
 static VALUE Parser_node_namespace(VALUE self) {
@@ -228,6 +754,16 @@ static VALUE Parser_node_namespace(VALUE self) {
   return rbstr_from_str(parser->node.xml_namespace);
 }
 
+static VALUE Parser_node_namespace_id(VALUE self) {
+  auto parser = Parser_instance(self);
+  return INT2NUM(parser->node.namespace_id);
+}
+
+static VALUE Parser_node_name_id(VALUE self) {
+  auto parser = Parser_instance(self);
+  return INT2NUM(parser->node.name_id);
+}
+
 static VALUE Parser_node_text(VALUE self) {
   auto parser = Parser_instance(self);
   return rbstr_from_str(parser->node.text);
@@ -235,6 +771,7 @@ static VALUE Parser_node_text(VALUE self) {
 
 static VALUE Parser_node_attribute_count(VALUE self) {
   auto parser = Parser_instance(self);
+  parse_attributes(parser);
   return INT2NUM(parser->node.attribute_count);
 }
 
@@ -248,6 +785,556 @@ static VALUE Parser_node_self_closing(VALUE self) {
   return parser->node.self_closing ? Qtrue : Qfalse;
 }
 
+static VALUE Parser_node_whitespace(VALUE self) {
+  auto parser = Parser_instance(self);
+  return parser->node.whitespace ? Qtrue : Qfalse;
+}
+
+//
+// Writer
+//
+
+struct RubyWriter {
+  Writer writer;
+  VALUE target; // IO or String that receives the output
+};
+
+static bool Writer_io_sink(void *data, const char *bytes, int64_t length) {
+  rb_funcall((VALUE) data, id_write, 1, rb_str_new(bytes, length));
+  return true;
+}
+
+static bool Writer_string_sink(void *data, const char *bytes, int64_t length) {
+  rb_str_cat((VALUE) data, bytes, length);
+  return true;
+}
+
+static void Writer_mark(void *data) {
+  rb_gc_mark(((RubyWriter *) data)->target);
+}
+
+static size_t Writer_size(const void *data) {
+  return sizeof(RubyWriter) + ((RubyWriter *) data)->writer.capacity;
+}
+
+static void Writer_free(void *data) {
+  writer_destroy(&((RubyWriter *) data)->writer);
+  free(data);
+}
+
+rb_data_type_t Writer_data_type = {
+    "Writer",
+    {Writer_mark, Writer_free, Writer_size},
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static RubyWriter *Writer_instance(VALUE self) {
+  return (RubyWriter *) RDATA(self)->data;
+}
+
+static VALUE Writer_allocate(VALUE self) {
+  RubyWriter *writer;
+  return TypedData_Make_Struct(self, RubyWriter, &Writer_data_type, writer);
+}
+
+static VALUE Writer_initialize(int argc, VALUE* argv, VALUE self) {
+  VALUE target;
+  VALUE options;
+  rb_scan_args(argc, argv, "01:", &target, &options);
+
+  WriterMode mode = WM_COMPACT;
+  int indent = 2;
+  if (!NIL_P(options)) {
+    if (RTEST(rb_hash_aref(options, ID2SYM(rb_intern("pretty"))))) mode = WM_PRETTY;
+    VALUE indent_value = rb_hash_aref(options, ID2SYM(rb_intern("indent")));
+    if (!NIL_P(indent_value)) indent = NUM2INT(indent_value);
+  }
+
+  auto writer = Writer_instance(self);
+  writer_destroy(&writer->writer);
+  if (NIL_P(target)) target = rb_str_new(nullptr, 0);
+
+  if (RB_TYPE_P(target, T_STRING)) {
+    writer_init(&writer->writer, Writer_string_sink, (void *) target, mode, indent);
+  } else if (RB_INTEGER_TYPE_P(target)) {
+    writer_init_fd(&writer->writer, NUM2INT(target), mode, indent);
+  } else if (rb_respond_to(target, id_write)) {
+    writer_init(&writer->writer, Writer_io_sink, (void *) target, mode, indent);
+  } else {
+    rb_raise(rb_eTypeError, "RUXML::Writer needs a String, IO or file descriptor to write to");
+  }
+  writer->target = target;
+  return self;
+}
+
+static VALUE Writer_xml_header(int argc, VALUE* argv, VALUE self) {
+  VALUE version;
+  VALUE encoding;
+  rb_scan_args(argc, argv, "02", &version, &encoding);
+
+  auto writer = Writer_instance(self);
+  writer_xml_header(&writer->writer,
+                    NIL_P(version) ? "1.0"_str : str_from_rbstr(version),
+                    NIL_P(encoding) ? "UTF-8"_str : str_from_rbstr(encoding));
+  return self;
+}
+
+static VALUE Writer_begin_element(int argc, VALUE* argv, VALUE self) {
+  VALUE name;
+  VALUE xml_namespace;
+  rb_scan_args(argc, argv, "11", &name, &xml_namespace);
+
+  auto writer = Writer_instance(self);
+  writer_begin_element(&writer->writer, NIL_P(xml_namespace) ? str_empty() : str_from_rbstr(xml_namespace),
+                       str_from_rbstr(name));
+  return self;
+}
+
+static VALUE Writer_attribute(int argc, VALUE* argv, VALUE self) {
+  VALUE name;
+  VALUE value;
+  VALUE xml_namespace;
+  rb_scan_args(argc, argv, "21", &name, &value, &xml_namespace);
+
+  auto writer = Writer_instance(self);
+  if (!writer->writer.tag_open) rb_raise(rb_eRuntimeError, "attributes must directly follow begin_element");
+  writer_attribute(&writer->writer, NIL_P(xml_namespace) ? str_empty() : str_from_rbstr(xml_namespace),
+                   str_from_rbstr(name), str_from_rbstr(value));
+  return self;
+}
+
+static VALUE Writer_text(VALUE self, VALUE text) {
+  auto writer = Writer_instance(self);
+  writer_text(&writer->writer, str_from_rbstr(text));
+  return self;
+}
+
+static VALUE Writer_comment(VALUE self, VALUE text) {
+  auto writer = Writer_instance(self);
+  writer_comment(&writer->writer, str_from_rbstr(text));
+  return self;
+}
+
+static VALUE Writer_raw(VALUE self, VALUE text) {
+  auto writer = Writer_instance(self);
+  writer_raw(&writer->writer, str_from_rbstr(text));
+  return self;
+}
+
+static VALUE Writer_end_element(VALUE self) {
+  auto writer = Writer_instance(self);
+  if (!writer_end_element(&writer->writer)) rb_raise(rb_eRuntimeError, "no open element to end");
+  return self;
+}
+
+static VALUE Writer_write_node(VALUE self, VALUE parser_value) {
+  auto parser = &((RubyParser *) rb_check_typeddata(parser_value, &Parser_data_type))->parser;
+  auto writer = Writer_instance(self);
+  writer_node(&writer->writer, parser, parser->node);
+  return self;
+}
+
+static VALUE Writer_flush(VALUE self) {
+  auto writer = Writer_instance(self);
+  if (!writer_flush(&writer->writer)) rb_sys_fail("RUXML::Writer#flush");
+  return self;
+}
+
+static VALUE Writer_to_s(VALUE self) {
+  auto writer = Writer_instance(self);
+  writer_flush(&writer->writer);
+  return RB_TYPE_P(writer->target, T_STRING) ? writer->target : Qnil;
+}
+
+//
+// Filter
+//
+
+static FilterAction Parser_filter_yield(void *data, Parser *parser, Node *node) {
+  VALUE action = rb_yield(*(VALUE *) data);
+  if (action == Qfalse || action == ID2SYM(id_drop)) return FILTER_DROP;
+  if (action == ID2SYM(id_drop_content)) return FILTER_DROP_CONTENT;
+  return FILTER_KEEP;
+}
+
+static VALUE Parser_passthrough(VALUE self, VALUE writer_value) {
+  rb_need_block();
+  auto writer = (RubyWriter *) rb_check_typeddata(writer_value, &Writer_data_type);
+  auto parser = Parser_instance(self);
+  if (parser->encoding != SE_UTF8) {
+    rb_raise(rb_eArgError, "filter copies source bytes, so it can not take a %s source",
+             source_encoding_name(parser->encoding));
+  }
+  auto success = filter_passthrough(parser, &writer->writer, Parser_filter_yield, &self);
+  return success ? Qtrue : Qfalse;
+}
+
+//
+// SAX
+//
+
+static bool RubySax_start_element(void *data, Parser *, Node *node) {
+  VALUE name = rbstr_from_qualified_name(node->xml_namespace, node->text);
+  rb_funcallv(*(VALUE *) data, id_start_element, 1, &name);
+  return true;
+}
+
+static bool RubySax_attribute(void *data, Parser *, Attribute *attribute) {
+  VALUE args[] = {rbstr_from_qualified_name(attribute->xml_namespace, attribute->name),
+                  rbstr_from_str(attribute->value)};
+  rb_funcallv(*(VALUE *) data, id_attr, 2, args);
+  return true;
+}
+
+static bool RubySax_end_element(void *data, Parser *, Node *node) {
+  VALUE name = rbstr_from_qualified_name(node->xml_namespace, node->text);
+  rb_funcallv(*(VALUE *) data, id_end_element, 1, &name);
+  return true;
+}
+
+static bool RubySax_text(void *data, Parser *, Node *node) {
+  VALUE text = rbstr_from_str(node->text);
+  rb_funcallv(*(VALUE *) data, id_text, 1, &text);
+  return true;
+}
+
+static bool RubySax_comment(void *data, Parser *, Node *node) {
+  VALUE text = rbstr_from_str(node->text);
+  rb_funcallv(*(VALUE *) data, id_comment, 1, &text);
+  return true;
+}
+
+// Which handler methods exist is settled once up front, nodes without one are skipped in C without any Ruby objects
+static VALUE Parser_sax_parse(VALUE self, VALUE handler) {
+  SaxHandler callbacks = {};
+  callbacks.data = &handler;
+  if (rb_respond_to(handler, id_start_element)) callbacks.start_element = RubySax_start_element;
+  if (rb_respond_to(handler, id_attr)) callbacks.attribute = RubySax_attribute;
+  if (rb_respond_to(handler, id_end_element)) callbacks.end_element = RubySax_end_element;
+  if (rb_respond_to(handler, id_text)) callbacks.text = RubySax_text;
+  if (rb_respond_to(handler, id_comment)) callbacks.comment = RubySax_comment;
+
+  auto success = sax_parse(Parser_instance(self), &callbacks);
+  return success ? Qtrue : Qfalse;
+}
+
+//
+// Typed values
+//
+
+static ValueType value_type_from_symbol(VALUE type) {
+  Check_Type(type, T_SYMBOL);
+  auto id = SYM2ID(type);
+  for (int i = 0; i < MAX_VALUE_TYPES; i++) {
+    if (value_type_ids[i] == id) return (ValueType) i;
+  }
+  rb_raise(rb_eArgError, "Unknown value type :%s, expected string, int64, float, bool, time or decimal",
+           rb_id2name(id));
+}
+
+static VALUE rbvalue_from_value(Value *value, VALUE field_name) {
+  if (value->state == VS_MISSING) return Qnil;
+  if (value->state == VS_INVALID) {
+    auto text = value->text.length > 256 ? str_until_index(value->text, 255) : value->text;
+    rb_raise(rb_eArgError, "Invalid %s value \"%.*s\" for %s", value_type_name(value->type), str_prt(text),
+             NIL_P(field_name) ? "node" : StringValueCStr(field_name));
+  }
+
+  switch (value->type) {
+    case VT_INT64: return LL2NUM(value->int64);
+    case VT_FLOAT: return DBL2NUM(value->float64);
+    case VT_BOOL: return value->boolean ? Qtrue : Qfalse;
+    case VT_TIME: {
+      VALUE time = rb_time_nano_new(value->time.seconds, value->time.nanoseconds);
+      return rb_funcall(time, rb_intern("utc"), 0);
+    }
+    case VT_DECIMAL: {
+      int64_t denominator = 1;
+      for (int i = 0; i < value->decimal.scale; i++) denominator *= 10;
+      return rb_rational_new(LL2NUM(value->decimal.unscaled), LL2NUM(denominator));
+    }
+    default: return rbstr_from_str(value->text);
+  }
+}
+
+// The current node's text as type, e.g. the text node of a <price> element as :float
+static VALUE Parser_node_value(VALUE self, VALUE type) {
+  auto parser = Parser_instance(self);
+  Value value = {};
+  parse_value(parser->node.text, value_type_from_symbol(type), &value);
+  return rbvalue_from_value(&value, Qnil);
+}
+
+// fields maps "@attribute" or "child" names to value types. record_fields and names hold one entry per field.
+static void schema_from_fields(RecordSchema *schema, Parser *parser, VALUE record_name, VALUE field_names, VALUE fields,
+                               RecordField *record_fields, String *names) {
+  int field_count = (int) RARRAY_LEN(field_names);
+  for (int i = 0; i < field_count; i++) {
+    VALUE name = rb_ary_entry(field_names, i);
+    Check_Type(name, T_STRING);
+    names[i] = str_from_rbstr(name);
+    record_fields[i] = RecordField{};
+    record_fields[i].attribute = names[i].length > 0 && names[i].data[0] == '@';
+    if (record_fields[i].attribute) names[i] = str_from_index(names[i], 1);
+    record_fields[i].type = value_type_from_symbol(rb_hash_aref(fields, name));
+  }
+  record_schema_init(schema, parser, str_from_rbstr(record_name), record_fields, names, field_count);
+}
+
+// Every record element yields an Array of native values in field order, nil for missing fields
+static VALUE Parser_records(VALUE self, VALUE record_name, VALUE fields) {
+  rb_need_block();
+  Check_Type(record_name, T_STRING);
+  Check_Type(fields, T_HASH);
+  auto parser = Parser_instance(self);
+
+  VALUE field_names = rb_funcall(fields, rb_intern("keys"), 0);
+  int field_count = (int) RARRAY_LEN(field_names);
+  auto record_fields = ALLOCA_N(RecordField, field_count + 1);
+  auto names = ALLOCA_N(String, field_count + 1);
+  auto values = ALLOCA_N(Value, field_count + 1);
+  RecordSchema schema = {};
+  schema_from_fields(&schema, parser, record_name, field_names, fields, record_fields, names);
+
+  int64_t count = 0;
+  while (record_next(parser, &schema, values)) {
+    VALUE record = rb_ary_new_capa(field_count);
+    for (int i = 0; i < field_count; i++) {
+      rb_ary_push(record, rbvalue_from_value(&values[i], rb_ary_entry(field_names, i)));
+    }
+    rb_yield(record);
+    count++;
+  }
+
+  RB_GC_GUARD(field_names);
+  return LL2NUM(count);
+}
+
+static VALUE rbhash_from_column(Column *column, int64_t row_count) {
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("type")), ID2SYM(value_type_ids[column->type]));
+  rb_hash_aset(result, ID2SYM(rb_intern("length")), LL2NUM(row_count));
+  rb_hash_aset(result, ID2SYM(rb_intern("null_count")), LL2NUM(column->null_count));
+  rb_hash_aset(result, ID2SYM(rb_intern("validity")), rb_str_new((char *) column->validity, alen(column->validity)));
+  if (column->type == VT_STRING) {
+    rb_hash_aset(result, ID2SYM(rb_intern("offsets")),
+                 rb_str_new((char *) column->offsets, alen(column->offsets) * sizeof(int32_t)));
+  }
+  if (column->type == VT_DECIMAL) rb_hash_aset(result, ID2SYM(rb_intern("scale")), INT2NUM(column->scale));
+  rb_hash_aset(result, ID2SYM(rb_intern("data")), rb_str_new(column->data, alen(column->data)));
+  return result;
+}
+
+// Reads up to limit records (all of them without one) into Arrow style column buffers, returned as binary Strings
+// per field, see Column. A batch with length 0 means the input is exhausted.
+static VALUE Parser_columns(int argc, VALUE* argv, VALUE self) {
+  VALUE record_name;
+  VALUE fields;
+  VALUE limit;
+  rb_scan_args(argc, argv, "21", &record_name, &fields, &limit);
+  Check_Type(record_name, T_STRING);
+  Check_Type(fields, T_HASH);
+  auto parser = Parser_instance(self);
+
+  VALUE field_names = rb_funcall(fields, rb_intern("keys"), 0);
+  int field_count = (int) RARRAY_LEN(field_names);
+  auto record_fields = ALLOCA_N(RecordField, field_count + 1);
+  auto names = ALLOCA_N(String, field_count + 1);
+  auto values = ALLOCA_N(Value, field_count + 1);
+  RecordSchema schema = {};
+  schema_from_fields(&schema, parser, record_name, field_names, fields, record_fields, names);
+
+  ColumnTable table;
+  columns_init(&table, &schema);
+  auto ruby_parser = RubyParser_instance(self);
+  auto pending = ruby_parser->pending_row;
+  bool same_fields = alen(pending) == (uint32_t) field_count;
+  for (int i = 0; same_fields && i < field_count; i++) same_fields = pending[i].type == record_fields[i].type;
+  if (same_fields) {
+    table.pending = ruby_parser->pending_row;
+    ruby_parser->pending_row = nullptr;
+  }
+  aclear(ruby_parser->pending_row);
+  int invalid = columns_read(parser, &table, values, NIL_P(limit) ? 0 : NUM2LL(limit));
+  afree(ruby_parser->pending_row);
+  ruby_parser->pending_row = table.pending;
+  table.pending = nullptr;
+
+  VALUE result = rb_hash_new();
+  if (invalid < 0) {
+    for (int i = 0; i < field_count; i++) {
+      rb_hash_aset(result, rb_ary_entry(field_names, i), rbhash_from_column(&table.columns[i], table.row_count));
+    }
+  }
+  columns_destroy(&table);
+
+  if (invalid >= 0) rbvalue_from_value(&values[invalid], rb_ary_entry(field_names, invalid)); // Raises
+  RB_GC_GUARD(field_names);
+  return result;
+}
+
+//
+// Batches
+//
+
+// Shared by every caller of parse_many. It only grows, and only while no batch is in flight, since another Ruby thread
+// may be waiting in parse_pool_run without the GVL. A batch uses at most threads: of its workers.
+static ParsePool parse_pool;
+static pid_t parse_pool_pid;
+static pthread_mutex_t parse_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int parse_pool_users; // Batches in flight
+
+struct ParseManyState {
+  ParseBatch *batch;
+  VALUE documents;
+  VALUE parser;
+  VALUE results;
+};
+
+// A transcoded document handed over to Ruby, freed once no parser or node points into it
+static void Buffer_free(void *data) {
+  raw_free(data);
+}
+
+static rb_data_type_t Buffer_data_type = {
+    "Buffer",
+    {nullptr, Buffer_free, nullptr},
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void *parse_many_run(void *data) {
+  parse_pool_run(&parse_pool, (ParseBatch *) data);
+  return nullptr;
+}
+
+static void parse_many_cancel(void *data) {
+  ((ParseBatch *) data)->cancelled = true;
+}
+
+static VALUE parse_many_yield(VALUE data) {
+  auto state = (ParseManyState *) data;
+  auto batch = state->batch;
+  auto parser = Parser_instance(state->parser);
+  for (int64_t i = 0; i < batch->count; i++) {
+    auto document = batch->documents[i];
+    auto recording = &batch->recordings[i];
+    parser_replay(parser, "document"_str, document.data, document.length, recording);
+
+    // Nodes taken in the block keep their bytes alive through the source
+    VALUE source = rb_ary_entry(state->documents, i);
+    if (recording->transcoded) {
+      source = TypedData_Wrap_Struct(0, &Buffer_data_type, recording->transcoded);
+      recording->transcoded = nullptr;
+    }
+    Parser_keep_source(state->parser, Qnil, source);
+    rb_ary_push(state->results, rb_yield_values(2, state->parser, LL2NUM(i)));
+  }
+  return state->results;
+}
+
+static VALUE parse_many_cleanup(VALUE data) {
+  auto state = (ParseManyState *) data;
+  auto batch = state->batch;
+  if (!NIL_P(state->parser)) {
+    parser_replay(Parser_instance(state->parser), String{}, nullptr, 0, nullptr);
+    Parser_keep_source(state->parser, Qnil, Qnil);
+  }
+  for (int64_t i = 0; i < batch->count; i++) recording_free(&batch->recordings[i]);
+  raw_free(batch->recordings);
+  raw_free(batch->documents);
+  return Qnil;
+}
+
+static bool parse_pool_acquire(int thread_count) {
+  pthread_mutex_lock(&parse_pool_mutex);
+  if (parse_pool.thread_count && parse_pool_pid != getpid()) {
+    parse_pool = ParsePool{}; // A forked child has the memory but not the threads
+    parse_pool_users = 0;
+  }
+
+  if (!parse_pool_users && parse_pool.thread_count < thread_count) {
+    if (parse_pool.thread_count) parse_pool_destroy(&parse_pool);
+    if (!parse_pool_init(&parse_pool, thread_count)) {
+      pthread_mutex_unlock(&parse_pool_mutex);
+      return false;
+    }
+    parse_pool_pid = getpid();
+  }
+  parse_pool_users++;
+  pthread_mutex_unlock(&parse_pool_mutex);
+  return true;
+}
+
+static void parse_pool_release() {
+  pthread_mutex_lock(&parse_pool_mutex);
+  parse_pool_users--;
+  pthread_mutex_unlock(&parse_pool_mutex);
+}
+
+// Parses the documents on a pool of native threads with the GVL released, then yields a parser replaying each one in
+// order. Returns the block results. Takes the Parser.new options except resolve_namespaces:, and threads:, which
+// defaults to the number of CPUs.
+static VALUE RUXML_parse_many(int argc, VALUE* argv, VALUE self) {
+  VALUE strings;
+  VALUE options;
+  rb_scan_args(argc, argv, "1:", &strings, &options);
+  rb_need_block();
+  Check_Type(strings, T_ARRAY);
+
+  ParserOptions parser_options = {};
+  int thread_count = 0;
+  if (!NIL_P(options)) {
+    parser_options = parser_options_from_hash(options);
+    parser_options.resolve_namespaces = false; // Namespace ids belong to each worker's parser
+    VALUE threads = rb_hash_aref(options, ID2SYM(rb_intern("threads")));
+    if (!NIL_P(threads)) thread_count = NUM2INT(threads);
+  }
+  if (thread_count <= 0) thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (thread_count <= 0) thread_count = 1;
+  if (thread_count > 256) thread_count = 256;
+
+  // Frozen, so nothing can change the bytes while the workers read them without the GVL
+  int64_t count = RARRAY_LEN(strings);
+  VALUE documents = rb_ary_new_capa(count);
+  for (int64_t i = 0; i < count; i++) {
+    VALUE document = rb_ary_entry(strings, i);
+    Check_Type(document, T_STRING);
+    rb_ary_push(documents, rb_str_new_frozen(document));
+  }
+
+  if (!parse_pool_acquire(thread_count)) rb_raise(rb_eRuntimeError, "Could not start parser threads");
+
+  ParseBatch batch;
+  batch.documents = raw_allocate_array(String, count + 1);
+  batch.recordings = (ParserRecording *) raw_allocate_size_zero(sizeof(ParserRecording) * (count + 1));
+  batch.count = count;
+  batch.options = parser_options;
+  batch.thread_count = thread_count;
+  batch.next = 0;
+  batch.cancelled = false;
+  for (int64_t i = 0; i < count; i++) batch.documents[i] = str_from_rbstr(rb_ary_entry(documents, i));
+
+  rb_thread_call_without_gvl(parse_many_run, &batch, parse_many_cancel, &batch);
+  parse_pool_release();
+
+  ParseManyState state = {&batch, documents, Qnil, Qnil};
+  if (batch.cancelled) {
+    parse_many_cleanup((VALUE) &state);
+    rb_thread_check_ints();
+    rb_raise(rb_eInterrupt, "RUXML.parse_many was interrupted");
+  }
+
+  state.parser = rb_class_new_instance(0, nullptr, ruxmlParser);
+  state.results = rb_ary_new_capa(count);
+  VALUE results = rb_ensure(parse_many_yield, (VALUE) &state, parse_many_cleanup, (VALUE) &state);
+
+  RB_GC_GUARD(documents);
+  RB_GC_GUARD(state.parser);
+  return results;
+}
+
 //
 // Init
 //
@@ -259,39 +1346,110 @@ void Init_ruxml() {
   node_type_ids[NODE_TEXT] = rb_intern("text");
   node_type_ids[NODE_XML_HEADER] = rb_intern("xml_header");
   node_type_ids[NODE_COMMENT] = rb_intern("comment");
+  node_type_ids[NODE_ERROR] = rb_intern("error");
+
+  for (int type = 0; type < MAX_VALUE_TYPES; type++) value_type_ids[type] = rb_intern(value_type_name((ValueType) type));
+
+  id_write = rb_intern("write");
+  id_new = rb_intern("new");
+  id_drop = rb_intern("drop");
+  id_drop_content = rb_intern("drop_content");
+  id_start_element = rb_intern("start_element");
+  id_attr = rb_intern("attr");
+  id_end_element = rb_intern("end_element");
+  id_text = rb_intern("text");
+  id_comment = rb_intern("comment");
 
   ruxmlModule = rb_define_module("RUXML");
+  rb_define_module_function(ruxmlModule, "parse_many", reinterpret_cast<VALUE (*)(...)>(RUXML_parse_many), -1);
 
   ruxmlNode = rb_define_class_under(ruxmlModule, "Node", rb_cData);
   rb_define_alloc_func(ruxmlNode, Node_allocate);
   rb_define_method(ruxmlNode, "initialize", reinterpret_cast<VALUE (*)(...)>(Node_initialize), 0);
   rb_define_method(ruxmlNode, "column_start", reinterpret_cast<VALUE (*)(...)>(Node_column_start), 0);
+  rb_define_method(ruxmlNode, "column_end", reinterpret_cast<VALUE (*)(...)>(Node_column_end), 0);
   rb_define_method(ruxmlNode, "line", reinterpret_cast<VALUE (*)(...)>(Node_line), 0);
   rb_define_method(ruxmlNode, "offset", reinterpret_cast<VALUE (*)(...)>(Node_offset), 0);
+  rb_define_method(ruxmlNode, "tag_start", reinterpret_cast<VALUE (*)(...)>(Node_tag_start), 0);
+  rb_define_method(ruxmlNode, "tag_end", reinterpret_cast<VALUE (*)(...)>(Node_tag_end), 0);
+  rb_define_method(ruxmlNode, "content_start", reinterpret_cast<VALUE (*)(...)>(Node_content_start), 0);
+  rb_define_method(ruxmlNode, "content_end", reinterpret_cast<VALUE (*)(...)>(Node_content_end), 0);
+  rb_define_method(ruxmlNode, "element_start", reinterpret_cast<VALUE (*)(...)>(Node_element_start), 0);
   rb_define_method(ruxmlNode, "namespace", reinterpret_cast<VALUE (*)(...)>(Node_namespace), 0);
+  rb_define_method(ruxmlNode, "namespace_id", reinterpret_cast<VALUE (*)(...)>(Node_namespace_id), 0);
+  rb_define_method(ruxmlNode, "name_id", reinterpret_cast<VALUE (*)(...)>(Node_name_id), 0);
   rb_define_method(ruxmlNode, "text", reinterpret_cast<VALUE (*)(...)>(Node_text), 0);
   rb_define_method(ruxmlNode, "attribute_count", reinterpret_cast<VALUE (*)(...)>(Node_attribute_count), 0);
   rb_define_method(ruxmlNode, "type", reinterpret_cast<VALUE (*)(...)>(Node_type), 0);
   rb_define_method(ruxmlNode, "self_closing", reinterpret_cast<VALUE (*)(...)>(Node_self_closing), 0);
+  rb_define_method(ruxmlNode, "whitespace", reinterpret_cast<VALUE (*)(...)>(Node_whitespace), 0);
+  rb_define_method(ruxmlNode, "[]", reinterpret_cast<VALUE (*)(...)>(Node_aref), -1);
 
   ruxmlParser = rb_define_class_under(ruxmlModule, "Parser", rb_cData);
   rb_define_alloc_func(ruxmlParser, Parser_allocate);
-  rb_define_method(ruxmlParser, "initialize", reinterpret_cast<VALUE (*)(...)>(Parser_initialize), 0);
+  rb_define_method(ruxmlParser, "initialize", reinterpret_cast<VALUE (*)(...)>(Parser_initialize), -1);
   rb_define_method(ruxmlParser, "open_string", reinterpret_cast<VALUE (*)(...)>(Parser_open_string), -1);
   rb_define_method(ruxmlParser, "open_file", reinterpret_cast<VALUE (*)(...)>(Parser_open_file), -1);
+  rb_define_method(ruxmlParser, "build_cache", reinterpret_cast<VALUE (*)(...)>(Parser_build_cache), -1);
+  rb_define_method(ruxmlParser, "open_cache", reinterpret_cast<VALUE (*)(...)>(Parser_open_cache), -1);
+  rb_define_method(ruxmlParser, "io", reinterpret_cast<VALUE (*)(...)>(Parser_io), 0);
+  rb_define_method(ruxmlParser, "encoding", reinterpret_cast<VALUE (*)(...)>(Parser_encoding), 0);
   rb_define_method(ruxmlParser, "node", reinterpret_cast<VALUE (*)(...)>(Parser_node), 0);
   rb_define_method(ruxmlParser, "next_node", reinterpret_cast<VALUE (*)(...)>(Parser_next_node), 0);
   rb_define_method(ruxmlParser, "done", reinterpret_cast<VALUE (*)(...)>(Parser_done), 0);
   rb_define_method(ruxmlParser, "errored", reinterpret_cast<VALUE (*)(...)>(Parser_errored), 0);
+  rb_define_method(ruxmlParser, "error", reinterpret_cast<VALUE (*)(...)>(Parser_error), 0);
+  rb_define_method(ruxmlParser, "error_count", reinterpret_cast<VALUE (*)(...)>(Parser_error_count), 0);
+  rb_define_method(ruxmlParser, "source_slice", reinterpret_cast<VALUE (*)(...)>(Parser_source_slice), 2);
+  rb_define_method(ruxmlParser, "register_namespace", reinterpret_cast<VALUE (*)(...)>(Parser_register_namespace), 1);
+  rb_define_method(ruxmlParser, "namespace_uri", reinterpret_cast<VALUE (*)(...)>(Parser_namespace_uri), 1);
+  rb_define_method(ruxmlParser, "register_name", reinterpret_cast<VALUE (*)(...)>(Parser_register_name), 1);
+  rb_define_method(ruxmlParser, "name_id", reinterpret_cast<VALUE (*)(...)>(Parser_name_id), 1);
+  rb_define_method(ruxmlParser, "stats", reinterpret_cast<VALUE (*)(...)>(Parser_stats), 0);
+  rb_define_method(ruxmlParser, "passthrough", reinterpret_cast<VALUE (*)(...)>(Parser_passthrough), 1);
+  rb_define_method(ruxmlParser, "start_pipeline", reinterpret_cast<VALUE (*)(...)>(Parser_start_pipeline), 0);
+  rb_define_method(ruxmlParser, "sax_parse", reinterpret_cast<VALUE (*)(...)>(Parser_sax_parse), 1);
+  rb_define_method(ruxmlParser, "records", reinterpret_cast<VALUE (*)(...)>(Parser_records), 2);
+  rb_define_method(ruxmlParser, "columns", reinterpret_cast<VALUE (*)(...)>(Parser_columns), -1);
 
   rb_define_method(ruxmlParser, "node_column_start", reinterpret_cast<VALUE (*)(...)>(Parser_node_column_start), 0);
+  rb_define_method(ruxmlParser, "node_column_end", reinterpret_cast<VALUE (*)(...)>(Parser_node_column_end), 0);
   rb_define_method(ruxmlParser, "node_line", reinterpret_cast<VALUE (*)(...)>(Parser_node_line), 0);
   rb_define_method(ruxmlParser, "node_offset", reinterpret_cast<VALUE (*)(...)>(Parser_node_offset), 0);
+  rb_define_method(ruxmlParser, "node_tag_start", reinterpret_cast<VALUE (*)(...)>(Parser_node_tag_start), 0);
+  rb_define_method(ruxmlParser, "node_tag_end", reinterpret_cast<VALUE (*)(...)>(Parser_node_tag_end), 0);
+  rb_define_method(ruxmlParser, "node_content_start", reinterpret_cast<VALUE (*)(...)>(Parser_node_content_start), 0);
+  rb_define_method(ruxmlParser, "node_content_end", reinterpret_cast<VALUE (*)(...)>(Parser_node_content_end), 0);
+  rb_define_method(ruxmlParser, "node_element_start", reinterpret_cast<VALUE (*)(...)>(Parser_node_element_start), 0);
   rb_define_method(ruxmlParser, "node_namespace", reinterpret_cast<VALUE (*)(...)>(Parser_node_namespace), 0);
+  rb_define_method(ruxmlParser, "node_namespace_id", reinterpret_cast<VALUE (*)(...)>(Parser_node_namespace_id), 0);
+  rb_define_method(ruxmlParser, "node_name_id", reinterpret_cast<VALUE (*)(...)>(Parser_node_name_id), 0);
+  rb_define_method(ruxmlParser, "node_value", reinterpret_cast<VALUE (*)(...)>(Parser_node_value), 1);
   rb_define_method(ruxmlParser, "node_text", reinterpret_cast<VALUE (*)(...)>(Parser_node_text), 0);
   rb_define_method(ruxmlParser, "node_attribute_count", reinterpret_cast<VALUE (*)(...)>(Parser_node_attribute_count), 0);
   rb_define_method(ruxmlParser, "node_type", reinterpret_cast<VALUE (*)(...)>(Parser_node_type), 0);
   rb_define_method(ruxmlParser, "node_self_closing", reinterpret_cast<VALUE (*)(...)>(Parser_node_self_closing), 0);
+  rb_define_method(ruxmlParser, "node_whitespace", reinterpret_cast<VALUE (*)(...)>(Parser_node_whitespace), 0);
+  rb_define_method(ruxmlParser, "node_attribute", reinterpret_cast<VALUE (*)(...)>(Parser_node_attribute), -1);
+  rb_define_method(ruxmlParser, "node_attributes", reinterpret_cast<VALUE (*)(...)>(Parser_node_attributes), 0);
+  rb_define_method(ruxmlParser, "path", reinterpret_cast<VALUE (*)(...)>(Parser_path), 0);
+  rb_define_method(ruxmlParser, "parent_name", reinterpret_cast<VALUE (*)(...)>(Parser_parent_name), 0);
+  rb_define_method(ruxmlParser, "node_duplicate_attribute", reinterpret_cast<VALUE (*)(...)>(Parser_node_duplicate_attribute), 0);
+  rb_define_method(ruxmlParser, "each_attribute", reinterpret_cast<VALUE (*)(...)>(Parser_each_attribute), 0);
+
+  ruxmlWriter = rb_define_class_under(ruxmlModule, "Writer", rb_cData);
+  rb_define_alloc_func(ruxmlWriter, Writer_allocate);
+  rb_define_method(ruxmlWriter, "initialize", reinterpret_cast<VALUE (*)(...)>(Writer_initialize), -1);
+  rb_define_method(ruxmlWriter, "xml_header", reinterpret_cast<VALUE (*)(...)>(Writer_xml_header), -1);
+  rb_define_method(ruxmlWriter, "begin_element", reinterpret_cast<VALUE (*)(...)>(Writer_begin_element), -1);
+  rb_define_method(ruxmlWriter, "attribute", reinterpret_cast<VALUE (*)(...)>(Writer_attribute), -1);
+  rb_define_method(ruxmlWriter, "text", reinterpret_cast<VALUE (*)(...)>(Writer_text), 1);
+  rb_define_method(ruxmlWriter, "comment", reinterpret_cast<VALUE (*)(...)>(Writer_comment), 1);
+  rb_define_method(ruxmlWriter, "raw", reinterpret_cast<VALUE (*)(...)>(Writer_raw), 1);
+  rb_define_method(ruxmlWriter, "end_element", reinterpret_cast<VALUE (*)(...)>(Writer_end_element), 0);
+  rb_define_method(ruxmlWriter, "write_node", reinterpret_cast<VALUE (*)(...)>(Writer_write_node), 1);
+  rb_define_method(ruxmlWriter, "flush", reinterpret_cast<VALUE (*)(...)>(Writer_flush), 0);
+  rb_define_method(ruxmlWriter, "to_s", reinterpret_cast<VALUE (*)(...)>(Writer_to_s), 0);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "sax.hpp"
+
+static bool sax_start_element(Parser *parser, SaxHandler *handler, Node *node) {
+  if (handler->start_element && !handler->start_element(handler->data, parser, node)) return false;
+
+  if (handler->attribute) {
+    rewind_attributes(parser);
+    for (int i = 0; i < parser->node.attribute_count; i++) {
+      auto attribute = get_attribute(parser);
+      if (!handler->attribute(handler->data, parser, &attribute)) return false;
+    }
+    rewind_attributes(parser);
+  }
+
+  if (node->self_closing && handler->end_element) return handler->end_element(handler->data, parser, node);
+  return true;
+}
+
+bool sax_parse(Parser *parser, SaxHandler *handler) {
+  while (true) {
+    auto node = get_node(parser);
+    bool carry_on = true;
+    switch (node.type) {
+      case NODE_INVALID: return !parser->errored;
+      case NODE_ELEMENT_BEGIN:
+        carry_on = sax_start_element(parser, handler, &node);
+        break;
+      case NODE_ELEMENT_END:
+        if (handler->end_element) carry_on = handler->end_element(handler->data, parser, &node);
+        break;
+      case NODE_TEXT:
+        if (handler->text) carry_on = handler->text(handler->data, parser, &node);
+        break;
+      case NODE_COMMENT:
+        if (handler->comment) carry_on = handler->comment(handler->data, parser, &node);
+        break;
+      default:
+        break;
+    }
+    if (!carry_on || parser->errored) return false; // Reading lazy attributes may have failed
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "parser.hpp"
+
+// Callbacks for sax_parse, any of them may be null to skip those nodes. Returning false from one stops parsing.
+// Nodes and attributes point into the parser buffer and are only valid during the call.
+struct SaxHandler {
+  void *data;
+  bool (*start_element)(void *data, Parser *parser, Node *node);
+  bool (*attribute)(void *data, Parser *parser, Attribute *attribute); // After start_element, once per attribute
+  bool (*end_element)(void *data, Parser *parser, Node *node);         // Also right after a self-closing element
+  bool (*text)(void *data, Parser *parser, Node *node);
+  bool (*comment)(void *data, Parser *parser, Node *node);
+};
+
+// Runs the rest of the parser's source through the handler. Attributes are only read with an attribute callback, so
+// with lazy_attributes they are never tokenized otherwise. Returns false when the source did not parse or a callback
+// stopped it.
+bool sax_parse(Parser *parser, SaxHandler *handler);
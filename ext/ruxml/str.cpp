@@ -6,6 +6,10 @@
 #include <cstdio>
 #include "str.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 uint64_t zstr_length(const char *str) {
   uint64_t result = 0;
   while (*(str++)) result++;
@@ -43,12 +47,12 @@ String str_dup(Allocator *allocator, String s) {
 String str_dup(String s) { return str_dup(temp_allocator, s); }
 
 String str_dup(Allocator *allocator, const char *str) {
-  return str_dup(allocator, str, static_cast<int>(zstr_length(str)));
+  return str_dup(allocator, str, static_cast<int64_t>(zstr_length(str)));
 }
 
 String str_dup(const char *str) { return str_dup(temp_allocator, str); }
 
-String str_dup(Allocator *allocator, const char *str, int length) {
+String str_dup(Allocator *allocator, const char *str, int64_t length) {
   String result;
   result.length = length;
   result.data = allocate_zstring(allocator, length);
@@ -57,7 +61,7 @@ String str_dup(Allocator *allocator, const char *str, int length) {
   return result;
 }
 
-String str_dup(const char *str, int length) { return str_dup(temp_allocator, str, length); }
+String str_dup(const char *str, int64_t length) { return str_dup(temp_allocator, str, length); }
 
 int zstr_find_last(const char *str, char c) {
   int result = -1;
@@ -70,11 +74,11 @@ int zstr_find_last(const char *str, char c) {
   return result;
 }
 
-int str_find_last(String s, char c, int after) {
-  int result = -1;
-  int index = 0;
+int64_t str_find_last(String s, char c, int64_t after) {
+  int64_t result = -1;
+  int64_t index = 0;
   char *str = s.data + after;
-  for (int i = after; i < s.length; i++) {
+  for (int64_t i = after; i < s.length; i++) {
     if (*str == c) result = index;
     str++;
     index++;
@@ -82,9 +86,9 @@ int str_find_last(String s, char c, int after) {
   return result;
 }
 
-int str_find_first(String s, char c, int after) {
+int64_t str_find_first(String s, char c, int64_t after) {
   char *str = s.data + after;
-  for (int i = after; i < s.length; i++) {
+  for (int64_t i = after; i < s.length; i++) {
     if (*str == c) return i;
     str++;
   }
@@ -100,7 +104,7 @@ bool str_equal(String a, const char *b) {
   return str_equal(a, b, zstr_length(b));
 }
 
-bool str_equal(String a, const char *b_data, int b_length) {
+bool str_equal(String a, const char *b_data, int64_t b_length) {
   if (a.length != b_length) return false;
   return memcmp(a.data, b_data, a.length) == 0;
 }
@@ -115,13 +119,43 @@ bool str_empty(String s) {
   return s.length == 0 || !s.data;
 }
 
+bool str_is_whitespace(String s) {
+  auto ptr = s.data;
+  auto end = s.data + s.length;
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i carriage_return = _mm_set1_epi8('\r');
+  while (end - ptr >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *) ptr);
+    __m128i blanks = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, carriage_return)));
+    if (_mm_movemask_epi8(blanks) != 0xFFFF) return false;
+    ptr += 16;
+  }
+#endif
+  for (; ptr != end; ptr++) {
+    if (!is_xml_whitespace(*ptr)) return false;
+  }
+  return true;
+}
+
+String trim_whitespace(String s) {
+  auto start = s.data;
+  auto end = s.data + s.length;
+  while (start != end && is_xml_whitespace(*start)) start++;
+  while (end != start && is_xml_whitespace(end[-1])) end--;
+  return String{(int64_t) (end - start), start};
+}
+
 bool parse_int(String string, int32_t *result_ptr) {
   bool valid = false;
   int result = 0;
 
   auto buffer = string.data;
 
-  for (int i = 0; i < string.length; i++) {
+  for (int64_t i = 0; i < string.length; i++) {
     char c = buffer[0];
     if (c >= '0' && c <= '9') {
       result *= 10;
@@ -140,11 +174,11 @@ bool parse_int(String string, int32_t *result_ptr) {
 
 bool parse_int64(String string, int64_t *result_ptr) {
   bool valid = false;
-  int result = 0;
+  int64_t result = 0;
 
   auto buffer = string.data;
 
-  for (int i = 0; i < string.length; i++) {
+  for (int64_t i = 0; i < string.length; i++) {
     char c = buffer[0];
     if (c >= '0' && c <= '9') {
       result *= 10;
@@ -10,18 +10,22 @@ char *zstr_dup(const char *str);
 char *zstr_dup(const char *str, int64_t size);
 int zstr_find_last(const char *str, char c);
 
+// The length is 64-bit so text spans of files past 2 GB stay exact. It costs nothing: the pointer pads the struct to
+// 16 bytes either way.
 struct String {
-   int32_t length;
+   int64_t length;
    char *data;
 };
 
+static_assert(sizeof(String) == 16, "String is embedded in every node and attribute, keep it two words");
+
 inline String operator "" _str(const char *data, size_t length) {
-   return String{static_cast<int32_t>(length),
+   return String{static_cast<int64_t>(length),
                  const_cast<char *>(data)};
 }
 
-inline String copy_string(MemoryArena *arena, uint32_t length, char *input) {
-   uint32_t buf_length = length + 1;
+inline String copy_string(MemoryArena *arena, int64_t length, char *input) {
+   int64_t buf_length = length + 1;
 
    String str;
    str.length = length;
@@ -41,28 +45,28 @@ inline String copy_zstring(MemoryArena *arena, char *input) {
 
 inline String as_zstring(char *input) {
    String str;
-   str.length = static_cast<int32_t>(zstr_length(input));
+   str.length = static_cast<int64_t>(zstr_length(input));
    str.data = input;
    return str;
 }
 
-inline String str_from_index(String s, int index) {
+inline String str_from_index(String s, int64_t index) {
    return String{s.length - index, s.data + index};
 }
 
-inline String str_until_index(String s, int index) {
+inline String str_until_index(String s, int64_t index) {
    return String{index + 1, s.data};
 }
 
-inline String str_after_index(String s, int index) {
+inline String str_after_index(String s, int64_t index) {
    return String{s.length - index - 1, s.data + index + 1};
 }
 
-inline String str_before_index(String s, int index) {
+inline String str_before_index(String s, int64_t index) {
    return String{index, s.data};
 }
 
-inline String str_between(String s, int after_index, int before_index) {
+inline String str_between(String s, int64_t after_index, int64_t before_index) {
    return String{before_index - after_index - 1, s.data + after_index + 1};
 }
 
@@ -87,14 +91,14 @@ inline int64_t parse_int64_default(String string, int64_t default_value) {
 }
 
 // Use in printf with format specifier  %.*s
-#define str_prt(s) s.length, s.data
+#define str_prt(s) (int) (s).length, (s).data
 
 String str_dup(String str);
 String str_dup(const char *str);
-String str_dup(const char *str, int length);
+String str_dup(const char *str, int64_t length);
 String str_dup(Allocator *allocator, String str);
 String str_dup(Allocator *allocator, const char *str);
-String str_dup(Allocator *allocator, const char *str, int length);
+String str_dup(Allocator *allocator, const char *str, int64_t length);
 
 char* str_to_zstr(String str);
 char* str_to_zstr(Allocator *allocator, String str);
@@ -102,10 +106,22 @@ char* str_to_zstr(Allocator *allocator, String str);
 String str_print(const char *fmt, ...);
 String str_print(Allocator *allocator, const char *fmt, ...);
 
-int str_find_last(String s, char c, int after = 0);
-int str_find_first(String s, char c, int after = 0);
+int64_t str_find_last(String s, char c, int64_t after = 0);
+int64_t str_find_first(String s, char c, int64_t after = 0);
 int str_compare(String a, String b);
 bool str_equal(String a, String b);
 bool str_equal(String a, const char *b);
-bool str_equal(String a, const char *b_data, int b_length);
-bool str_empty(String s);
\ No newline at end of file
+bool str_equal(String a, const char *b_data, int64_t b_length);
+bool str_empty(String s);
+inline bool is_xml_whitespace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+bool str_is_whitespace(String s); // XML whitespace: space, tab, carriage return and newline
+String trim_whitespace(String s);  // Without leading and trailing XML whitespace, pointing into s
+// FNV-1a, for tables keyed on names and URIs
+inline uint64_t str_hash(String s) {
+   uint64_t hash = 14695981039346656037ull;
+   for (int64_t i = 0; i < s.length; i++) {
+      hash ^= (uint8_t) s.data[i];
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
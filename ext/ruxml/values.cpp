@@ -0,0 +1,359 @@
+#include "values.hpp"
+
+#include <cmath>
+#include <cstdlib>
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+//
+// Digits, eight at a time (SWAR)
+//
+
+inline uint64_t load_eight(const char *ptr) {
+  uint64_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline bool is_eight_digits(uint64_t value) {
+  return (((value & 0xF0F0F0F0F0F0F0F0ull) | (((value + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ==
+          0x3333333333333333ull);
+}
+
+// The first byte in memory is the most significant digit, this assumes a little-endian load
+inline uint32_t parse_eight_digits(uint64_t value) {
+  value -= 0x3030303030303030ull;
+  value = (value * 10) + (value >> 8);
+  value = (((value & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+           (((value >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+  return (uint32_t) value;
+}
+
+// Accumulates the digits at ptr into result, at most max_digits of them. Returns the number of digits consumed, the
+// caller checks what follows.
+static int parse_digits(const char *ptr, const char *end, int max_digits, uint64_t *result) {
+  auto start = ptr;
+  auto value = *result;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (end - ptr >= 8 && (ptr - start) + 8 <= max_digits) {
+    auto chunk = load_eight(ptr);
+    if (!is_eight_digits(chunk)) break;
+    value = value * 100000000 + parse_eight_digits(chunk);
+    ptr += 8;
+  }
+#endif
+  while (ptr != end && is_digit(*ptr) && ptr - start < max_digits) {
+    value = value * 10 + (*ptr - '0');
+    ptr++;
+  }
+  *result = value;
+  return (int) (ptr - start);
+}
+
+static const char *skip_zeros(const char *ptr, const char *end) {
+  while (ptr != end && *ptr == '0') ptr++;
+  return ptr;
+}
+
+bool parse_value_int64(String text, int64_t *result) {
+  text = trim_whitespace(text);
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+
+  bool negative = false;
+  if (ptr != end && (*ptr == '-' || *ptr == '+')) negative = *ptr++ == '-';
+  if (ptr == end || !is_digit(*ptr)) return false;
+
+  ptr = skip_zeros(ptr, end);
+  uint64_t value = 0;
+  ptr += parse_digits(ptr, end, 19, &value);
+  if (ptr != end) return false; // Not a digit, or more than 19 significant digits
+
+  uint64_t limit = negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX;
+  if (value > limit) return false;
+  *result = negative ? (int64_t) (0 - value) : (int64_t) value;
+  return true;
+}
+
+static const double powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// The xs:double lexical form without the special values: [+-]? (digits ('.' digits*)? | '.' digits) ([eE] [+-]? digits)?
+static bool is_decimal_form(String text) {
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+  if (ptr != end && (*ptr == '-' || *ptr == '+')) ptr++;
+
+  auto digits_start = ptr;
+  while (ptr != end && is_digit(*ptr)) ptr++;
+  bool any_digits = ptr != digits_start;
+  if (ptr != end && *ptr == '.') {
+    auto fraction_start = ++ptr;
+    while (ptr != end && is_digit(*ptr)) ptr++;
+    any_digits = any_digits || ptr != fraction_start;
+  }
+  if (!any_digits) return false;
+
+  if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+    ptr++;
+    if (ptr != end && (*ptr == '-' || *ptr == '+')) ptr++;
+    auto exponent_start = ptr;
+    while (ptr != end && is_digit(*ptr)) ptr++;
+    if (ptr == exponent_start) return false;
+  }
+  return ptr == end;
+}
+
+static bool parse_float_slow(String text, double *result) {
+  // XML spells infinity INF and has one NaN, strtod would also take inf, infinity, nan(...), hex floats and the like
+  if (str_equal(text, "INF"_str) || str_equal(text, "+INF"_str)) {
+    *result = HUGE_VAL;
+    return true;
+  }
+  if (str_equal(text, "-INF"_str)) {
+    *result = -HUGE_VAL;
+    return true;
+  }
+  if (str_equal(text, "NaN"_str)) {
+    *result = NAN;
+    return true;
+  }
+  if (!is_decimal_form(text)) return false;
+
+  char buffer[128];
+  char *copy = text.length < (int64_t) sizeof(buffer) ? buffer : str_to_zstr(text);
+  if (copy == buffer) {
+    memcpy(buffer, text.data, text.length);
+    buffer[text.length] = 0;
+  }
+
+  char *parsed_end;
+  *result = strtod(copy, &parsed_end);
+  bool valid = parsed_end == copy + text.length;
+  if (copy != buffer) raw_free(copy);
+  return valid;
+}
+
+// Exact when the mantissa fits in 53 bits and the power of ten is exactly representable (Clinger's fast path),
+// everything else goes through strtod
+bool parse_value_float(String text, double *result) {
+  text = trim_whitespace(text);
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+  if (ptr == end) return false;
+
+  bool negative = false;
+  if (*ptr == '-' || *ptr == '+') negative = *ptr++ == '-';
+
+  auto integer_start = ptr;
+  ptr = skip_zeros(ptr, end);
+  uint64_t mantissa = 0;
+  int integer_digits = parse_digits(ptr, end, 19, &mantissa);
+  ptr += integer_digits;
+  bool any_digits = ptr != integer_start;
+
+  int fraction_digits = 0;
+  if (ptr != end && *ptr == '.') {
+    ptr++;
+    auto fraction_start = integer_digits ? ptr : skip_zeros(ptr, end);
+    int leading_zeros = (int) (fraction_start - ptr);
+    fraction_digits = parse_digits(fraction_start, end, 19 - integer_digits, &mantissa);
+    ptr = fraction_start + fraction_digits;
+    fraction_digits += leading_zeros;
+    any_digits = any_digits || fraction_digits > 0;
+  }
+
+  int64_t exponent = 0;
+  if (ptr != end && (*ptr == 'e' || *ptr == 'E') && any_digits) {
+    ptr++;
+    bool negative_exponent = false;
+    if (ptr != end && (*ptr == '-' || *ptr == '+')) negative_exponent = *ptr++ == '-';
+    if (ptr == end || !is_digit(*ptr)) return false;
+    while (ptr != end && is_digit(*ptr) && exponent < 100000) exponent = exponent * 10 + (*ptr++ - '0');
+    if (negative_exponent) exponent = -exponent;
+  }
+
+  exponent -= fraction_digits;
+  if (ptr != end || !any_digits || mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+    return parse_float_slow(text, result);
+  }
+
+  double value = (double) mantissa;
+  value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+  *result = negative ? -value : value;
+  return true;
+}
+
+bool parse_value_bool(String text, bool *result) {
+  text = trim_whitespace(text);
+  if (str_equal(text, "true", 4) || str_equal(text, "1", 1)) {
+    *result = true;
+    return true;
+  }
+  if (str_equal(text, "false", 5) || str_equal(text, "0", 1)) {
+    *result = false;
+    return true;
+  }
+  return false;
+}
+
+static bool parse_fixed_digits(const char **ptr_ptr, const char *end, int count, int *result) {
+  auto ptr = *ptr_ptr;
+  if (end - ptr < count) return false;
+  int value = 0;
+  for (int i = 0; i < count; i++) {
+    if (!is_digit(ptr[i])) return false;
+    value = value * 10 + (ptr[i] - '0');
+  }
+  *ptr_ptr = ptr + count;
+  *result = value;
+  return true;
+}
+
+static bool expect_char(const char **ptr_ptr, const char *end, char c) {
+  if (*ptr_ptr == end || **ptr_ptr != c) return false;
+  (*ptr_ptr)++;
+  return true;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+static int days_in_month(int year, int month) {
+  static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  return month == 2 && leap ? 29 : days[month - 1];
+}
+
+// YYYY-MM-DD, optionally followed by THH:MM:SS, a fraction of up to nine digits and Z or an offset of +HH:MM
+bool parse_value_time(String text, Timestamp *result) {
+  text = trim_whitespace(text);
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+
+  int year, month, day;
+  int hour = 0, minute = 0, second = 0;
+  int32_t nanoseconds = 0;
+  if (!parse_fixed_digits(&ptr, end, 4, &year) || !expect_char(&ptr, end, '-') ||
+      !parse_fixed_digits(&ptr, end, 2, &month) || !expect_char(&ptr, end, '-') ||
+      !parse_fixed_digits(&ptr, end, 2, &day)) {
+    return false;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) return false;
+
+  if (ptr != end && (*ptr == 'T' || *ptr == 't' || *ptr == ' ')) {
+    ptr++;
+    if (!parse_fixed_digits(&ptr, end, 2, &hour) || !expect_char(&ptr, end, ':') ||
+        !parse_fixed_digits(&ptr, end, 2, &minute) || !expect_char(&ptr, end, ':') ||
+        !parse_fixed_digits(&ptr, end, 2, &second)) {
+      return false;
+    }
+    if (hour > 24 || minute > 59 || second > 60) return false;
+    if (hour == 24 && (minute || second)) return false;
+    if (second == 60) second = 59; // Leap seconds are folded into the second before
+
+    if (ptr != end && *ptr == '.') {
+      ptr++;
+      if (ptr == end || !is_digit(*ptr)) return false;
+      int digits = 0;
+      while (ptr != end && is_digit(*ptr)) {
+        if (digits < 9) {
+          nanoseconds = nanoseconds * 10 + (*ptr - '0');
+          digits++;
+        }
+        ptr++;
+      }
+      while (digits++ < 9) nanoseconds *= 10;
+    }
+  }
+
+  int64_t offset_seconds = 0;
+  if (ptr != end && (*ptr == 'Z' || *ptr == 'z')) {
+    ptr++;
+  } else if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+    int sign = *ptr++ == '-' ? -1 : 1;
+    int offset_hours, offset_minutes = 0;
+    if (!parse_fixed_digits(&ptr, end, 2, &offset_hours)) return false;
+    if (ptr != end) {
+      expect_char(&ptr, end, ':');
+      if (!parse_fixed_digits(&ptr, end, 2, &offset_minutes)) return false;
+    }
+    if (offset_hours > 14 || offset_minutes > 59) return false;
+    offset_seconds = sign * (offset_hours * 3600 + offset_minutes * 60);
+  }
+  if (ptr != end) return false;
+
+  result->seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset_seconds;
+  result->nanoseconds = nanoseconds;
+  return true;
+}
+
+// Up to 18 significant digits, so the unscaled value always fits
+bool parse_value_decimal(String text, Decimal *result) {
+  text = trim_whitespace(text);
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+
+  bool negative = false;
+  if (ptr != end && (*ptr == '-' || *ptr == '+')) negative = *ptr++ == '-';
+
+  auto integer_start = ptr;
+  ptr = skip_zeros(ptr, end);
+  uint64_t unscaled = 0;
+  int integer_digits = parse_digits(ptr, end, 18, &unscaled);
+  ptr += integer_digits;
+  bool any_digits = ptr != integer_start;
+
+  int scale = 0;
+  if (ptr != end && *ptr == '.') {
+    ptr++;
+    scale = parse_digits(ptr, end, 18 - integer_digits, &unscaled);
+    ptr += scale;
+    any_digits = any_digits || scale > 0;
+  }
+  if (ptr != end || !any_digits) return false;
+
+  result->unscaled = negative ? -(int64_t) unscaled : (int64_t) unscaled;
+  result->scale = scale;
+  return true;
+}
+
+void parse_value(String text, ValueType type, Value *value) {
+  value->type = type;
+  value->text = text;
+  if (type != VT_STRING && trim_whitespace(text).length == 0) {
+    value->state = VS_MISSING;
+    return;
+  }
+
+  bool valid;
+  switch (type) {
+    case VT_STRING: valid = true; break;
+    case VT_INT64: valid = parse_value_int64(text, &value->int64); break;
+    case VT_FLOAT: valid = parse_value_float(text, &value->float64); break;
+    case VT_BOOL: valid = parse_value_bool(text, &value->boolean); break;
+    case VT_TIME: valid = parse_value_time(text, &value->time); break;
+    case VT_DECIMAL: valid = parse_value_decimal(text, &value->decimal); break;
+    default: valid = false; break;
+  }
+  value->state = valid ? VS_PRESENT : VS_INVALID;
+}
+
+const char *value_type_name(ValueType type) {
+  switch (type) {
+    case VT_STRING: return "string";
+    case VT_INT64: return "int64";
+    case VT_FLOAT: return "float";
+    case VT_BOOL: return "bool";
+    case VT_TIME: return "time";
+    case VT_DECIMAL: return "decimal";
+    default: return "unknown";
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+#include "str.hpp"
+
+// Typed values parsed straight from the source buffer. Surrounding XML whitespace is ignored, everything else has to
+// be part of the value for it to parse.
+
+enum ValueType : uint8_t {
+  VT_STRING,
+  VT_INT64,
+  VT_FLOAT,   // xs:double, including INF, -INF and NaN
+  VT_BOOL,    // true, false, 1 or 0
+  VT_TIME,    // ISO-8601 date or date-time, without an offset it is taken as UTC
+  VT_DECIMAL, // Exact, as unscaled * 10^-scale
+
+  MAX_VALUE_TYPES
+};
+
+enum ValueState : uint8_t {
+  VS_MISSING,
+  VS_PRESENT,
+  VS_INVALID // The text did not parse as the requested type, Value::text holds it
+};
+
+struct Decimal {
+  int64_t unscaled;
+  int32_t scale;
+};
+
+struct Timestamp {
+  int64_t seconds; // Since the Unix epoch, UTC
+  int32_t nanoseconds;
+};
+
+struct Value {
+  ValueType type;
+  ValueState state;
+  String text; // Points into the parser buffer
+  union {
+    int64_t int64;
+    double float64;
+    bool boolean;
+    Timestamp time;
+    Decimal decimal;
+  };
+};
+
+bool parse_value_int64(String text, int64_t *result);
+bool parse_value_float(String text, double *result);
+bool parse_value_bool(String text, bool *result);
+bool parse_value_time(String text, Timestamp *result);
+bool parse_value_decimal(String text, Decimal *result);
+
+// Fills in value for type, setting its state; empty text is missing for every type but VT_STRING
+void parse_value(String text, ValueType type, Value *value);
+
+const char *value_type_name(ValueType type);
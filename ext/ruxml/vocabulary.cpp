@@ -0,0 +1,140 @@
+#include "vocabulary.hpp"
+
+#include <algorithm>
+
+inline uint64_t vocabulary_slot(uint64_t hash, uint32_t seed, uint64_t mask) {
+  uint64_t h = hash ^ (seed * 0x9E3779B97F4A7C15ull);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h & mask;
+}
+
+inline uint64_t next_power_of_two(uint64_t value) {
+  uint64_t result = 1;
+  while (result < value) result <<= 1;
+  return result;
+}
+
+void vocabulary_init(Vocabulary *vocabulary) {
+  *vocabulary = Vocabulary{};
+  arena_init(&vocabulary->arena, "vocabulary");
+  apush(vocabulary->names, String{});
+  apush(vocabulary->hashes, (uint64_t) 0);
+}
+
+void vocabulary_destroy(Vocabulary *vocabulary) {
+  afree(vocabulary->names);
+  afree(vocabulary->hashes);
+  afree(vocabulary->seeds);
+  afree(vocabulary->slots);
+  arena_destroy(&vocabulary->arena);
+}
+
+int32_t vocabulary_add(Vocabulary *vocabulary, String name) {
+  auto hash = str_hash(name);
+  for (int32_t id = 1; id < (int32_t) alen(vocabulary->names); id++) {
+    if (vocabulary->hashes[id] == hash && str_equal(vocabulary->names[id], name)) return id;
+  }
+
+  apush(vocabulary->names, str_dup(arena_allocator(&vocabulary->arena), name));
+  apush(vocabulary->hashes, hash);
+  vocabulary->needs_build = true;
+  return (int32_t) alen(vocabulary->names) - 1;
+}
+
+// Places the ids of one bucket with the first seed that maps all of them to free, distinct slots
+static bool place_bucket(Vocabulary *vocabulary, int32_t *ids, int count, uint32_t *seed_ptr) {
+  for (uint32_t seed = 0; seed < 1 << 16; seed++) {
+    int placed = 0;
+    for (; placed < count; placed++) {
+      auto slot = vocabulary_slot(vocabulary->hashes[ids[placed]], seed, vocabulary->mask);
+      if (vocabulary->slots[slot]) break;
+      vocabulary->slots[slot] = ids[placed];
+    }
+    if (placed == count) {
+      *seed_ptr = seed;
+      return true;
+    }
+    while (placed-- > 0) vocabulary->slots[vocabulary_slot(vocabulary->hashes[ids[placed]], seed, vocabulary->mask)] = 0;
+  }
+  return false;
+}
+
+// Returns false when no perfect hash was found, lookups then fall back to comparing every name
+bool vocabulary_build(Vocabulary *vocabulary) {
+  vocabulary->needs_build = false;
+  aclear(vocabulary->seeds);
+  aclear(vocabulary->slots);
+  vocabulary->mask = 0;
+
+  int32_t count = (int32_t) alen(vocabulary->names) - 1;
+  if (count <= 0) return true;
+
+  uint64_t bucket_count = next_power_of_two((count + 3) / 4);
+  int32_t *order = nullptr; // Ids grouped by bucket, largest buckets first as they are the hardest to place
+  asetlen(order, count);
+  for (int32_t i = 0; i < count; i++) order[i] = i + 1;
+
+  auto bucket_of = [&](int32_t id) { return vocabulary->hashes[id] & (bucket_count - 1); };
+  uint32_t *bucket_sizes = nullptr;
+  asetlen(bucket_sizes, bucket_count);
+  memset(bucket_sizes, 0, bucket_count * sizeof(uint32_t));
+  for (int32_t i = 0; i < count; i++) bucket_sizes[bucket_of(order[i])]++;
+  std::sort(order, order + count, [&](int32_t a, int32_t b) {
+    auto size_a = bucket_sizes[bucket_of(a)];
+    auto size_b = bucket_sizes[bucket_of(b)];
+    if (size_a != size_b) return size_a > size_b;
+    return bucket_of(a) < bucket_of(b);
+  });
+
+  bool built = false;
+  for (uint64_t slot_count = next_power_of_two(count * 2); !built && slot_count <= (uint64_t) count * 64;
+       slot_count *= 2) {
+    vocabulary->mask = slot_count - 1;
+    asetlen(vocabulary->slots, slot_count);
+    memset(vocabulary->slots, 0, slot_count * sizeof(int32_t));
+    asetlen(vocabulary->seeds, bucket_count);
+    memset(vocabulary->seeds, 0, bucket_count * sizeof(uint32_t));
+
+    built = true;
+    for (int32_t start = 0; start < count;) {
+      auto bucket = bucket_of(order[start]);
+      int32_t end = start;
+      while (end < count && bucket_of(order[end]) == bucket) end++;
+      if (!place_bucket(vocabulary, order + start, end - start, &vocabulary->seeds[bucket])) {
+        built = false;
+        break;
+      }
+      start = end;
+    }
+  }
+
+  if (!built) {
+    aclear(vocabulary->seeds);
+    aclear(vocabulary->slots);
+    vocabulary->mask = 0;
+  }
+
+  afree(order);
+  afree(bucket_sizes);
+  return built;
+}
+
+int32_t vocabulary_lookup(Vocabulary *vocabulary, String name) {
+  if (vocabulary->needs_build) vocabulary_build(vocabulary);
+  if (vocabulary_empty(vocabulary)) return 0;
+
+  auto hash = str_hash(name);
+  if (!alen(vocabulary->slots)) {
+    for (int32_t id = 1; id < (int32_t) alen(vocabulary->names); id++) {
+      if (vocabulary->hashes[id] == hash && str_equal(vocabulary->names[id], name)) return id;
+    }
+    return 0;
+  }
+
+  auto seed = vocabulary->seeds[hash & (alen(vocabulary->seeds) - 1)];
+  auto id = vocabulary->slots[vocabulary_slot(hash, seed, vocabulary->mask)];
+  if (id && vocabulary->hashes[id] == hash && str_equal(vocabulary->names[id], name)) return id;
+  return 0;
+}
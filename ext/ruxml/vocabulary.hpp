@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+#include "str.hpp"
+#include "array.hpp"
+
+// A fixed set of names, e.g. the elements and attributes of a schema, mapped to small integer ids so consumers can
+// dispatch on an integer instead of comparing strings. Lookups go through a perfect hash (hash and displace): the name
+// hash picks a bucket, the bucket's seed picks a slot that no other name uses, and one string compare confirms the
+// match. The table is rebuilt on the first lookup after names were added.
+struct Vocabulary {
+  String *names;     // Stretchy array, indexed by name id; id 0 is reserved for names outside the vocabulary
+  uint64_t *hashes;  // Stretchy array, str_hash of each name
+  uint32_t *seeds;   // Stretchy array, one per bucket
+  int32_t *slots;    // Stretchy array, a name id or 0
+  uint64_t mask;     // Slot count - 1
+  bool needs_build;
+  MemoryArena arena; // Owns the name copies
+};
+
+void vocabulary_init(Vocabulary *vocabulary);
+void vocabulary_destroy(Vocabulary *vocabulary);
+
+int32_t vocabulary_add(Vocabulary *vocabulary, String name); // Returns the existing id when the name is known
+bool vocabulary_build(Vocabulary *vocabulary);
+int32_t vocabulary_lookup(Vocabulary *vocabulary, String name); // 0 when the name is not in the vocabulary
+
+inline bool vocabulary_empty(Vocabulary *vocabulary) { return alen(vocabulary->names) <= 1; }
@@ -0,0 +1,281 @@
+#include "writer.hpp"
+
+#include <cerrno>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+inline bool needs_escape(char c, bool attribute) {
+  return c == '<' || c == '>' || c == '&' || (attribute && (c == '"' || c == '\''));
+}
+
+static bool fd_sink(void *data, const char *bytes, int64_t length) {
+  int fd = (int) (intptr_t) data;
+  while (length > 0) {
+    auto written = write(fd, bytes, (size_t) length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    bytes += written;
+    length -= written;
+  }
+  return true;
+}
+
+void writer_init(Writer *writer, WriterSinkFunc sink, void *sink_data, WriterMode mode, int indent, int64_t capacity) {
+  *writer = Writer{};
+  writer->sink = sink;
+  writer->sink_data = sink_data;
+  writer->mode = mode;
+  writer->indent = indent;
+  writer->capacity = capacity;
+  writer->buffer = raw_allocate_string(capacity);
+}
+
+void writer_init_fd(Writer *writer, int fd, WriterMode mode, int indent) {
+  writer_init(writer, fd_sink, (void *) (intptr_t) fd, mode, indent);
+}
+
+bool writer_flush(Writer *writer) {
+  if (writer->at > 0) {
+    // Emptied first, a sink that raises out of here must not see the same bytes again on the next flush
+    auto length = writer->at;
+    writer->at = 0;
+    if (!writer->failed && !writer->sink(writer->sink_data, writer->buffer, length)) writer->failed = true;
+  }
+  return !writer->failed;
+}
+
+void writer_destroy(Writer *writer) {
+  raw_free(writer->buffer);
+  afree(writer->elements);
+  afree(writer->names);
+  writer->buffer = nullptr;
+}
+
+void writer_raw(Writer *writer, String text) {
+  if (text.length > writer->capacity - writer->at) {
+    writer_flush(writer);
+    if (text.length >= writer->capacity) {
+      if (!writer->failed && !writer->sink(writer->sink_data, text.data, text.length)) writer->failed = true;
+      return;
+    }
+  }
+
+  memcpy(writer->buffer + writer->at, text.data, text.length);
+  writer->at += text.length;
+}
+
+inline void writer_char(Writer *writer, char c) {
+  if (writer->at == writer->capacity) writer_flush(writer);
+  writer->buffer[writer->at++] = c;
+}
+
+static const char *find_escape(const char *ptr, const char *end, bool attribute) {
+#if defined(__SSE2__)
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i quot = _mm_set1_epi8('"');
+  const __m128i apos = _mm_set1_epi8('\'');
+
+  while (end - ptr >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *) ptr);
+    __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)),
+                                _mm_cmpeq_epi8(chunk, amp));
+    if (attribute) {
+      hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(chunk, quot), _mm_cmpeq_epi8(chunk, apos)));
+    }
+    int mask = _mm_movemask_epi8(hits);
+    if (mask) return ptr + __builtin_ctz(mask);
+    ptr += 16;
+  }
+#endif
+
+  while (ptr != end && !needs_escape(*ptr, attribute)) ptr++;
+  return ptr;
+}
+
+void writer_escaped(Writer *writer, String text, bool attribute) {
+  auto ptr = (const char *) text.data;
+  auto end = ptr + text.length;
+  auto run = ptr;
+
+  while (true) {
+    ptr = find_escape(ptr, end, attribute);
+    if (ptr == end) break;
+
+    writer_raw(writer, String{(int64_t) (ptr - run), (char *) run});
+    switch (*ptr) {
+      case '<': writer_raw(writer, "&lt;"_str); break;
+      case '>': writer_raw(writer, "&gt;"_str); break;
+      case '&': writer_raw(writer, "&amp;"_str); break;
+      case '"': writer_raw(writer, "&quot;"_str); break;
+      default: writer_raw(writer, "&apos;"_str); break;
+    }
+    run = ++ptr;
+  }
+
+  writer_raw(writer, String{(int64_t) (end - run), (char *) run});
+}
+
+static void writer_close_start_tag(Writer *writer) {
+  if (!writer->tag_open) return;
+  writer_char(writer, '>');
+  writer->tag_open = false;
+}
+
+static void writer_newline(Writer *writer, int64_t depth) {
+  if (writer->mode != WM_PRETTY || !writer->written) return;
+
+  static const String spaces = "                                "_str;
+  writer_char(writer, '\n');
+  int64_t count = depth * writer->indent;
+  while (count > 0) {
+    int64_t length = count < spaces.length ? count : spaces.length;
+    writer_raw(writer, String{(int64_t) length, spaces.data});
+    count -= length;
+  }
+}
+
+static void writer_qualified_name(Writer *writer, String xml_namespace, String name) {
+  if (!str_empty(xml_namespace)) {
+    writer_raw(writer, xml_namespace);
+    writer_char(writer, ':');
+  }
+  writer_raw(writer, name);
+}
+
+static WriterElement *writer_parent(Writer *writer) {
+  auto count = alen(writer->elements);
+  return count ? &writer->elements[count - 1] : nullptr;
+}
+
+void writer_xml_header(Writer *writer, String version, String encoding) {
+  writer_raw(writer, "<?xml version=\""_str);
+  writer_escaped(writer, version, true);
+  writer_raw(writer, "\" encoding=\""_str);
+  writer_escaped(writer, encoding, true);
+  writer_raw(writer, "\"?>"_str);
+  writer->written = true;
+}
+
+void writer_begin_element(Writer *writer, String xml_namespace, String name) {
+  writer_close_start_tag(writer);
+
+  auto parent = writer_parent(writer);
+  if (parent) parent->has_children = true;
+  if (!parent || !parent->has_text) writer_newline(writer, alen(writer->elements));
+
+  writer_char(writer, '<');
+  writer_qualified_name(writer, xml_namespace, name);
+  writer->tag_open = true;
+  writer->written = true;
+
+  WriterElement element = {};
+  element.name_start = alen(writer->names);
+  element.name_length = name.length + (str_empty(xml_namespace) ? 0 : xml_namespace.length + 1);
+  asetlen(writer->names, element.name_start + element.name_length);
+  auto name_ptr = writer->names + element.name_start;
+  if (!str_empty(xml_namespace)) {
+    memcpy(name_ptr, xml_namespace.data, xml_namespace.length);
+    name_ptr[xml_namespace.length] = ':';
+    name_ptr += xml_namespace.length + 1;
+  }
+  memcpy(name_ptr, name.data, name.length);
+  apush(writer->elements, element);
+}
+
+void writer_attribute(Writer *writer, String xml_namespace, String name, String value) {
+  if (!writer->tag_open) return;
+  writer_char(writer, ' ');
+  writer_qualified_name(writer, xml_namespace, name);
+  writer_raw(writer, "=\""_str);
+  writer_escaped(writer, value, true);
+  writer_char(writer, '"');
+}
+
+void writer_text(Writer *writer, String text) {
+  writer_close_start_tag(writer);
+  auto parent = writer_parent(writer);
+  if (parent) parent->has_text = true;
+  writer_escaped(writer, text, false);
+  writer->written = true;
+}
+
+void writer_comment(Writer *writer, String text) {
+  writer_close_start_tag(writer);
+  auto parent = writer_parent(writer);
+  if (parent) parent->has_children = true;
+  if (!parent || !parent->has_text) writer_newline(writer, alen(writer->elements));
+  writer_raw(writer, "<!--"_str);
+
+  // A comment can not hold "--" or end in '-', so a space goes after each '-' that starts either
+  auto run = text.data;
+  auto end = text.data + text.length;
+  for (auto ptr = text.data; ptr != end; ptr++) {
+    if (*ptr != '-' || (ptr + 1 != end && ptr[1] != '-')) continue;
+    writer_raw(writer, String{(int64_t) (ptr + 1 - run), (char *) run});
+    writer_char(writer, ' ');
+    run = ptr + 1;
+  }
+  writer_raw(writer, String{(int64_t) (end - run), (char *) run});
+  writer_raw(writer, "-->"_str);
+  writer->written = true;
+}
+
+bool writer_end_element(Writer *writer) {
+  if (!alen(writer->elements)) return false;
+  auto element = apop(writer->elements);
+
+  if (writer->tag_open) {
+    writer_raw(writer, "/>"_str);
+    writer->tag_open = false;
+  } else {
+    if (element.has_children && !element.has_text) writer_newline(writer, alen(writer->elements));
+    writer_raw(writer, "</"_str);
+    writer_raw(writer, String{(int64_t) element.name_length, writer->names + element.name_start});
+    writer_char(writer, '>');
+  }
+
+  ahdr(writer->names)->len = (uint32_t) element.name_start;
+  return true;
+}
+
+void writer_node(Writer *writer, Parser *parser, Node node) {
+  if (node.type == NODE_ELEMENT_BEGIN) {
+    writer_begin_element(writer, node.xml_namespace, node.text);
+
+    rewind_attributes(parser);
+    for (int i = 0; i < parser->node.attribute_count; i++) {
+      auto attribute = get_attribute(parser);
+      char quote = memchr(attribute.value.data, '"', attribute.value.length) ? '\'' : '"';
+      writer_char(writer, ' ');
+      writer_qualified_name(writer, attribute.xml_namespace, attribute.name);
+      writer_char(writer, '=');
+      writer_char(writer, quote);
+      writer_raw(writer, attribute.value);
+      writer_char(writer, quote);
+    }
+    rewind_attributes(parser);
+
+    if (node.self_closing) writer_end_element(writer);
+  } else if (node.type == NODE_ELEMENT_END) {
+    writer_end_element(writer);
+  } else if (node.type == NODE_TEXT) {
+    if (writer->mode == WM_PRETTY && str_is_whitespace(node.text)) return;
+    writer_close_start_tag(writer);
+    auto parent = writer_parent(writer);
+    if (parent) parent->has_text = true;
+    writer_raw(writer, node.text);
+    writer->written = true;
+  } else if (node.type == NODE_COMMENT) {
+    writer_comment(writer, node.text);
+  } else if (node.type == NODE_XML_HEADER) {
+    writer_raw(writer, String{(int64_t) (node.tag_end - node.tag_start), parser->buffer + node.tag_start});
+    writer->written = true;
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "parser.hpp"
+
+// Receives flushed output; returns false when the bytes could not be written
+using WriterSinkFunc = bool (*)(void *data, const char *bytes, int64_t length);
+
+enum WriterMode : uint8_t {
+  WM_COMPACT,
+  WM_PRETTY
+};
+
+struct WriterElement {
+  int64_t name_start; // Offset of the qualified name in Writer::names
+  int64_t name_length;
+  bool has_children;
+  bool has_text;
+};
+
+struct Writer {
+  WriterSinkFunc sink;
+  void *sink_data;
+  WriterMode mode;
+  int indent;
+
+  char *buffer;
+  int64_t capacity;
+  int64_t at;
+
+  bool failed;
+  bool tag_open; // A start tag is written up to its attributes and still needs a '>' or '/>'
+  bool written;
+
+  WriterElement *elements;
+  char *names;
+};
+
+void writer_init(Writer *writer, WriterSinkFunc sink, void *sink_data, WriterMode mode = WM_COMPACT, int indent = 2,
+                 int64_t capacity = 64 * 1024);
+void writer_init_fd(Writer *writer, int fd, WriterMode mode = WM_COMPACT, int indent = 2);
+bool writer_flush(Writer *writer);
+void writer_destroy(Writer *writer);
+
+void writer_raw(Writer *writer, String text);
+void writer_escaped(Writer *writer, String text, bool attribute);
+
+void writer_xml_header(Writer *writer, String version = "1.0"_str, String encoding = "UTF-8"_str);
+void writer_begin_element(Writer *writer, String xml_namespace, String name);
+void writer_attribute(Writer *writer, String xml_namespace, String name, String value);
+void writer_text(Writer *writer, String text);
+void writer_comment(Writer *writer, String text); // Splits "--" and a trailing '-' with a space
+bool writer_end_element(Writer *writer);
+
+// Writes a node returned by get_node, including its attributes. Node text and attribute values are written as they
+// appear in the source, they are not escaped a second time.
+void writer_node(Writer *writer, Parser *parser, Node node);
@@ -1,6 +1,7 @@
 require 'ruxml/ruxml'
 require 'ruxml/parser'
 require 'ruxml/parse_error'
+require 'ruxml/writer'
 
 module RUXML
 end
\ No newline at end of file
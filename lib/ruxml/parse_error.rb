@@ -1,9 +1,16 @@
 module RUXML
   class ParseError < RuntimeError
-    attr_reader :message
+    attr_reader :message, :code, :source, :offset, :line, :column, :expected, :got
 
-    def initialize(message)
+    def initialize(message, details = {})
       @message = message
+      @code = details[:code]
+      @source = details[:source]
+      @offset = details[:offset]
+      @line = details[:line]
+      @column = details[:column]
+      @expected = details[:expected]
+      @got = details[:got]
     end
   end
-end
\ No newline at end of file
+end
@@ -3,7 +3,7 @@ module RUXML
 
     def get_node
       next_node
-      raise ParseError.new("RUXML encountered an error in the XML") if errored
+      raise error if errored
       node
     end
 
@@ -11,14 +11,70 @@ module RUXML
       while next_node
         yield node
       end
-      raise ParseError.new("RUXML encountered an error in the XML") if errored
+      raise error if errored
+    end
+
+    # Copies the source to writer, yielding self for every node except element ends. Return :drop (or false) to leave
+    # the node or whole element out, :drop_content to keep only the element's tags, anything else to keep it.
+    def filter(writer, &block)
+      success = passthrough(writer, &block)
+      raise error if errored
+      success
+    end
+
+    # Opens filename like open_file, but replays the event cache at cache_path when it is current for the file and the
+    # parser's options, rebuilding the cache first when it is not. Returns true when the existing cache was used. When
+    # the cache can not be written the file is opened as with open_file.
+    def open_file_cached(filename, cache_path, **options)
+      return true if open_cache(filename, cache_path, **options) == :current
+      begin
+        open_cache(filename, cache_path, **options) if build_cache(filename, cache_path, **options)
+      rescue SystemCallError
+        open_file(filename, **options)
+      end
+      false
+    end
+
+    # Calls start_element(name), attr(name, value), end_element(name), text(text) and comment(text) on handler for
+    # every node, Ox::Sax style. Methods the handler does not define are never called, and no Node objects are made.
+    # A self-closing element gets an end_element right after its attributes.
+    def sax(handler)
+      success = sax_parse(handler)
+      raise error if errored
+      success
+    end
+
+    # Yields an Array of native values for every record element, fields maps child element names and "@attribute"
+    # names to :string, :int64, :float, :bool, :time or :decimal, e.g.
+    #
+    #   parser.each_record("order", "@id" => :int64, "total" => :decimal) { |id, total| }
+    def each_record(record, fields, &block)
+      count = records(record, fields, &block)
+      raise error if errored
+      count
+    end
+
+    # Reads up to limit records into column buffers laid out like Arrow arrays, one Hash of binary Strings per field
+    # (:validity, :data and :offsets for strings) plus :type, :length, :null_count and :scale for decimals. Call it
+    # again for the next batch, a batch of length 0 means the input is exhausted. A batch ends early rather than take a
+    # column past 2 GB, the most its int32 string offsets can address.
+    def read_columns(record, fields, limit = nil)
+      result = columns(record, fields, limit)
+      raise error if errored
+      result
+    end
+
+    # Registers names up front and returns their ids, e.g. ITEM, PRICE = parser.register_names("item", "price"). Nodes
+    # and attributes with a registered name carry its id as name_id, 0 otherwise.
+    def register_names(*names)
+      names.flatten.map { |name| register_name(name) }
     end
 
     def each_node
       while next_node
         yield
       end
-      raise ParseError.new("RUXML encountered an error in the XML") if errored
+      raise error if errored
     end
 
   end
@@ -0,0 +1,12 @@
+module RUXML
+  class Writer
+
+    def element(name, attributes = {})
+      begin_element(name.to_s)
+      attributes.each { |key, value| attribute(key.to_s, value.to_s) }
+      yield self if block_given?
+      end_element
+    end
+
+  end
+end
@@ -1,4 +1,5 @@
 require 'ruxml'
+require 'tempfile'
 
 describe RUXML::Parser, type: :lib do
   it "parses a basic string" do
@@ -205,6 +206,135 @@ describe RUXML::Parser, type: :lib do
     end
   end
 
+  it "tracks byte spans of elements" do
+    subject { described_class.new }
+
+    xml = "<a x='1'>one<b/><!--c--></a>"
+    success = subject.open_string("test", xml)
+    expect(success).to eq true
+
+    node = subject.get_node
+    expect(node.type).to eq :begin
+    expect(node.tag_start).to eq 0
+    expect(node.tag_end).to eq 9
+    expect(node.content_start).to eq 9
+    expect(node.content_end).to eq nil
+    expect(node.column_end).to eq 9
+
+    node = subject.get_node
+    expect(node.type).to eq :text
+    expect(subject.source_slice(node.tag_start, node.tag_end)).to eq "one"
+
+    node = subject.get_node
+    expect(node.self_closing).to eq true
+    expect(subject.source_slice(node.tag_start, node.tag_end)).to eq "<b/>"
+    expect(node.content_start).to eq node.content_end
+
+    node = subject.get_node
+    expect(node.type).to eq :comment
+    expect(subject.source_slice(node.tag_start, node.tag_end)).to eq "<!--c-->"
+    expect(subject.source_slice(node.content_start, node.content_end)).to eq "c"
+
+    node = subject.get_node
+    expect(node.type).to eq :end
+    expect(subject.source_slice(node.tag_start, node.tag_end)).to eq "</a>"
+    expect(subject.source_slice(node.content_start, node.content_end)).to eq "one<b/><!--c-->"
+    expect(subject.source_slice(node.element_start, node.tag_end)).to eq xml
+    expect(subject.node_tag_end).to eq xml.bytesize
+
+    expect { subject.source_slice(0, xml.bytesize + 1) }.to raise_error(IndexError)
+  end
+
+  it "reads attributes of the current node" do
+    subject { described_class.new }
+
+    success = subject.open_string("test", "<row id=\"7\" xml:lang='en' sku=\"A-1\"/><next/>")
+    expect(success).to eq true
+
+    subject.next_node
+    expect(subject.node_attribute_count).to eq 3
+    expect(subject.node_attribute("sku")).to eq "A-1"
+    expect(subject.node_attribute("lang", "xml")).to eq "en"
+    expect(subject.node_attribute("lang")).to eq nil
+    expect(subject.node_attributes).to eq("id" => "7", "xml:lang" => "en", "sku" => "A-1")
+    expect(subject.each_attribute.to_a).to eq [["id", "7", ""], ["lang", "en", "xml"], ["sku", "A-1", ""]]
+
+    subject.next_node
+    expect(subject.node_attributes).to eq({})
+  end
+
+  it "looks attributes up by name on wide elements" do
+    attributes = (1..200).map { |i| "a#{i}=\"#{i}\"" }.join(" ")
+    xml = "<row #{attributes} sku=\"A-1\" x:sku='B-2'/><dup id=\"1\" x:id=\"2\" id=\"3\"/>"
+    [{}, lazy_attributes: true].each do |options|
+      parser = described_class.new(**options)
+      parser.open_string("test", xml)
+      node = parser.get_node
+      expect(node["sku"]).to eq "A-1"
+      expect(node["sku", "x"]).to eq "B-2"
+      expect(node["a137"]).to eq "137"
+      expect(node["a201"]).to eq nil
+      expect(parser.node_duplicate_attribute).to eq nil
+
+      parser.get_node
+      expect(parser.node_attribute("id")).to eq "1"
+      expect(parser.node_duplicate_attribute).to eq "id"
+      expect { node["sku"] }.to raise_error(RuntimeError)
+    end
+    expect { RUXML::Node.new["sku"] }.to raise_error(RuntimeError)
+  end
+
+  it "calls a SAX handler for every node" do
+    handler = Class.new do
+      attr_reader :events
+      def initialize; @events = []; end
+      def start_element(name); @events << [:start, name]; end
+      def attr(name, value); @events << [:attr, name, value]; end
+      def end_element(name); @events << [:end, name]; end
+      def text(text); @events << [:text, text]; end
+      def comment(text); @events << [:comment, text]; end
+    end.new
+
+    xml = "<doc x:id='1'><item n=\"2\"/>text<!--note--></doc>"
+    subject.open_string("test", xml)
+    expect(subject.sax(handler)).to eq true
+    expect(handler.events).to eq [
+      [:start, "doc"], [:attr, "x:id", "1"], [:start, "item"], [:attr, "n", "2"], [:end, "item"], [:text, "text"],
+      [:comment, "note"], [:end, "doc"]
+    ]
+
+    ends = Class.new do
+      attr_reader :names
+      def initialize; @names = []; end
+      def end_element(name); @names << name; end
+    end.new
+    parser = described_class.new(lazy_attributes: true)
+    parser.open_string("test", xml)
+    parser.sax(ends)
+    expect(ends.names).to eq ["item", "doc"]
+
+    parser.open_string("test", "<a></b>")
+    expect { parser.sax(ends) }.to raise_error(RUXML::ParseError)
+  end
+
+  it "reports parse statistics" do
+    subject { described_class.new }
+
+    attributes = (1..40).map { |i| "a#{i}=\"#{i}\"" }.join(" ")
+    xml = "<a><b #{attributes}><c/></b><!--x--></a>"
+    success = subject.open_string("test", xml)
+    expect(success).to eq true
+    subject.each_node {}
+
+    stats = subject.stats
+    next if stats.nil? # Built without --enable-stats
+    expect(stats[:nodes]).to eq(begin: 3, end: 2, text: 0, xml_header: 0, comment: 1, error: 0)
+    expect(stats[:max_depth]).to eq 2
+    expect(stats[:attribute_block_overflows]).to eq 1
+    expect(stats[:bytes_scanned].values.sum).to eq xml.bytesize
+    expect(stats[:arena_used]).to be > 0
+  end
+
   it "errors on broken XML" do
     subject { described_class.new }
 
@@ -217,4 +347,653 @@ describe RUXML::Parser, type: :lib do
 
     expect(subject.done).to eq true
   end
+
+  it "checks that end tags match the open element" do
+    subject { described_class.new }
+
+    subject.open_string("test", "<a><b>text</a></b>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError) { |error|
+      expect(error.code).to eq :mismatched_end_tag
+      expect(error.expected).to eq "b"
+      expect(error.got).to eq "a"
+      expect(error.message).to eq "test:1:13 - Expected </b> but got </a>"
+    }
+
+    subject.open_string("test", "<a/></a>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError, /without an open element/)
+
+    subject.open_string("test", "<x:a><b></x:a>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError, /Expected <\/b> but got <\/x:a>/)
+
+    parser = described_class.new(recover: true)
+    parser.open_string("test", "<a><b></c></b></a>")
+    types = []
+    parser.each { |node| types << node.type }
+    expect(types).to eq [:begin, :begin, :error, :end, :end]
+    expect(parser.error_count).to eq 1
+  end
+
+  it "tracks the path of the current node" do
+    subject { described_class.new }
+
+    xml = "<doc><x:list>text<item id='1'/></x:list></doc>"
+    expected = [
+      ["/doc", nil], ["/doc/x:list", "doc"], ["/doc/x:list", "x:list"], ["/doc/x:list/item", "x:list"],
+      ["/doc/x:list", "doc"], ["/doc", nil]
+    ]
+    subject.open_string("test", xml)
+    paths = []
+    subject.each_node { paths << [subject.path, subject.parent_name] }
+    expect(paths).to eq expected
+
+    replayed = []
+    RUXML.parse_many([xml]) { |parser| parser.each_node { replayed << [parser.path, parser.parent_name] } }
+    expect(replayed).to eq expected
+  end
+
+  it "reports error details" do
+    subject { described_class.new }
+
+    success = subject.open_string("test", "<tag>text</t@ag>")
+    expect(success).to eq true
+    expect(subject.error).to eq nil
+
+    expect do
+      subject.each_node {}
+    end.to raise_error(RUXML::ParseError, "test:1:13 - Invalid character '@'")
+
+    error = subject.error
+    expect(error.code).to eq :invalid_character
+    expect(error.offset).to eq 12
+    expect(error.line).to eq 1
+    expect(error.column).to eq 13
+    expect(error.got).to eq "@"
+
+    subject.open_string("test", "<tag a=1>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError)
+  end
+
+  it "reports unexpected tokens" do
+    subject { described_class.new }
+
+    subject.open_string("test", "<a b>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError)
+    expect(subject.error.code).to eq :unexpected_token
+    expect(subject.error.expected).to eq "'='"
+    expect(subject.error.got).to eq "'>'"
+  end
+
+  it "recovers from errors when asked to" do
+    subject = described_class.new(recover: true)
+
+    subject.open_string("test", "<a><b x='1' y></b>\n<!DOCTYPE a><c>text</c></a>")
+    nodes = []
+    subject.each { |node| nodes << [node.type, node.text] }
+
+    expect(nodes).to eq [[:begin, "a"], [:error, "<b x='1' y>"], [:end, "b"], [:text, "\n"], [:error, "<!DOCTYPE a>"],
+                         [:begin, "c"], [:text, "text"], [:end, "c"], [:end, "a"]]
+    expect(subject.errored).to eq false
+    expect(subject.error_count).to eq 2
+    expect(subject.error.code).to eq :invalid_comment
+    expect(subject.error.line).to eq 2
+  end
+
+  it "recovers from an error at the end of the input" do
+    subject = described_class.new(recover: true)
+
+    subject.open_string("test", "<a>text</a><b c=\"unterminated>")
+    nodes = []
+    subject.each_node { nodes << [subject.node_type, subject.node_text] }
+
+    expect(nodes.last).to eq [:error, "<b c=\"unterminated>"]
+    expect(nodes.size).to eq 4
+    expect(subject.error.code).to eq :unterminated_value
+  end
+
+  it "resolves namespace prefixes to interned ids" do
+    subject = described_class.new(resolve_namespaces: true)
+    soap = subject.register_namespace("http://schemas.xmlsoap.org/soap/envelope/")
+    lang = subject.register_name("lang")
+
+    xml = "<s:Envelope xmlns:s='http://schemas.xmlsoap.org/soap/envelope/' xmlns='urn:a'>" \
+          "<s:Body s:id='1' xml:lang='en'><item xmlns='urn:b'/><item/></s:Body></s:Envelope>"
+    subject.open_string("test", xml)
+
+    nodes = []
+    subject.each_node do
+      nodes << [subject.node_type, subject.node_text, subject.namespace_uri(subject.node_namespace_id)]
+      if subject.node_text == "Body" && subject.node_type == :begin
+        expect(subject.node_namespace_id).to eq soap
+        expect(subject.node_attribute("id", soap)).to eq "1"
+        expect(subject.node_attribute("lang", 1)).to eq "en"
+        expect(subject.node_attribute(lang, 1)).to eq "en"
+        expect(subject.node_attribute(lang, "xml")).to eq "en"
+        expect(subject.node_attribute("id", 0)).to eq nil
+      end
+    end
+
+    envelope = "http://schemas.xmlsoap.org/soap/envelope/"
+    expect(nodes).to eq [[:begin, "Envelope", envelope], [:begin, "Body", envelope], [:begin, "item", "urn:b"],
+                         [:begin, "item", "urn:a"], [:end, "Body", envelope], [:end, "Envelope", envelope]]
+    expect(subject.register_namespace("urn:b")).to eq subject.register_namespace("urn:b")
+    expect(subject.namespace_uri(1)).to eq "http://www.w3.org/XML/1998/namespace"
+  end
+
+  it "reports undeclared namespace prefixes" do
+    subject = described_class.new(resolve_namespaces: true)
+
+    subject.open_string("test", "<a xmlns:p='urn:p'><p:b/></a><q:c/>")
+    expect { subject.each_node {} }.to raise_error(RUXML::ParseError, "test:1:30 - Namespace prefix is not declared")
+    expect(subject.error.code).to eq :unbound_prefix
+  end
+
+  it "stamps nodes with ids from a registered vocabulary" do
+    subject = described_class.new
+    item, price, currency = subject.register_names("item", "price", "currency")
+    expect(subject.register_name("price")).to eq price
+
+    subject.open_string("test", "<items><item><price currency='EUR' other='1'>10</price></item></items>")
+    ids = []
+    subject.each_node do
+      ids << subject.node_name_id if subject.node_type == :begin || subject.node_type == :end
+      next unless subject.node_type == :begin && subject.node_name_id == price
+
+      expect(subject.node_attribute(currency)).to eq "EUR"
+      expect(subject.node_attribute(item)).to eq nil
+    end
+
+    expect(ids).to eq [0, item, price, price, item, 0]
+  end
+
+  it "finds every name of a large vocabulary" do
+    subject = described_class.new
+    names = Array.new(500) { |i| "element-#{i}" }
+    ids = subject.register_names(names)
+
+    expect(names.map { |name| subject.name_id(name) }).to eq ids
+    expect(subject.name_id("element-500")).to eq 0
+    expect(subject.name_id("")).to eq 0
+  end
+
+  it "extracts typed record fields" do
+    subject = described_class.new
+    xml = <<~XML
+      <orders>
+        <order id="1" paid="true"><total>19.99</total><amount>12.50</amount><created>2024-03-01T12:00:00Z</created></order>
+        <order id="-2" paid="0"><total> 1e3 </total><note>gift</note><created>2024-03-01T13:30:00+01:30</created></order>
+        <order id="3"><total/><nested><total>5</total></nested></order>
+      </orders>
+    XML
+    subject.open_string("test", xml)
+
+    records = []
+    count = subject.each_record("order", "@id" => :int64, "@paid" => :bool, "total" => :float, "amount" => :decimal,
+                                         "created" => :time, "note" => :string) do |record|
+      records << record
+    end
+
+    expect(count).to eq 3
+    expect(records[0]).to eq [1, true, 19.99, Rational(25, 2), Time.utc(2024, 3, 1, 12), nil]
+    expect(records[1]).to eq [-2, false, 1000.0, nil, Time.utc(2024, 3, 1, 12), "gift"]
+    expect(records[2]).to eq [3, nil, nil, nil, nil, nil]
+
+    subject.open_string("test", "<r><o id='1'><t>2</t></o><o id='1'><t>2</t><x></y></o></r>")
+    records = []
+    expect { subject.each_record("o", "@id" => :int64, "t" => :int64) { |record| records << record } }
+      .to raise_error(RUXML::ParseError)
+    expect(records).to eq [[1, 2]]
+  end
+
+  it "rejects values that do not parse" do
+    subject = described_class.new
+    subject.open_string("test", "<r><n>12a</n></r>")
+    expect { subject.each_record("r", "n" => :int64) {} }.to raise_error(ArgumentError, 'Invalid int64 value "12a" for n')
+
+    subject.open_string("test", "<r><n>9223372036854775807</n></r>")
+    subject.each_node { expect(subject.node_value(:int64)).to eq 9223372036854775807 if subject.node_type == :text }
+    expect { subject.node_value(:number) }.to raise_error(ArgumentError)
+
+    floats = ["1.5e300", "-INF", "NaN", ".5E-3", "0x10", "infinity", "nan(1)", "inf", "1e", "."].map do |text|
+      subject.open_string("test", "<n>#{text}</n>")
+      subject.next_node
+      subject.next_node
+      begin
+        subject.node_value(:float)
+      rescue ArgumentError
+        :invalid
+      end
+    end
+    expect(floats[0, 2]).to eq [1.5e300, -Float::INFINITY]
+    expect(floats[2].nan?).to eq true
+    expect(floats[3..]).to eq [0.0005] + [:invalid] * 6
+  end
+
+  it "reads records into Arrow style columns" do
+    subject = described_class.new
+    xml = "<rows><row id='1' ok='true'><name>a</name><price>1.5</price><at>1970-01-01T00:00:01Z</at></row>" \
+          "<row id='2'><name>bcd</name><price>2.25</price></row><row id='3' ok='false'/></rows>"
+    subject.open_string("test", xml)
+
+    fields = { "@id" => :int64, "@ok" => :bool, "name" => :string, "price" => :decimal, "at" => :time }
+    columns = subject.read_columns("row", fields, 2)
+
+    expect(columns["@id"][:length]).to eq 2
+    expect(columns["@id"][:data].unpack("q<*")).to eq [1, 2]
+    expect(columns["@ok"][:validity].unpack1("b2")).to eq "10"
+    expect(columns["@ok"][:data].unpack1("b2")).to eq "10"
+    expect(columns["@ok"][:null_count]).to eq 1
+    expect(columns["name"][:offsets].unpack("l<*")).to eq [0, 1, 4]
+    expect(columns["name"][:data]).to eq "abcd"
+    expect(columns["price"][:scale]).to eq 2
+    expect(columns["price"][:data].unpack("q<q<q<q<")).to eq [150, 0, 225, 0]
+    expect(columns["at"][:data].unpack("q<*")).to eq [1_000_000_000, 0]
+    expect(columns["at"][:validity].unpack1("b2")).to eq "10"
+
+    columns = subject.read_columns("row", fields, 2)
+    expect(columns["name"][:length]).to eq 1
+    expect(columns["name"][:validity].unpack1("b1")).to eq "0"
+    expect(columns["name"][:offsets].unpack("l<*")).to eq [0, 0]
+    expect(subject.read_columns("row", fields)["@id"][:length]).to eq 0
+  end
+
+  it "parses many documents on worker threads in order" do
+    documents = 200.times.map { |i| "<r id='#{i}'><v>#{i * 2}</v></r>" }
+    documents[7] = "<r id=7><v>14</v></r>"
+
+    results = RUXML.parse_many(documents, threads: 4) do |parser, index|
+      values = []
+      begin
+        parser.each_node { values << parser.node_text if parser.node_type == :text }
+      rescue RUXML::ParseError => e
+        values << e.message
+      end
+      [index, values, parser.errored]
+    end
+
+    expect(results.size).to eq 200
+    expect(results[3]).to eq [3, ["6"], false]
+    expect(results[199]).to eq [199, ["398"], false]
+    expect(results[7]).to eq [7, ["document:1:7 - Invalid character '7'"], true]
+
+    recovered = RUXML.parse_many(["<a><b x></b></a>"], recover: true) do |parser|
+      types = []
+      parser.each { |node| types << node.type }
+      types
+    end
+    expect(recovered).to eq [[:begin, :error, :end, :end]]
+
+    wide = 50.times.map { |i| "\uFEFF<r><v>#{i}</v></r>".encode("UTF-16LE").b }
+    nodes = RUXML.parse_many(wide) { |parser| 3.times { parser.next_node }; parser.node }
+    GC.start
+    expect(nodes.map(&:text)).to eq 50.times.map(&:to_s)
+
+    parser = described_class.new
+    parser.open_string("wide", wide[0])
+    parser.next_node
+    node = parser.node
+    parser.open_string("next", wide[1])
+    expect { node.text }.to raise_error(RuntimeError)
+
+    ids = [4, 2, 1].map do |threads|
+      Thread.new { 10.times.map { RUXML.parse_many(documents[8..], threads: threads) { |parser| parser.get_node["id"] } } }
+    end
+    expect(ids.map(&:value).flatten(1).uniq).to eq [(8...200).map(&:to_s)]
+  end
+
+  it "parses on a background thread ahead of the consumer" do
+    xml = "<doc>" + 20_000.times.map { |i| "<item id=\"#{i}\"><v>#{i}</v></item>" }.join + "</doc>"
+    read = lambda do |pipelined, source = xml, **options|
+      parser = described_class.new(**options)
+      parser.open_string("test", source)
+      expect(parser.start_pipeline).to eq true if pipelined
+      nodes = []
+      begin
+        parser.each { |node| nodes << [node.type, node.text, node.offset, node["id"], parser.path] }
+      rescue RUXML::ParseError => e
+        nodes << e.message
+      end
+      nodes
+    end
+
+    expected = read.call(false)
+    expect(expected.size).to be > 8 * 4096
+    expect(read.call(true)).to eq expected
+
+    broken = xml.sub("</item><item id=\"7000\">", "</item><item id=7000>")
+    expect(read.call(true, broken)).to eq read.call(false, broken)
+    expect(read.call(true, broken).last).to include "Invalid character '7'"
+
+    parser = described_class.new
+    parser.open_string("test", xml)
+    parser.start_pipeline
+    3.times { parser.next_node }
+    expect { parser.start_pipeline }.not_to raise_error
+    parser.open_string("again", "<a/>")
+    expect { parser.start_pipeline }.not_to raise_error
+    expect(parser.get_node.text).to eq "a"
+
+    parser = described_class.new
+    parser.open_string("late", "<a/>")
+    parser.next_node
+    expect { parser.start_pipeline }.to raise_error(RuntimeError)
+
+    source = xml.dup
+    parser = described_class.new
+    parser.open_string("changed", source)
+    parser.start_pipeline
+    source.replace("x" * xml.size * 2)
+    source << "y" * 1000
+    texts = []
+    parser.each { |node| texts << node.text }
+    expect(texts).to eq expected.map { |node| node[1] }
+  end
+
+  it "reads files the same way with every io strategy" do
+    read_nodes = lambda do |io, offset = nil, length = nil|
+      parser = described_class.new
+      expect(parser.open_file("./spec/fixtures/text.xml", offset, length, io: io)).to eq true
+      nodes = []
+      parser.each { |node| nodes << [node.type, node.text] }
+      [parser.io, nodes]
+    end
+
+    expected = read_nodes.call(:mmap)[1]
+    expect(read_nodes.call(:auto)).to eq [:populate, expected]
+    %i[sequential populate prefetch read].each { |io| expect(read_nodes.call(io)).to eq [io, expected] }
+
+    # Offsets do not have to be page aligned
+    text = File.read("./spec/fixtures/text.xml")
+    offset = text.index("<", 1)
+    length = text.index(">", offset) + 1 - offset
+    expect(read_nodes.call(:read, offset, length)[1]).to eq [[:begin, text[offset + 1...offset + length - 1]]]
+    expect { described_class.new.open_file("./spec/fixtures/text.xml", io: :async) }.to raise_error(ArgumentError)
+
+    %i[mmap read].each do |io|
+      parser = described_class.new
+      expect(parser.open_file("./spec/fixtures/text.xml", offset, text.bytesize, io: io)).to eq false
+      expect(parser.error.code).to eq :open_failed
+      expect(parser.error.message).to include "Invalid argument"
+    end
+  end
+
+  it "streams files through a window of released pages" do
+    Tempfile.create(["stream", ".xml"]) do |file|
+      file.write("<rows>")
+      20000.times { |i| file.write("<row id='#{i}'>value #{i}</row>") }
+      file.write("</rows>")
+      file.flush
+
+      read_texts = lambda do |options|
+        parser = described_class.new
+        expect(parser.open_file(file.path, **options)).to eq true
+        first = nil
+        texts = []
+        parser.each do |node|
+          first ||= node if node.type == :text
+          texts << node.text if node.type == :text
+        end
+        [texts, first.text]
+      end
+
+      expected = read_texts.call(io: :mmap)
+      expect(expected[0].size).to eq 20000
+      expect(read_texts.call(window: 4096)).to eq expected
+      expect(read_texts.call(io: :prefetch, window: 1)).to eq expected
+
+      # A range that starts off a page boundary, the window then counts from the mapping below the range
+      offset = File.read(file.path).index("<row id='100'>")
+      ranged = lambda do |options|
+        parser = described_class.new
+        expect(parser.open_file(file.path, offset, File.size(file.path) - offset - 7, **options)).to eq true
+        texts = []
+        parser.each { |node| texts << node.text if node.type == :text }
+        texts
+      end
+      expect(ranged.call(window: 4096)).to eq expected[0][100..]
+      expect(ranged.call(io: :prefetch, window: 1)).to eq expected[0][100..]
+
+      parser = described_class.new
+      expect(parser.open_file(file.path, io: :read, window: 4096)).to eq false
+      expect(parser.error.code).to eq :open_failed
+    end
+  end
+
+  it "opens a sparse file at an offset past 4 GB" do
+    Tempfile.create(["sparse", ".xml"]) do |file|
+      offset = 5 * 1024**3 + 7
+      file.seek(offset)
+      file.write("<a n='1'>tail</a>")
+      file.flush
+
+      subject = described_class.new
+      expect(subject.open_file(file.path, offset)).to eq true
+      nodes = []
+      subject.each { |node| nodes << [node.type, node.text] }
+      expect(nodes).to eq [[:begin, "a"], [:text, "tail"], [:end, "a"]]
+    end
+  end
+
+  it "reports 64-bit offsets when parsing past 2 GB" do
+    Tempfile.create(["sparse", ".xml"]) do |file|
+      # Ten 256 MB text nodes of zero bytes, the file holes cost no disk space
+      step = 256 * 1024**2
+      file.write("<r><t>")
+      (1..9).each do |i|
+        file.seek(i * step)
+        file.write("</t><t n='#{i}'>")
+      end
+      file.write("</t></r>")
+      file.flush
+
+      subject = described_class.new
+      expect(subject.open_file(file.path, window: 64 * 1024**2)).to eq true
+      begins = []
+      subject.each { |node| begins << node.tag_start if node.type == :begin }
+      expect(begins.last).to eq 9 * step + 4
+      expect(subject.errored).to eq false
+    end
+  end
+
+  it "checks string offsets and lengths" do
+    subject = described_class.new
+
+    expect(subject.open_string("test", "<a/><b/>", 4)).to eq true
+    expect(subject.next_node && subject.node_text).to eq "b"
+    expect { subject.open_string("test", "<a/>", 2, 3) }.to raise_error(ArgumentError)
+    expect { subject.open_string("test", "<a/>", 5) }.to raise_error(ArgumentError)
+  end
+
+  it "skips a UTF-8 byte order mark" do
+    subject = described_class.new
+
+    expect(subject.open_string("test", "\xEF\xBB\xBF<a>x</a>".b)).to eq true
+    expect(subject.next_node && [subject.node_type, subject.node_text]).to eq [:begin, "a"]
+    expect(subject.encoding).to eq Encoding::UTF_8
+  end
+
+  it "transcodes UTF-16 sources" do
+    text = "<?xml version=\"1.0\"?>\n<greeting lang='\u00e9'>Hello, w\u00f6rld \u20ac \u{1F600} and some more ASCII</greeting>"
+    expected = [[:xml_header, ""], [:text, "\n"], [:begin, "greeting"],
+                [:text, "Hello, w\u00f6rld \u20ac \u{1F600} and some more ASCII"], [:end, "greeting"]]
+
+    ["\uFEFF#{text}".encode("UTF-16LE"), text.encode("UTF-16BE")].each do |source|
+      subject = described_class.new
+      expect(subject.open_string("test", source.b)).to eq true
+      nodes = []
+      subject.each { |node| nodes << [node.type, node.text.force_encoding("UTF-8")] }
+      expect(nodes).to eq expected
+      expect(subject.encoding).to eq source.encoding
+    end
+
+    results = RUXML.parse_many([text.encode("UTF-16LE").b]) do |parser|
+      texts = []
+      parser.each { |node| texts << node.text.force_encoding("UTF-8") if node.type == :text }
+      texts
+    end
+    expect(results).to eq [["\n", expected[3][1]]]
+
+    subject = described_class.new
+    expect(subject.open_string("test", "\xFF\xFE<\x00\x00\xD8a\x00".b)).to eq false
+    expect(subject.error.code).to eq :invalid_encoding
+    expect(subject.error.offset).to eq 4
+  end
+
+  it "validates UTF-8 when asked to" do
+    prefix = "<doc>\n  <a>#{"plain ascii " * 4}caf\u00e9 \u20ac \u{1F600}</a>\n  <b>"
+    ["\xC0\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xE2\x82", "\x80"].each do |invalid|
+      source = "#{prefix}#{invalid}</b>\n</doc>".b
+
+      expect(described_class.new.open_string("test", source)).to eq true
+
+      subject = described_class.new(validate_utf8: true)
+      expect(subject.open_string("test", source)).to eq false
+      expect(subject.error.code).to eq :invalid_encoding
+      expect(subject.error.offset).to eq prefix.bytesize
+      expect(subject.error.line).to eq 3
+      expect(subject.error.column).to eq 6
+    end
+
+    subject = described_class.new(validate_utf8: true)
+    expect(subject.open_string("test", "#{prefix}</b>\n</doc>")).to eq true
+  end
+
+  it "drops whitespace text and comments when asked to" do
+    source = "<list>\n" + 3.times.map { |i| "    <!-- item #{i} -->\n    <item>\n\t\t  value #{i}  \r\n    </item>\n" }.join + "</list>"
+    read = lambda do |options|
+      parser = described_class.new(**options)
+      parser.open_string("test", source)
+      nodes = []
+      parser.each { |node| nodes << [node.type, node.text, node.line, node.whitespace] }
+      nodes
+    end
+
+    all = read.call({})
+    expect(all.size).to eq 21
+    expect(all.count { |node| node[3] }).to eq 7
+    expect(all.last).to eq [:end, "list", 14, false]
+
+    skipped = read.call(skip_whitespace_text: true, skip_comments: true)
+    expect(skipped.map { |node| node[0..1] }).to eq [[:begin, "list"]] +
+      3.times.flat_map { |i| [[:begin, "item"], [:text, "\n\t\t  value #{i}  \r\n    "], [:end, "item"]] } + [[:end, "list"]]
+    expect(skipped.map { |node| node[2] }).to eq all.reject { |node| node[3] || node[0] == :comment }.map { |node| node[2] }
+
+    trimmed = read.call(trim_text: true)
+    expect(trimmed.select { |node| node[0] == :text }.map { |node| node[1] }).to eq ["value 0", "value 1", "value 2"]
+    expect(trimmed.count { |node| node[0] == :comment }).to eq 3
+  end
+
+  it "leaves positions out when asked to, still locating errors" do
+    source = "<list>\n  <!-- a\n  note -->\n  <row id=\"1\"\n    x='2'>text</row>\n  <!-- b -- c -->\n</list>"
+    read = lambda do |options|
+      parser = described_class.new(**options)
+      parser.open_string("test", source)
+      nodes = []
+      begin
+        parser.each { |node| nodes << [node.type, node.text, node.offset, node.line, node.column_start, node.column_end] }
+      rescue RUXML::ParseError => e
+        nodes << e.message
+      end
+      nodes
+    end
+
+    all = read.call(skip_comments: true)
+    bare = read.call(skip_comments: true, skip_positions: true)
+    expect(bare.size).to eq all.size
+    expect(bare[0...-1]).to eq all[0...-1].map { |node| node[0, 3] + [0, 0, 0] }
+    expect(all.last).to include "test:6:"
+    expect(bare.last).to eq all.last
+    expect(read.call({}).last).to eq all.last
+  end
+
+  it "replays files from an event cache" do
+    Tempfile.create(["cached", ".xml"]) do |file|
+      items = 5000.times.map { |i| "<item id=\"#{i}\"><x:v xmlns:x='urn:v'>#{i}</x:v><!-- #{i} --></item>" }
+      file.write("<doc>" + items.join + "<item id=7>\n</item></doc>")
+      file.flush
+      cache_path = file.path + ".cache"
+      read = lambda do |cached, **options|
+        parser = described_class.new(recover: true, resolve_namespaces: true, **options)
+        hit = cached ? parser.open_file_cached(file.path, cache_path) : parser.open_file(file.path)
+        nodes = []
+        parser.each do |node|
+          nodes << [node.type, node.text, node.offset, node.line, node.column_start, node.namespace_id,
+                    parser.node_attributes, parser.path]
+        end
+        [hit, nodes]
+      end
+
+      begin
+        expected = read.call(false)[1]
+        expect(read.call(true)).to eq [false, expected]
+        expect(read.call(true)).to eq [true, expected]
+        expect(expected.last).to eq [:end, "doc", file.size - 6, 2, 8, 0, {}, "/doc"]
+
+        parser = described_class.new(recover: true, resolve_namespaces: true)
+        File.utime(Time.now, Time.now + 5, file.path)
+        expect(parser.open_cache(file.path, cache_path)).to eq :current
+        File.open(cache_path, "r+b") { |cache| cache.pwrite(255.chr, 168) } # The type of the first node
+        expect(parser.open_cache(file.path, cache_path)).to eq :current
+        expect(parser.next_node).to be_falsey
+        expect(parser.error.code).to eq :open_failed
+        expect(described_class.new(recover: true).open_cache(file.path, cache_path)).to eq :stale
+        expect(read.call(true, skip_comments: true)).to eq [false, expected.reject { |node| node[0] == :comment }]
+
+        File.truncate(cache_path, 100)
+        expect(parser.open_cache(file.path, cache_path)).to eq :missing
+        expect(parser.get_node.text).to eq "doc"
+        file.write(" ")
+        file.flush
+        expect(parser.build_cache(file.path, cache_path)).to eq true
+        expect(Dir.glob(cache_path + ".*")).to eq []
+        expect(described_class.new.open_cache(file.path, cache_path)).to eq :stale
+
+        parser = described_class.new
+        expect { parser.build_cache(file.path, "/nonexistent_dir/c.cache") }.to raise_error(Errno::ENOENT)
+        expect(parser.open_file_cached(file.path, "/nonexistent_dir/c.cache")).to eq false
+        expect(parser.get_node.text).to eq "doc"
+      ensure
+        File.delete(cache_path) if File.exist?(cache_path)
+      end
+    end
+  end
+
+  it "tokenizes attributes lazily when asked to" do
+    long_value = "x" * 40 + "/>\n" + "y" * 40
+    source = "<list>\n  <row id=\"1\" note='#{long_value}'\n       sku=\"A-1\"/>\n  <row id=\"2\">text</row>\n</list>"
+    read = lambda do |options|
+      parser = described_class.new(**options)
+      parser.open_string("test", source)
+      nodes = []
+      parser.each do |node|
+        attributes = node.type == :begin ? parser.node_attributes : nil
+        nodes << [node.type, node.text, node.line, node.column_start, node.column_end, node.tag_end, node.self_closing, attributes]
+      end
+      nodes
+    end
+    expect(read.call(lazy_attributes: true)).to eq read.call({})
+
+    parser = described_class.new(lazy_attributes: true)
+    parser.open_string("test", source)
+    names = []
+    parser.each { |node| names << [node.text, node.attribute_count] if node.type == :begin }
+    expect(names).to eq [["list", 0], ["row", nil], ["row", nil]]
+
+    parser.open_string("test", "<a><b id=7>text</b></a>")
+    parser.next_node
+    parser.next_node
+    expect(parser.node_text).to eq "b"
+    expect(parser.errored).to eq false
+    expect { parser.node_attributes }.not_to raise_error
+    expect(parser.errored).to eq true
+    expect(parser.error.code).to eq :invalid_character
+    expect(parser.next_node).to be_falsey
+  end
+
+  it "reports files that can not be opened" do
+    subject { described_class.new }
+
+    expect(subject.open_file("./spec/fixtures/missing.xml")).to eq false
+    expect(subject.error.code).to eq :open_failed
+    expect(subject.error.message).to include "No such file"
+  end
 end
@@ -0,0 +1,37 @@
+require 'ruxml'
+
+describe RUXML::Parser, type: :lib do
+  describe "filter" do
+    let(:xml) { "<?xml version=\"1.0\"?>\n<doc>\n  <keep a='1'>x</keep>\n  <secret><b>y</b></secret>\n  <redact>z<i/></redact><!--c-->\n</doc>\n" }
+
+    it "copies kept nodes and drops subtrees" do
+      subject.open_string("test", xml)
+      writer = RUXML::Writer.new
+
+      subject.filter(writer) do |parser|
+        case parser.node_text
+        when "secret" then :drop
+        when "redact" then :drop_content
+        else parser.node_type != :comment
+        end
+      end
+
+      expect(writer.to_s).to eq "<?xml version=\"1.0\"?>\n<doc>\n  <keep a='1'>x</keep>\n  \n  <redact></redact>\n</doc>\n"
+    end
+
+    it "keeps a byte order mark and refuses UTF-16 sources" do
+      subject.open_string("test", "\uFEFF<a><b/></a>")
+      writer = RUXML::Writer.new
+      subject.filter(writer) { |parser| parser.node_text != "b" }
+      expect(writer.to_s.b).to eq "\xEF\xBB\xBF<a></a>".b
+
+      subject.open_string("test", "\uFEFF<?xml version='1.0' encoding='UTF-16'?><a/>".encode("UTF-16LE").b)
+      expect { subject.filter(RUXML::Writer.new) { :keep } }.to raise_error(ArgumentError)
+    end
+
+    it "raises on broken XML" do
+      subject.open_string("test", "<a></a@>")
+      expect { subject.filter(RUXML::Writer.new) { :keep } }.to raise_error(RUXML::ParseError)
+    end
+  end
+end
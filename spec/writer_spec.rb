@@ -0,0 +1,75 @@
+require 'ruxml'
+require 'stringio'
+
+describe RUXML::Writer, type: :lib do
+  it "writes compact XML with escaping" do
+    writer = described_class.new
+    writer.xml_header
+    writer.element("root", id: "a\"<b>'") do
+      writer.text("1 < 2 & 3 > 2")
+      writer.element("empty")
+      writer.begin_element("item", "ns")
+      writer.attribute("lang", "en", "xml")
+      writer.comment("note")
+      writer.end_element
+    end
+
+    expect(writer.to_s).to eq '<?xml version="1.0" encoding="UTF-8"?>' \
+      '<root id="a&quot;&lt;b&gt;&apos;">1 &lt; 2 &amp; 3 &gt; 2<empty/><ns:item xml:lang="en"><!--note--></ns:item></root>'
+  end
+
+  it "keeps comments well-formed" do
+    writer = described_class.new
+    writer.element("a") { writer.comment("x -- y-") }
+    expect(writer.to_s).to eq "<a><!--x - - y- --></a>"
+
+    parser = RUXML::Parser.new
+    parser.open_string("test", writer.to_s)
+    parser.next_node
+    expect(parser.get_node.text).to eq "x - - y- "
+  end
+
+  it "pretty prints nested elements" do
+    writer = described_class.new(nil, pretty: true, indent: 2)
+    writer.element("a") do
+      writer.element("b") { writer.text("x") }
+      writer.element("c")
+    end
+
+    expect(writer.to_s).to eq "<a>\n  <b>x</b>\n  <c/>\n</a>"
+  end
+
+  it "writes to an IO" do
+    io = StringIO.new
+    writer = described_class.new(io)
+    writer.element("a") { writer.text("b") }
+    writer.flush
+
+    expect(io.string).to eq "<a>b</a>"
+
+    io = StringIO.new
+    failing = true
+    io.define_singleton_method(:write) { |bytes| failing ? (failing = false; raise IOError, "full") : super(bytes) }
+    writer = described_class.new(io)
+    writer.element("a")
+    expect { writer.flush }.to raise_error(IOError)
+    writer.element("b")
+    writer.flush
+    expect(io.string).to eq "<b/>"
+  end
+
+  it "round trips parsed nodes" do
+    xml = "<?xml version=\"1.0\"?><a x='1' y='say \"hi\"'>t&amp;t<ns:b/><!--c--></a>"
+    parser = RUXML::Parser.new
+    parser.open_string("test", xml)
+
+    writer = described_class.new
+    writer.write_node(parser) while parser.next_node
+
+    expect(writer.to_s).to eq xml.sub("x='1'", 'x="1"')
+  end
+
+  it "raises when ending an element that was never begun" do
+    expect { described_class.new.end_element }.to raise_error(RuntimeError)
+  end
+end